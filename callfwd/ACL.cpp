@@ -9,6 +9,7 @@
 #include <folly/Conv.h>
 #include <folly/synchronization/Hazptr.h>
 #include <proxygen/lib/utils/Time.h>
+#include <uuid/uuid.h>
 
 using folly::IPAddress;
 using folly::Optional;
@@ -19,6 +20,7 @@ class ACL::Rule {
   SystemTimePoint created;
   Optional<SystemTimePoint> expire;
   mutable folly::TokenBucket callBudget{1e10, 1e10};
+  Optional<ACL::Attestation> attestation;
 };
 
 class ACL::Data : public folly::hazptr_obj_base<ACL::Data> {
@@ -47,6 +49,26 @@ int ACL::isCallAllowed(const IPAddress &peer) const
     return 429;
 }
 
+const ACL::Attestation* ACL::attestation(const IPAddress &peer) const
+{
+  if (!data_)
+    return nullptr;
+  auto it = data_->origin.find(peer);
+  if (it == data_->origin.cend() || !it->second.attestation)
+    return nullptr;
+  return &*it->second.attestation;
+}
+
+static ACL::Attestation parseAttestation(folly::StringPiece attest,
+                                         folly::StringPiece origid) {
+  if (attest != "A" && attest != "B" && attest != "C")
+    throw std::runtime_error("attestation must be A, B or C");
+  uuid_t uuid;
+  if (!origid.empty() && uuid_parse(origid.str().c_str(), uuid) == -1)
+    throw std::runtime_error("origid must be a UUID");
+  return {attest.str(), origid.str()};
+}
+
 static SystemTimePoint parsePostgresTime(std::string value) {
   std::tm tm = {};
   std::stringstream ss(std::move(value));
@@ -68,13 +90,16 @@ std::unique_ptr<ACL::Data> ACL::fromCSV(std::istream &in, size_t& line) {
     folly::split(',', linebuf, row);
     ++line;
 
-    if (row.size() == 4) {
+    if (row.size() >= 4 && row.size() <= 6) {
       if (!row[1].empty())
         rule.created = parsePostgresTime(row[1].str());
       if (!row[2].empty())
         rule.expire = parsePostgresTime(row[2].str());
       if (auto cps = folly::tryTo<double>(row[3]))
         rule.callBudget.reset(*cps, std::max(*cps, 1.));
+      rule.attestation.reset();
+      if (row.size() >= 5 && !row[4].empty())
+        rule.attestation = parseAttestation(row[4], row.size() == 6 ? row[5] : "");
       data->origin[folly::IPAddress(row[0])] = std::move(rule);
     } else {
       throw std::runtime_error("bad number of columns");
@@ -4,6 +4,7 @@
 #include <istream>
 #include <atomic>
 #include <memory>
+#include <string>
 #include <folly/synchronization/HazptrHolder.h>
 
 #include "CallFwd.h"
@@ -13,6 +14,13 @@ class ACL {
   class Rule;
   class Data;
 
+  /* SHAKEN attestation of calls from a peer */
+  struct Attestation {
+    std::string attest;
+    // empty to generate one per call
+    std::string origid;
+  };
+
   /** Construct taking ownership of Data. */
   ACL(std::unique_ptr<Data> data);
   /** Construct from globals and hold protected reference. */
@@ -26,6 +34,9 @@ class ACL {
   /* Check if peer is allowed at the moment */
   int isCallAllowed(const folly::IPAddress &peer) const;
 
+  /* Attestation to sign calls of peer with, nullptr if not configured */
+  const Attestation* attestation(const folly::IPAddress &peer) const;
+
   /* Construct Data from CSV stream */
   static std::unique_ptr<ACL::Data> fromCSV(std::istream &in, size_t &line);
 
@@ -1,10 +1,15 @@
 #include <functional>
+#include <string_view>
 #include <gflags/gflags.h>
 #include <folly/Likely.h>
 #include <folly/Range.h>
 #include <folly/Conv.h>
 #include <folly/Format.h>
+#include <folly/dynamic.h>
+#include <folly/json.h>
 #include <folly/small_vector.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
 #include <proxygen/lib/http/HTTPCommonHeaders.h>
 #include <proxygen/lib/http/HTTPMethod.h>
 #include <proxygen/lib/http/RFC2616.h>
@@ -13,17 +18,11 @@
 #include <proxygen/httpserver/ResponseBuilder.h>
 #include <proxygen/httpserver/filters/DirectResponseHandler.h>
 
-#include "PhoneMapping.h"
-#include "DncMapping.h"
-#include "DnoMapping.h"
-#include "TollFreeMapping.h"
-#include "LergMapping.h"
-#include "YoumailMapping.h"
-#include "GeoMapping.h"
-#include "FtcMapping.h"
-#include "F404Mapping.h"
-#include "F606Mapping.h"
+#include "CallFwd.h"
+#include "Datasets.h"
 #include "AccessLog.h"
+#include "HotCache.h"
+#include "Metrics.h"
 
 using namespace proxygen;
 using folly::StringPiece;
@@ -31,6 +30,25 @@ using folly::StringPiece;
 DEFINE_uint32(max_query_length, 32768,
               "Maximum length of POST x-www-form-urlencoded body");
 
+DEFINE_uint32(hot_cache_size, 0,
+              "Per-thread number of cached /target records and SIP routing "
+              "numbers, 0 disables the cache");
+
+static MetricHistogram targetBatchSize("callfwd_target_batch_size",
+                                       "Number of phone numbers per /target request");
+static MetricCounter targetCacheHits("callfwd_hot_cache_lookups_total",
+                                     "Number of phone numbers looked up in hot cache",
+                                     "endpoint=\"target\",result=\"hit\"");
+static MetricCounter targetCacheMisses("callfwd_hot_cache_lookups_total",
+                                       "Number of phone numbers looked up in hot cache",
+                                       "endpoint=\"target\",result=\"miss\"");
+
+/** Formatted /target records of the calling thread */
+static HotCache<std::string>& targetCache() {
+  static thread_local HotCache<std::string> cache(FLAGS_hot_cache_size);
+  return cache;
+}
+
 
 bool isJsonRequested(StringPiece accept) {
   RFC2616::TokenPairVec acceptTok;
@@ -85,147 +103,117 @@ class TargetHandler final : public RequestHandler {
 
   void onQueryComplete() noexcept {
     size_t N = pn_.size();
+    targetBatchSize.record(N);
     std::string record;
-    bool dnoAvailable = false;
-    bool dncAvailable = false;
-    bool tollfreeAvailable = false;
-    bool lergAvailable = false;
-    bool youmailAvailable = false;
-    bool geoAvailable = false;
-    bool ftcAvailable = false;
-    bool f404Available = false;
-    bool f606Available = false;
-
-    if (LIKELY(DncMapping::isAvailable())) {
-      dncAvailable = true;
-    } else {
-      dncAvailable = false;
-    }
-
-    if (LIKELY(DnoMapping::isAvailable())) {
-      dnoAvailable = true;
-    } else {
-      dnoAvailable = false;
-    }
-
-    if (LIKELY(TollFreeMapping::isAvailable())) {
-      tollfreeAvailable = true;
-    } else {
-      tollfreeAvailable = false;
-    }
-
-    if (LIKELY(LergMapping::isAvailable())) {
-      lergAvailable = true;
-    } else {
-      lergAvailable = false;
-    }
 
-    if (LIKELY(YoumailMapping::isAvailable())) {
-      youmailAvailable = true;
-    } else {
-      youmailAvailable = false;
-    }
-
-    if (LIKELY(GeoMapping::isAvailable())) {
-      geoAvailable = true;
-    } else {
-      geoAvailable = false;
-    }
-
-    if (LIKELY(FtcMapping::isAvailable())) {
-      ftcAvailable = true;
-    } else {
-      ftcAvailable = false;
+    // All answers come from one snapshot, even if a reload runs meanwhile
+    Datasets db = Datasets::get();
+    if (UNLIKELY(!db.isAvailable())) {
+      ResponseBuilder(downstream_)
+        .status(503, "Service Unavailable")
+        .sendWithEOM();
+      return;
     }
 
-    if (LIKELY(F404Mapping::isAvailable())) {
-      f404Available = true;
-    } else {
-      f404Available = false;
+    // Serve hot numbers from cache, look up only the rest
+    uint64_t generation = db.generation();
+    HotCache<std::string> &cache = targetCache();
+    cached_.resize(N);
+    for (size_t i = 0; i < N; ++i) {
+      cached_[i] = cache.find(cacheKey(pn_[i]), generation);
+      if (!cached_[i])
+        miss_.push_back(pn_[i]);
     }
-
-    if (LIKELY(F606Mapping::isAvailable())) {
-      f606Available = true;
-    } else {
-      f606Available = false;
+    size_t M = miss_.size();
+    if (cache.enabled()) {
+      targetCacheHits.inc(N - M);
+      targetCacheMisses.inc(M);
     }
 
-    us_rn_.resize(N);
-    ca_rn_.resize(N);
+    const DncMapping *dnc = db.get<DncMapping>();
+    const DnoMapping *dno = db.get<DnoMapping>();
+    const TollFreeMapping *tollfree = db.get<TollFreeMapping>();
+    const LergMapping *lerg = db.get<LergMapping>();
+    const YoumailMapping *youmail = db.get<YoumailMapping>();
+    const GeoMapping *geo = db.get<GeoMapping>();
+    const FtcMapping *ftc = db.get<FtcMapping>();
+    const F404Mapping *f404 = db.get<F404Mapping>();
+    const F606Mapping *f606 = db.get<F606Mapping>();
+    bool dncAvailable = dnc != nullptr;
+    bool dnoAvailable = dno != nullptr;
+    bool tollfreeAvailable = tollfree != nullptr;
+    bool lergAvailable = lerg != nullptr;
+    bool youmailAvailable = youmail != nullptr;
+    bool geoAvailable = geo != nullptr;
+    bool ftcAvailable = ftc != nullptr;
+    bool f404Available = f404 != nullptr;
+    bool f606Available = f606 != nullptr;
+
+    us_rn_.resize(M);
+    ca_rn_.resize(M);
     if (dncAvailable)
-      us_dnc_.resize(N);
+      us_dnc_.resize(M);
     if (dnoAvailable)
-      us_dno_.resize(N);
+      us_dno_.resize(M);
     if (tollfreeAvailable)
-      us_tollfree_.resize(N);
+      us_tollfree_.resize(M);
     if (lergAvailable)
-      us_lerg_.resize(N);
+      us_lerg_.resize(M);
     if (youmailAvailable)
-      us_youmail_.resize(N);
+      us_youmail_.resize(M);
     if (geoAvailable)
-      us_geo_.resize(N);
+      us_geo_.resize(M);
     if (ftcAvailable)
-      us_ftc_.resize(N);
+      us_ftc_.resize(M);
     if (f404Available)
-      us_f404_.resize(N);
+      us_f404_.resize(M);
     if (f606Available)
-      us_f606_.resize(N);
+      us_f606_.resize(M);
 
-    PhoneMapping::getUS()
-      .getRNs(N, pn_.data(), us_rn_.data());
-    PhoneMapping::getCA()
-      .getRNs(N, pn_.data(), ca_rn_.data());
+    db.us().getRNs(M, miss_.data(), us_rn_.data());
+    db.ca().getRNs(M, miss_.data(), ca_rn_.data());
 
     if (dncAvailable)
-      DncMapping::getDNC()
-        .getDNCs(N, pn_.data(), us_dnc_.data());
+      dnc->lookups(M, miss_.data(), us_dnc_.data());
 
     if (dnoAvailable)
-      DnoMapping::getDNO()
-        .getDNOs(N, pn_.data(), us_dno_.data());
+      dno->lookups(M, miss_.data(), us_dno_.data());
 
     if (tollfreeAvailable)
-      TollFreeMapping::getTollFree()
-        .getTollFrees(N, pn_.data(), us_tollfree_.data());
+      tollfree->lookups(M, miss_.data(), us_tollfree_.data());
 
     if (lergAvailable) {
       folly::small_vector<uint64_t, 16> lerg_search_key;
-      lerg_search_key.resize(N);
+      lerg_search_key.resize(M);
 
-      for (size_t i = 0; i < N; ++i) {
-        uint64_t rn = us_rn_[i];
+      for (size_t j = 0; j < M; ++j) {
+        uint64_t rn = us_rn_[j];
         if (rn == PhoneNumber::NONE)
-          rn = ca_rn_[i];
+          rn = ca_rn_[j];
 
         if (rn != PhoneNumber::NONE)
-          lerg_search_key[i] = rn;
+          lerg_search_key[j] = rn;
         else
-          lerg_search_key[i] = pn_[i];
+          lerg_search_key[j] = miss_[j];
       }
 
-      LergMapping::getLerg()
-        .getLergs(N, lerg_search_key.data(), us_lerg_.data());
+      lerg->lookups(M, lerg_search_key.data(), us_lerg_.data());
     }
 
     if (youmailAvailable)
-      YoumailMapping::getYoumail()
-        .getYoumails(N, pn_.data(), us_youmail_.data());
+      youmail->lookups(M, miss_.data(), us_youmail_.data());
 
     if (geoAvailable)
-      GeoMapping::getGeo()
-        .getGeos(N, pn_.data(), us_geo_.data());
+      geo->lookups(M, miss_.data(), us_geo_.data());
 
     if (ftcAvailable)
-      FtcMapping::getFtc()
-        .getFtcs(N, pn_.data(), us_ftc_.data());
+      ftc->lookups(M, miss_.data(), us_ftc_.data());
 
     if (f404Available)
-      F404Mapping::getF404()
-        .getF404s(N, pn_.data(), us_f404_.data());
+      f404->lookups(M, miss_.data(), us_f404_.data());
 
     if (f606Available)
-      F606Mapping::getF606()
-        .getF606s(N, pn_.data(), us_f606_.data());
+      f606->lookups(M, miss_.data(), us_f606_.data());
 
     ResponseBuilder(downstream_)
       .status(200, "OK")
@@ -235,10 +223,17 @@ class TargetHandler final : public RequestHandler {
 
     if (json_)
       record += "[\n";
+    size_t j = 0;
     for (size_t i = 0; i < N; ++i) {
-      uint64_t rn = us_rn_[i];
+      const char *sep = (i == N-1) ? "\n" : ",\n";
+      if (cached_[i]) {
+        folly::format(&record, "  {}{}", *cached_[i], sep);
+        continue;
+      }
+
+      uint64_t rn = us_rn_[j];
       if (rn == PhoneNumber::NONE)
-        rn = ca_rn_[i];
+        rn = ca_rn_[j];
 
       std::string lrn_str = std::string("");
       std::string dno_str = std::string("");
@@ -253,136 +248,137 @@ class TargetHandler final : public RequestHandler {
       
       if (json_) {
         if (rn != PhoneNumber::NONE)
-          lrn_str = folly::format("\"pn\": \"{}\", \"rn\": \"{}\"", pn_[i], rn).str();
+          lrn_str = folly::format("\"pn\": \"{}\", \"rn\": \"{}\"", miss_[j], rn).str();
         else
-          lrn_str = folly::format("\"pn\": \"{}\", \"rn\": null", pn_[i]).str();
+          lrn_str = folly::format("\"pn\": \"{}\", \"rn\": null", miss_[j]).str();
 
-        if (!dncAvailable || us_dnc_[i] == 0)
+        if (!dncAvailable || us_dnc_[j] == 0)
           dnc_str = std::string("\"is_dnc\": \"no\"");
         else
           dnc_str = std::string("\"is_dnc\": \"yes\"");
           
-        if (!dnoAvailable || us_dno_[i] == 0)
+        if (!dnoAvailable || us_dno_[j] == 0)
           dno_str = std::string("\"is_dno\": \"no\"");
         else
           dno_str = std::string("\"is_dno\": \"yes\"");
 
-        if (!tollfreeAvailable || us_tollfree_[i] == 0)
+        if (!tollfreeAvailable || us_tollfree_[j] == 0)
           tollfree_str = std::string("\"is_tollfree\": \"no\"");
         else
           tollfree_str = std::string("\"is_tollfree\": \"yes\"");
 
-        if (!lergAvailable || us_lerg_[i].lerg_key == 0)
+        if (!lergAvailable || us_lerg_[j].lerg_key == 0)
           lerg_str = std::string("\"ocn\":: null, \"operator\": null, \"ocn_type\": null, \"lata\": null, \"rate_center\": null, \"country\": null");
         else {
           lerg_str = folly::format("\"ocn\": \"{}\", \"operator\": \"{}\", \"ocn_type\": \"{}\", \"lata\": \"{}\", \"rate_center\": \"{}\", \"country\": \"{}\"", 
-            us_lerg_[i].ocn, us_lerg_[i].company, us_lerg_[i].ocn_type, us_lerg_[i].lata, us_lerg_[i].rate_center, us_lerg_[i].country).str();
+            us_lerg_[j].ocn, us_lerg_[j].company, us_lerg_[j].ocn_type, us_lerg_[j].lata, us_lerg_[j].rate_center, us_lerg_[j].country).str();
         }
 
-        if (!youmailAvailable || us_youmail_[i].pn == 0)
+        if (!youmailAvailable || us_youmail_[j].pn == 0)
           youmail_str = std::string("\"youmail_SpamScore\": null, \"youmail_FraudProbability\": null, \"youmail_Unlawful\": null, \" youmail_TCPAFraudProbability\": null");
         else {
           youmail_str = folly::format("\"youmail_SpamScore\": \"{}\", \"youmail_FraudProbability\": \"{}\", \"youmail_Unlawful\": \"{}\", \"youmail_TCPAFraudProbability\": \"{}\"", 
-            us_youmail_[i].sapmscore, us_youmail_[i].fraudprobability, us_youmail_[i].unlawful, us_youmail_[i].tcpafraud).str();
+            us_youmail_[j].sapmscore, us_youmail_[j].fraudprobability, us_youmail_[j].unlawful, us_youmail_[j].tcpafraud).str();
         }
         
-        if (!geoAvailable || us_geo_[i].npanxx == 0)
+        if (!geoAvailable || us_geo_[j].npanxx == 0)
           geo_str = std::string("\"zipcode\": null, \"county\": null, \"city\": null, \" latitude\": null, \" longitude\": null, \" timezone\": null");
         else {
           geo_str = folly::format("\"zipcode\": \"{}\", \"county\": \"{}\", \"city\": \"{}\", \"latitude\": \"{}\", \"longitude\": \"{}\", \"timezone\": \"{}\"", 
-            us_geo_[i].zipcode, us_geo_[i].county, us_geo_[i].city, us_geo_[i].latitude, us_geo_[i].longitude, us_geo_[i].timezone).str();
+            us_geo_[j].zipcode, us_geo_[j].county, us_geo_[j].city, us_geo_[j].latitude, us_geo_[j].longitude, us_geo_[j].timezone).str();
         }
 
-        if (!ftcAvailable || us_ftc_[i].pn == 0)
+        if (!ftcAvailable || us_ftc_[j].pn == 0)
           ftc_str = std::string("\"is_ftc\": \"no\", \"last_ftc_on\": null, \"first_ftc_on\": null, \"ftc_count\": null");
         else {
           ftc_str = folly::format("\"is_ftc\": \"yes\", \"last_ftc_on\": \"{}\", \"first_ftc_on\": \"{}\", \" ftc_count\": \"{}\"", 
-            us_ftc_[i].last_ftc_on, us_ftc_[i].first_ftc_on, us_ftc_[i].ftc_count).str();
+            us_ftc_[j].last_ftc_on, us_ftc_[j].first_ftc_on, us_ftc_[j].ftc_count).str();
         }
 
-        if (!f404Available || us_f404_[i].pn == 0)
+        if (!f404Available || us_f404_[j].pn == 0)
           f404_str = std::string("\"first_404_on\": null, \"last_404_on\": null");
         else {
           f404_str = folly::format("\"first_404_on\": \"{}\", \"last_404_on\": \"{}\"", 
-            us_f404_[i].first_F404_on, us_f404_[i].last_F404_on).str();
+            us_f404_[j].first_F404_on, us_f404_[j].last_F404_on).str();
         }
 
-        if (!f606Available || us_f606_[i].pn == 0)
+        if (!f606Available || us_f606_[j].pn == 0)
           f606_str = std::string("\"first_6xx_on\": null, \"last_6xx_on\": null");
         else {
           f606_str = folly::format("\"first_6xx_on\": \"{}\", \"last_6xx_on\": \"{}\"", 
-            us_f606_[i].first_F606_on, us_f606_[i].last_F606_on).str();
+            us_f606_[j].first_F606_on, us_f606_[j].last_F606_on).str();
         }
 
       } else {
         if (rn != PhoneNumber::NONE)
-          lrn_str = folly::format("pn={},lrn={}", pn_[i], rn).str();
+          lrn_str = folly::format("pn={},lrn={}", miss_[j], rn).str();
         else
-          lrn_str = folly::format("pn={},lrn=null", pn_[i]).str();
+          lrn_str = folly::format("pn={},lrn=null", miss_[j]).str();
 
-        if (!dncAvailable || us_dnc_[i] == 0)
+        if (!dncAvailable || us_dnc_[j] == 0)
           dnc_str = std::string("is_dnc=no");
         else
           dnc_str = std::string("is_dnc=yes");
         
-        if (!dnoAvailable || us_dno_[i] == 0)
+        if (!dnoAvailable || us_dno_[j] == 0)
           dno_str = std::string("is_dno=no");
         else
           dno_str = std::string("is_dno=yes");
 
-        if (!tollfreeAvailable || us_tollfree_[i] == 0)
+        if (!tollfreeAvailable || us_tollfree_[j] == 0)
           tollfree_str = std::string("is_tollfree=no");
         else
           tollfree_str = std::string("is_tollfree=yes");
         
-        if (!lergAvailable || us_lerg_[i].lerg_key == 0)
+        if (!lergAvailable || us_lerg_[j].lerg_key == 0)
           lerg_str = std::string("ocn=null, operator=null, ocn_type=null, lata=null, rate_center=null, country=null ");
         else {
           lerg_str = folly::format("ocn={}, operator={}, ocn_type={}, lata={}, rate_center={}, country={}", 
-            us_lerg_[i].ocn, us_lerg_[i].company, us_lerg_[i].ocn_type, us_lerg_[i].lata, us_lerg_[i].rate_center, us_lerg_[i].country).str();
+            us_lerg_[j].ocn, us_lerg_[j].company, us_lerg_[j].ocn_type, us_lerg_[j].lata, us_lerg_[j].rate_center, us_lerg_[j].country).str();
         }
 
-        if (!youmailAvailable || us_youmail_[i].pn == 0)
+        if (!youmailAvailable || us_youmail_[j].pn == 0)
           youmail_str = std::string("youmail_SpamScore=null, youmail_FraudProbability=null, youmail_Unlawful=null, youmail_TCPAFraudProbability=null");
         else {
           youmail_str = folly::format("youmail_SpamScore={}, youmail_FraudProbability={}, youmail_Unlawful={}, youmail_TCPAFraudProbability={}", 
-            us_youmail_[i].sapmscore, us_youmail_[i].fraudprobability, us_youmail_[i].unlawful, us_youmail_[i].tcpafraud).str();
+            us_youmail_[j].sapmscore, us_youmail_[j].fraudprobability, us_youmail_[j].unlawful, us_youmail_[j].tcpafraud).str();
         }
 
-        if (!geoAvailable || us_geo_[i].npanxx == 0)
+        if (!geoAvailable || us_geo_[j].npanxx == 0)
           geo_str = std::string("zipcode=null, county=null, city=null, latitude=null, longitude=null, timezone=null");
         else {
           geo_str = folly::format("zipcode={}, county={}, city={}, latitude={}, longitude={}, timezone={}", 
-            us_geo_[i].zipcode, us_geo_[i].county, us_geo_[i].city, us_geo_[i].latitude, us_geo_[i].longitude, us_geo_[i].timezone).str();
+            us_geo_[j].zipcode, us_geo_[j].county, us_geo_[j].city, us_geo_[j].latitude, us_geo_[j].longitude, us_geo_[j].timezone).str();
         }
 
-        if (!ftcAvailable || us_ftc_[i].pn == 0)
+        if (!ftcAvailable || us_ftc_[j].pn == 0)
           ftc_str = std::string("is_ftc=no, last_ftc_on=null, first_ftc_on=null, ftc_count=null");
         else {
           ftc_str = folly::format("is_ftc=yes, last_ftc_on={}, first_ftc_on={}, ftc_count={}", 
-            us_ftc_[i].last_ftc_on, us_ftc_[i].first_ftc_on, us_ftc_[i].ftc_count).str();
+            us_ftc_[j].last_ftc_on, us_ftc_[j].first_ftc_on, us_ftc_[j].ftc_count).str();
         }
 
-        if (!f404Available || us_f404_[i].pn == 0)
+        if (!f404Available || us_f404_[j].pn == 0)
           f404_str = std::string("first_404_on=null, last_404_on=null");
         else {
           f404_str = folly::format("first_404_on={}, last_404_on={}", 
-            us_f404_[i].first_F404_on, us_f404_[i].last_F404_on).str();
+            us_f404_[j].first_F404_on, us_f404_[j].last_F404_on).str();
         }
 
-        if (!f606Available || us_f606_[i].pn == 0)
+        if (!f606Available || us_f606_[j].pn == 0)
           f606_str = std::string("first_6xx_on=null, last_6xx_on=null");
         else {
           f606_str = folly::format("first_6xx_on={}, last_6xx_on={}", 
-            us_f606_[i].first_F606_on, us_f606_[i].last_F606_on).str();
+            us_f606_[j].first_F606_on, us_f606_[j].last_F606_on).str();
         }
 
       }
 
-      if (i == N-1)
-        folly::format(&record, "  {{{}, {}, {}, {}, {}, {}, {}, {}, {}, {}}}\n", lrn_str, dno_str, dnc_str, tollfree_str, lerg_str, youmail_str, geo_str, ftc_str, f404_str, f606_str);
-      else
-        folly::format(&record, "  {{{}, {}, {}, {}, {}, {}, {}, {}, {}, {}}},\n", lrn_str, dno_str, dnc_str, tollfree_str, lerg_str, youmail_str, geo_str, ftc_str, f404_str, f606_str);
+      size_t begin = record.size() + 2;
+      folly::format(&record, "  {{{}, {}, {}, {}, {}, {}, {}, {}, {}, {}}}", lrn_str, dno_str, dnc_str, tollfree_str, lerg_str, youmail_str, geo_str, ftc_str, f404_str, f606_str);
+      fresh_.emplace_back(begin, record.size() - begin);
+      record += sep;
+      ++j;
 
       //if (record.size() > 1000) {   
       //  downstream_->sendBody(folly::IOBuf::copyBuffer(record));
@@ -393,11 +389,22 @@ class TargetHandler final : public RequestHandler {
     if (json_)
       record += "]\n";
 
+    // Cached records are referenced until here, don't evict them earlier
+    for (size_t j = 0; j < M; ++j) {
+      cache.insert(cacheKey(miss_[j]), generation,
+                   std::string_view(record.data() + fresh_[j].first, fresh_[j].second));
+    }
+
     if (!record.empty())
       downstream_->sendBody(folly::IOBuf::copyBuffer(record));
     downstream_->sendEOM();
   }
 
+  /** Records differ by output format, cache them separately */
+  uint64_t cacheKey(uint64_t pn) const noexcept {
+    return pn << 1 | json_;
+  }
+
   void onQueryString(StringPiece query) {
     using namespace std::placeholders;
     auto paramFn = std::bind(&TargetHandler::onQueryParam, this, _1, _2);
@@ -455,6 +462,10 @@ class TargetHandler final : public RequestHandler {
   bool json_ = false;
   std::unique_ptr<folly::IOBuf> body_;
   folly::small_vector<uint64_t, 16> pn_;
+  // numbers not found in hot cache and offsets of their fresh records
+  folly::small_vector<const std::string*, 16> cached_;
+  folly::small_vector<uint64_t, 16> miss_;
+  folly::small_vector<std::pair<size_t, size_t>, 16> fresh_;
   folly::small_vector<uint64_t, 16> us_rn_;
   folly::small_vector<uint64_t, 16> ca_rn_;
   folly::small_vector<uint64_t, 16> us_dnc_;
@@ -468,6 +479,24 @@ class TargetHandler final : public RequestHandler {
   folly::small_vector<F606Data, 16> us_f606_;
 };
 
+/** Convert up to 10 leading digits into a range of 10-digit numbers. */
+static bool parsePrefix(StringPiece value, std::pair<uint64_t, uint64_t> &range) {
+  if (value.size() > 10)
+    return false;
+
+  auto asInt = folly::tryTo<uint64_t>(value);
+  if (!asInt)
+    return false;
+
+  range.first = asInt.value();
+  range.second = range.first + 1;
+  for (size_t i = 0; i < 10 - value.size(); ++i) {
+    range.first *= 10;
+    range.second *= 10;
+  }
+  return true;
+}
+
 class ReverseHandler final : public RequestHandler {
  public:
   void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
@@ -531,23 +560,229 @@ class ReverseHandler final : public RequestHandler {
 
   void onQueryParam(StringPiece name, StringPiece value) {
     if (name == "prefix%5B%5D" || name == "prefix[]") {
-      uint64_t from, to;
+      std::pair<uint64_t, uint64_t> range;
+      if (parsePrefix(value, range))
+        query_.push_back(range);
+    }
+  }
 
-      if (value.size() > 10)
-        return;
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+  }
 
-      if (auto asInt = folly::tryTo<uint64_t>(value))
-        from = asInt.value();
-      else
-        return;
+  void onEOM() noexcept override {
+  }
+
+  void onUpgrade(UpgradeProtocol proto) noexcept override {
+    // handler doesn't support upgrades
+  }
 
-      to = from + 1;
-      for (size_t i = 0; i < 10 - value.size(); ++i) {
-        from *= 10;
-        to *= 10;
+  void requestComplete() noexcept override {
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    delete this;
+  }
+
+ private:
+  std::vector<std::pair<uint64_t, uint64_t>> query_;
+  std::string record_;
+};
+
+/** Range queries on the PN side: list ported numbers by PN prefix or
+  * count them, optionally grouped by leading digits (e.g. per NPA).
+  * Listings are sent in batches of rows from the event loop, a batch is
+  * produced only while the client keeps up with egress. */
+class PortedHandler final : public RequestHandler,
+                            private folly::EventBase::LoopCallback {
+ public:
+  explicit PortedHandler(bool count)
+    : count_(count)
+  {}
+
+  void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
+    using namespace std::placeholders;
+
+    HTTPMessage::splitNameValuePieces(req->getQueryStringAsStringPiece(), '&', '=',
+                                      std::bind(&PortedHandler::onQueryParam,
+                                                this, _1, _2));
+
+    // Listing needs a prefix, counts cover all numbers without one
+    if (query_.empty() && count_)
+      query_.push_back({"", {0, kAllNumbers}});
+    for (const Query &q : query_) {
+      if (digits_ > q.prefix.size() + kMaxGroupDigits)
+        badQuery_ = true;
+    }
+
+    if (req->getMethod() != HTTPMethod::GET || badQuery_ || query_.empty()) {
+      ResponseBuilder(downstream_)
+        .status(400, "Bad Request")
+        .sendWithEOM();
+      return;
+    }
+
+    const std::string &accept = req->getHeaders()
+      .getSingleOrEmpty(HTTP_HEADER_ACCEPT);
+    json_ = isJsonRequested(accept);
+
+    ResponseBuilder(downstream_)
+      .status(200, "OK")
+      .header(HTTP_HEADER_CONTENT_TYPE,
+              json_ ? "application/json" : "text/plain")
+      .send();
+
+    if (json_)
+      record_ += "[";
+    if (!count_) {
+      streaming_ = true;
+      resume_ = query_.front().range.first;
+      return sendRows();
+    }
+    PhoneMapping us = PhoneMapping::getUS();
+    PhoneMapping ca = PhoneMapping::getCA();
+    for (const Query &q : query_) {
+      uint64_t from = q.range.first, to = q.range.second;
+      if (digits_ == 0) {
+        sendCount(q.prefix, us.countPNs(from, to) + ca.countPNs(from, to));
+      } else {
+        sendGroups(us, ca, from, to);
       }
-      query_.emplace_back(from, to);
     }
+    finish();
+  }
+
+  /** Send the next batch of rows, US then CA for every prefix.
+    * A dataset is pinned only while a batch is sent, the next batch takes
+    * the current one again and continues after the last PN sent. So
+    * a stalled client never keeps a retired dataset from being freed. */
+  void sendRows() {
+    size_t budget = kRowsPerBatch;
+    while (budget > 0 && !paused_) {
+      if (next_ == 2 * query_.size())
+        return finish();
+      const Query &q = query_[next_ / 2];
+      PhoneMapping db = next_ % 2 == 0 ? PhoneMapping::getUS() : PhoneMapping::getCA();
+      db.inversePNs(resume_, q.range.second);
+      for (; budget > 0 && db.hasRow(); db.advance(), --budget) {
+        if (json_) {
+          folly::format(&record_, "{}\n  {{\"pn\": \"{}\", \"rn\": \"{}\"}}",
+                        separator(), db.currentPN(), db.currentRN());
+        } else {
+          folly::format(&record_, "{},{}\n", db.currentPN(), db.currentRN());
+        }
+        resume_ = db.currentPN() + 1;
+        flush();
+      }
+      if (!db.hasRow() && ++next_ < 2 * query_.size())
+        resume_ = query_[next_ / 2].range.first;
+    }
+
+    if (!record_.empty()) {
+      downstream_->sendBody(folly::IOBuf::copyBuffer(record_));
+      record_.clear();
+    }
+    // Yield to other requests, onEgressResumed() continues a paused one
+    if (!paused_)
+      folly::EventBaseManager::get()->getEventBase()->runInLoop(this);
+  }
+
+  void sendGroups(const PhoneMapping &us, const PhoneMapping &ca,
+                  uint64_t from, uint64_t to) {
+    uint64_t groupSize = 1;
+    for (unsigned i = digits_; i < 10; ++i)
+      groupSize *= 10;
+
+    // Both datasets produce ascending groups, merge them
+    std::vector<std::pair<uint64_t, size_t>> usGroups, caGroups;
+    auto collect = [](std::vector<std::pair<uint64_t, size_t>> &out) {
+      return [&out](uint64_t group, size_t count) {
+        out.emplace_back(group, count);
+      };
+    };
+    us.countPNs(from, to, groupSize, collect(usGroups));
+    ca.countPNs(from, to, groupSize, collect(caGroups));
+
+    auto u = usGroups.begin(), c = caGroups.begin();
+    while (u != usGroups.end() || c != caGroups.end()) {
+      uint64_t group;
+      size_t count = 0;
+      if (c == caGroups.end() || (u != usGroups.end() && u->first <= c->first)) {
+        group = u->first;
+        count += (u++)->second;
+      } else {
+        group = c->first;
+      }
+      if (c != caGroups.end() && c->first == group)
+        count += (c++)->second;
+
+      std::string prefix = folly::to<std::string>(group);
+      if (prefix.size() < digits_)
+        prefix.insert(0, digits_ - prefix.size(), '0');
+      sendCount(prefix, count);
+    }
+  }
+
+  void sendCount(StringPiece prefix, size_t count) {
+    if (json_) {
+      folly::format(&record_, "{}\n  {{\"prefix\": \"{}\", \"count\": {}}}",
+                    separator(), prefix, count);
+    } else {
+      folly::format(&record_, "{},{}\n", prefix, count);
+    }
+    flush();
+  }
+
+  void finish() {
+    streaming_ = false;
+    if (json_)
+      record_ += "\n]\n";
+    if (!record_.empty())
+      downstream_->sendBody(folly::IOBuf::copyBuffer(record_));
+    downstream_->sendEOM();
+  }
+
+  StringPiece separator() {
+    StringPiece sep = first_ ? "" : ",";
+    first_ = false;
+    return sep;
+  }
+
+  void flush() {
+    if (record_.size() > 1000) {
+      downstream_->sendBody(folly::IOBuf::copyBuffer(record_));
+      record_.clear();
+    }
+  }
+
+  void onQueryParam(StringPiece name, StringPiece value) {
+    if (name == "prefix%5B%5D" || name == "prefix[]") {
+      Query q{value.str(), {}};
+      if (parsePrefix(value, q.range))
+        query_.push_back(std::move(q));
+      else
+        badQuery_ = true;
+    } else if (name == "digits" && count_) {
+      auto digits = folly::tryTo<unsigned>(value);
+      if (digits && *digits >= 1 && *digits <= 10)
+        digits_ = *digits;
+      else
+        badQuery_ = true;
+    }
+  }
+
+  void runLoopCallback() noexcept override {
+    sendRows();
+  }
+
+  void onEgressPaused() noexcept override {
+    paused_ = true;
+  }
+
+  void onEgressResumed() noexcept override {
+    paused_ = false;
+    if (streaming_ && !isLoopCallbackScheduled())
+      sendRows();
   }
 
   void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
@@ -565,12 +800,107 @@ class ReverseHandler final : public RequestHandler {
   }
 
   void onError(ProxygenError err) noexcept override {
+    // a scheduled batch is cancelled by ~LoopCallback
     delete this;
   }
 
  private:
-  std::vector<std::pair<uint64_t, uint64_t>> query_;
+  static constexpr uint64_t kAllNumbers = 10000000000ull;
+  // groups per prefix are limited to 10^kMaxGroupDigits
+  static constexpr size_t kMaxGroupDigits = 4;
+  static constexpr size_t kRowsPerBatch = 1024;
+
+  struct Query {
+    std::string prefix;
+    std::pair<uint64_t, uint64_t> range;
+  };
+
+  const bool count_;
+  unsigned digits_ = 0;
+  bool json_ = false;
+  bool first_ = true;
+  bool badQuery_ = false;
+  std::vector<Query> query_;
   std::string record_;
+
+  // listing state: dataset being sent, query * 2 + (0 US, 1 CA),
+  // and the first PN of it not sent yet
+  size_t next_ = 0;
+  uint64_t resume_ = 0;
+  bool streaming_ = false;
+  bool paused_ = false;
+};
+
+class MetricsHandler final : public RequestHandler {
+ public:
+  void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
+    if (req->getMethod() != HTTPMethod::GET) {
+      ResponseBuilder(downstream_)
+        .status(400, "Bad Request")
+        .sendWithEOM();
+      return;
+    }
+
+    ResponseBuilder(downstream_)
+      .status(200, "OK")
+      .header(HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4")
+      .body(renderMetrics())
+      .sendWithEOM();
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+  }
+
+  void onEOM() noexcept override {
+  }
+
+  void onUpgrade(UpgradeProtocol proto) noexcept override {
+    // handler doesn't support upgrades
+  }
+
+  void requestComplete() noexcept override {
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    delete this;
+  }
+};
+
+class MemoryHandler final : public RequestHandler {
+ public:
+  void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
+    if (req->getMethod() != HTTPMethod::GET) {
+      ResponseBuilder(downstream_)
+        .status(400, "Bad Request")
+        .sendWithEOM();
+      return;
+    }
+
+    ResponseBuilder(downstream_)
+      .status(200, "OK")
+      .header(HTTP_HEADER_CONTENT_TYPE, "application/json")
+      .body(folly::toPrettyJson(memoryReport()) + "\n")
+      .sendWithEOM();
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+  }
+
+  void onEOM() noexcept override {
+  }
+
+  void onUpgrade(UpgradeProtocol proto) noexcept override {
+    // handler doesn't support upgrades
+  }
+
+  void requestComplete() noexcept override {
+    delete this;
+  }
+
+  void onError(ProxygenError err) noexcept override {
+    delete this;
+  }
 };
 
 class ApiHandlerFactory : public RequestHandlerFactory {
@@ -585,7 +915,7 @@ class ApiHandlerFactory : public RequestHandlerFactory {
   RequestHandler* makeHandler(Args&&... args)
   {
     if (LIKELY(PhoneMapping::isAvailable())) {
-      return new H(std::forward(args)...);
+      return new H(std::forward<Args>(args)...);
     } else {
       return new DirectResponseHandler(503, "Service Unavailable", "");
     }
@@ -598,6 +928,14 @@ class ApiHandlerFactory : public RequestHandlerFactory {
       return this->makeHandler<TargetHandler>();
     } else if (path == "/reverse") {
       return this->makeHandler<ReverseHandler>();
+    } else if (path == "/ported") {
+      return this->makeHandler<PortedHandler>(false);
+    } else if (path == "/ported/count") {
+      return this->makeHandler<PortedHandler>(true);
+    } else if (path == "/metrics") {
+      return new MetricsHandler;
+    } else if (path == "/memory") {
+      return new MemoryHandler;
     } else {
       return new DirectResponseHandler(404, "Not found", "");
     }
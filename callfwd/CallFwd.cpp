@@ -1,4 +1,5 @@
 #include <folly/init/Init.h>
+#include <folly/ssl/Init.h>
 #include <folly/Memory.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/async/AsyncUDPSocket.h>
@@ -6,6 +7,7 @@
 #include <folly/system/HardwareConcurrency.h>
 #include <folly/logging/AsyncFileWriter.h>
 #include <proxygen/httpserver/HTTPServer.h>
+#include <stir/KeyManager.h>
 
 #include "CallFwd.h"
 #include "AccessLog.h"
@@ -28,6 +30,7 @@ DEFINE_string(sip_if4, "", "IP/Hostname to bind SIP to");
 DEFINE_int32(threads, 0,
              "Number of threads to listen on. Numbers <= 0 "
              "will use the number of cores on this machine.");
+DECLARE_string(stir_keys);
 
 int main(int argc, char* argv[]) {
   folly::Init init(&argc, &argv);
@@ -35,6 +38,12 @@ int main(int argc, char* argv[]) {
   setlocale(LC_ALL, "C");
   startControlSocket();
 
+  // Sign 302 replies to peers with attestation in ACL
+  if (!FLAGS_stir_keys.empty()) {
+    folly::ssl::init();
+    KeyManager::load(FLAGS_stir_keys);
+  }
+
   CHECK(FLAGS_http_port < 65536);
   if (FLAGS_threads <= 0) {
     FLAGS_threads = folly::hardware_concurrency();
@@ -72,6 +81,8 @@ int main(int argc, char* argv[]) {
   options.receiveStreamWindowSize = uint32_t(1 << 20);
   options.receiveSessionWindowSize = 10 * (1 << 20);
   options.handlerFactories = RequestHandlerChain()
+    .addThen(makeNumaHandlerFactory())
+    .addThen(makeMetricsHandlerFactory())
     .addThen(makeAccessLogHandlerFactory())
     .addThen(makeApiHandlerFactory())
     .addThen(makeSipHandlerFactory(udpServer))
@@ -12,6 +12,7 @@ namespace folly {
   class IPAddress;
   class LogWriter;
   class EventBase;
+  struct dynamic;
 }
 namespace proxygen {
   class RequestHandlerFactory;
@@ -19,6 +20,10 @@ namespace proxygen {
 
 void startControlSocket();
 
+/** Memory used by every dataset, broken down by component, and by
+  * retired datasets not reclaimed yet. */
+folly::dynamic memoryReport();
+
 std::unique_ptr<proxygen::RequestHandlerFactory>
 makeApiHandlerFactory();
 
@@ -28,4 +33,10 @@ makeSipHandlerFactory(std::vector<std::shared_ptr<folly::AsyncUDPSocket>> socket
 std::unique_ptr<proxygen::RequestHandlerFactory>
 makeAccessLogHandlerFactory();
 
+std::unique_ptr<proxygen::RequestHandlerFactory>
+makeMetricsHandlerFactory();
+
+std::unique_ptr<proxygen::RequestHandlerFactory>
+makeNumaHandlerFactory();
+
 #endif // CALLFWD_CALLFWD_H
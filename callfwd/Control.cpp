@@ -1,8 +1,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <algorithm>
 #include <fstream>
+#include <tuple>
 #include <functional>
+#include <mutex>
 #include <thread>
 #include <atomic>
 #include <systemd/sd-daemon.h>
@@ -11,96 +14,179 @@
 #include <folly/dynamic.h>
 #include <folly/json.h>
 #include <folly/stop_watch.h>
+#include <folly/synchronization/Hazptr.h>
+#if USE_RCU
+#include <folly/synchronization/Rcu.h>
+#endif
 #include <folly/portability/GFlags.h>
 #include <folly/system/ThreadId.h>
 #include <folly/String.h>
 #include <folly/Format.h>
 
 #include "CallFwd.h"
-#include "PhoneMapping.h"
-#include "DncMapping.h"
-#include "DnoMapping.h"
-#include "TollFreeMapping.h"
-#include "LergMapping.h"
-#include "YoumailMapping.h"
-#include "GeoMapping.h"
-#include "FtcMapping.h"
-#include "F404Mapping.h"
-#include "F606Mapping.h"
+#include "DatasetStream.h"
+#include "Datasets.h"
 #include "ACL.h"
+#include "HugePages.h"
+#include "MemoryUsage.h"
+#include "Metrics.h"
+#include "Numa.h"
+#include <stir/KeyManager.h>
 
 using folly::StringPiece;
 
 DEFINE_uint32(status_report_period, 0,
               "How often (in seconds) long operation reports about its status");
+DECLARE_string(stir_keys);
 static auto reportPeriod = std::chrono::seconds(30);
 
-static std::atomic<PhoneMapping::Data*> mappingUS;
-static std::atomic<PhoneMapping::Data*> mappingCA;
-static std::atomic<DncMapping::Data*> mappingDNC;
-static std::atomic<DnoMapping::Data*> mappingDNO;
-static std::atomic<TollFreeMapping::Data*> mappingTollFree;
+// Hot tables have a replica per NUMA node with --numa=replicate
+static std::atomic<PhoneMapping::Data*> mappingUS[kMaxNumaNodes];
+static std::atomic<PhoneMapping::Data*> mappingCA[kMaxNumaNodes];
 static std::atomic<ACL::Data*> currentACL;
-static std::atomic<LergMapping::Data*> mappingLerg;
-static std::atomic<YoumailMapping::Data*> mappingYoumail;
-static std::atomic<GeoMapping::Data*> mappingGeo;
-static std::atomic<FtcMapping::Data*> mappingFtc;
-static std::atomic<F404Mapping::Data*> mapping404;
-static std::atomic<F606Mapping::Data*> mapping606;
-
-PhoneMapping PhoneMapping::getUS() noexcept { return { mappingUS }; }
-PhoneMapping PhoneMapping::getCA() noexcept { return { mappingCA }; }
-DnoMapping DnoMapping::getDNO() noexcept { return { mappingDNO }; }
-DncMapping DncMapping::getDNC() noexcept { return { mappingDNC }; }
-TollFreeMapping TollFreeMapping::getTollFree() noexcept { return { mappingTollFree }; }
-LergMapping LergMapping::getLerg() noexcept { return { mappingLerg }; }
-YoumailMapping YoumailMapping::getYoumail() noexcept { return { mappingYoumail }; }
-GeoMapping GeoMapping::getGeo() noexcept { return { mappingGeo }; }
-FtcMapping FtcMapping::getFtc() noexcept { return { mappingFtc }; }
-F404Mapping F404Mapping::getF404() noexcept { return { mapping404 }; }
-F606Mapping F606Mapping::getF606() noexcept { return { mapping606 }; }
+// Snapshot of all datasets per NUMA node, see Datasets
+static std::atomic<Datasets::Data*> currentDatasets[kMaxNumaNodes];
 
-bool PhoneMapping::isAvailable() noexcept {
-  return !!mappingUS.load() && !!mappingCA.load();
-}
+// Generic mappings, only replicated ones use more than the first slot
+template <class Policy>
+static std::atomic<typename Mapping<Policy>::Data*> mappingReplicas[kMaxNumaNodes];
 
-bool DncMapping::isAvailable() noexcept {
-  return !!mappingDNC.load();
-}
+PhoneMapping PhoneMapping::getUS() noexcept { return { mappingUS[numaReplica()] }; }
+PhoneMapping PhoneMapping::getCA() noexcept { return { mappingCA[numaReplica()] }; }
 
-bool TollFreeMapping::isAvailable() noexcept {
-  return !!mappingTollFree.load();
+template <class Policy>
+Mapping<Policy> Mapping<Policy>::get() noexcept {
+  return { mappingReplicas<Policy>[kReplicated ? numaReplica() : 0] };
 }
 
-bool DnoMapping::isAvailable() noexcept {
-  return !!mappingDNO.load();
+// Replicas are published in order, so the last one is set only when all are
+bool PhoneMapping::isAvailable() noexcept {
+  unsigned last = numaReplicas() - 1;
+  return !!mappingUS[last].load() && !!mappingCA[last].load();
 }
 
-bool LergMapping::isAvailable() noexcept {
-  return !!mappingLerg.load();
+template <class Policy>
+bool Mapping<Policy>::isAvailable() noexcept {
+  unsigned last = kReplicated ? numaReplicas() - 1 : 0;
+  return !!mappingReplicas<Policy>[last].load();
 }
 
-bool YoumailMapping::isAvailable() noexcept {
-  return !!mappingYoumail.load();
+template DncMapping DncMapping::get() noexcept;
+template DnoMapping DnoMapping::get() noexcept;
+template TollFreeMapping TollFreeMapping::get() noexcept;
+template LergMapping LergMapping::get() noexcept;
+template YoumailMapping YoumailMapping::get() noexcept;
+template GeoMapping GeoMapping::get() noexcept;
+template FtcMapping FtcMapping::get() noexcept;
+template F404Mapping F404Mapping::get() noexcept;
+template F606Mapping F606Mapping::get() noexcept;
+template bool DncMapping::isAvailable() noexcept;
+template bool DnoMapping::isAvailable() noexcept;
+template bool TollFreeMapping::isAvailable() noexcept;
+template bool LergMapping::isAvailable() noexcept;
+template bool YoumailMapping::isAvailable() noexcept;
+template bool GeoMapping::isAvailable() noexcept;
+template bool FtcMapping::isAvailable() noexcept;
+template bool F404Mapping::isAvailable() noexcept;
+template bool F606Mapping::isAvailable() noexcept;
+
+ACL ACL::get() noexcept { return { currentACL }; }
+
+/** Mapping replica read by NUMA `node` */
+template <class Policy>
+static std::atomic<typename Mapping<Policy>::Data*>& mappingReplica(unsigned node) {
+  return mappingReplicas<Policy>[Mapping<Policy>::kReplicated ? node : 0];
 }
 
-bool GeoMapping::isAvailable() noexcept {
-  return !!mappingGeo.load();
+class Datasets::Data : public folly::hazptr_obj_base<Data> {
+ public:
+  Data(uint64_t generation, unsigned node)
+    : generation(generation)
+    , us(mappingUS[node])
+    , ca(mappingCA[node])
+    , acl(currentACL)
+    , mappings(mappingReplica<DncPolicy>(node),
+               mappingReplica<DnoPolicy>(node),
+               mappingReplica<TollFreePolicy>(node),
+               mappingReplica<LergPolicy>(node),
+               mappingReplica<YoumailPolicy>(node),
+               mappingReplica<GeoPolicy>(node),
+               mappingReplica<FtcPolicy>(node),
+               mappingReplica<F404Policy>(node),
+               mappingReplica<F606Policy>(node))
+  {}
+
+  uint64_t generation;
+  // protected references keeping listed datasets alive
+  PhoneMapping us;
+  PhoneMapping ca;
+  ACL acl;
+  std::tuple<DncMapping, DnoMapping, TollFreeMapping, LergMapping,
+             YoumailMapping, GeoMapping, FtcMapping,
+             F404Mapping, F606Mapping> mappings;
+};
+
+Datasets::Datasets(std::atomic<Data*> &global)
+#if USE_RCU
+  : data_(global.load(std::memory_order_acquire))
+#else
+  : data_(holder_.get_protected(global))
+#endif
+{}
+
+Datasets::Datasets(Datasets&& rhs) noexcept = default;
+Datasets::~Datasets() noexcept = default;
+
+Datasets Datasets::get() noexcept { return { currentDatasets[numaReplica()] }; }
+
+void Datasets::publish() {
+  // Reloads of different datasets may finish concurrently
+  static std::mutex publishMutex;
+  static uint64_t generation = 0;
+  std::lock_guard<std::mutex> lock(publishMutex);
+
+  ++generation;
+  for (unsigned node = 0; node < numaReplicas(); ++node) {
+    auto data = std::make_unique<Data>(generation, node);
+    if (Data *veteran = currentDatasets[node].exchange(data.release())) {
+#if USE_RCU
+      folly::rcu_retire(veteran);
+#else
+      veteran->retire();
+#endif
+    }
+  }
 }
 
-bool FtcMapping::isAvailable() noexcept {
-  return !!mappingFtc.load();
+uint64_t Datasets::generation() const noexcept {
+  return data_ ? data_->generation : 0;
 }
 
-bool F404Mapping::isAvailable() noexcept {
-  return !!mapping404.load();
+bool Datasets::isAvailable() const noexcept {
+  return data_ && data_->us.isLoaded() && data_->ca.isLoaded();
 }
 
-bool F606Mapping::isAvailable() noexcept {
-  return !!mapping606.load();
+const PhoneMapping& Datasets::us() const noexcept { return data_->us; }
+const PhoneMapping& Datasets::ca() const noexcept { return data_->ca; }
+const ACL& Datasets::acl() const noexcept { return data_->acl; }
+
+template <class M>
+const M* Datasets::get() const noexcept {
+  if (!data_)
+    return nullptr;
+  const M &db = std::get<M>(data_->mappings);
+  return db.isLoaded() ? &db : nullptr;
 }
 
-ACL ACL::get() noexcept { return { currentACL }; }
+template const DncMapping* Datasets::get<DncMapping>() const noexcept;
+template const DnoMapping* Datasets::get<DnoMapping>() const noexcept;
+template const TollFreeMapping* Datasets::get<TollFreeMapping>() const noexcept;
+template const LergMapping* Datasets::get<LergMapping>() const noexcept;
+template const YoumailMapping* Datasets::get<YoumailMapping>() const noexcept;
+template const GeoMapping* Datasets::get<GeoMapping>() const noexcept;
+template const FtcMapping* Datasets::get<FtcMapping>() const noexcept;
+template const F404Mapping* Datasets::get<F404Mapping>() const noexcept;
+template const F606Mapping* Datasets::get<F606Mapping>() const noexcept;
 
 static StringPiece osBasename(StringPiece path) {
   auto idx = path.rfind('/');
@@ -110,340 +196,95 @@ static StringPiece osBasename(StringPiece path) {
   return path.subpiece(idx + 1);
 }
 
-static bool loadACLFile(const std::string &path) {
-  std::unique_ptr<ACL::Data> data;
-  std::ifstream in;
-  size_t line = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.open(path);
-    data = ACL::fromCSV(in, line);
-    in.close();
-  } catch (std::exception& e) {
-    LOG(ERROR) << osBasename(path) << ':' << line << ": " << e.what();
-    return false;
-  }
-
-  LOG(INFO) << "Replacing ACL (" << line << " rows)...";
-  ACL::commit(std::move(data), currentACL);
-  folly::hazptr_cleanup();
-  return true;
+static void reportProgress(const DatasetStream &in, size_t nrows) {
+  int percent = in.progress();
+  LOG_IF(INFO, percent >= 0) << percent << "% completed (" << nrows << " rows read)";
+  LOG_IF(INFO, percent < 0) << nrows << " rows read";
 }
 
-static bool loadMappingFile(const std::string &path, folly::dynamic meta)
+/** Copy a freshly committed dataset into memory of every other node */
+template <class Mapping>
+static void replicateToNodes(std::atomic<typename Mapping::Data*> *replicas)
 {
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-  const std::string &country = meta.getDefault("country", "US").asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  PhoneMapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
-    return false;
+  for (unsigned node = 1; node < numaReplicas(); ++node) {
+    numaRunOn(node, [&] { Mapping::replicate(replicas[0], replicas[node]); });
+    LOG(INFO) << "Replicated to NUMA node " << node;
   }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  if (country == "CA")
-    builder.commit(mappingCA);
-  else
-    builder.commit(mappingUS);
-  folly::hazptr_cleanup();
-  return true;
 }
 
-static bool loadDNCMappingFile(const std::string &path, folly::dynamic meta)
+/** Wait until readers release the retired dataset and account reload */
+static void finishReload(StringPiece dataset, size_t nrows,
+                         const folly::stop_watch<> &reloadTime)
 {
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  DncMapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
-    return false;
-  }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingDNC);
+  auto took = reloadTime.elapsed();
+#if USE_RCU
+  // Free snapshots retired by publish(), releasing datasets they list
+  folly::rcu_barrier();
   folly::hazptr_cleanup();
-  return true;
-}
-
-static bool loadDnoMappingFile(const std::string &path, folly::dynamic meta, std::string dnotype)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  DnoMapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, dnotype, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
-    return false;
-  }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingDNO);
+#else
+  // Retired snapshots release datasets they list only when reclaimed,
+  // the second pass reclaims those datasets
   folly::hazptr_cleanup();
-  return true;
-}
-
-static bool loadTollFreeMappingFile(const std::string &path, folly::dynamic meta)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  TollFreeMapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
-    return false;
-  }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingTollFree);
   folly::hazptr_cleanup();
-  return true;
+#endif
+  recordReload(dataset, true, nrows, took, reloadTime.elapsed() - took);
 }
 
-static bool loadLergMappingFile(const std::string &path, folly::dynamic meta)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
+static bool loadACLFile(const std::string &path) {
+  std::unique_ptr<ACL::Data> data;
   std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  LergMapping::Builder builder;
-  size_t nrows = 0;
+  folly::stop_watch<> reloadTime;
+  size_t line = 0;
 
   try {
     in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
     in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
+    data = ACL::fromCSV(in, line);
     in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
+  } catch (std::exception& e) {
+    LOG(ERROR) << osBasename(path) << ':' << line << ": " << e.what();
+    recordReload("acl", false, line, reloadTime.elapsed());
     return false;
   }
 
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingLerg);
-  folly::hazptr_cleanup();
+  LOG(INFO) << "Replacing ACL (" << line << " rows)...";
+  ACL::commit(std::move(data), currentACL);
+  Datasets::publish();
+  finishReload("acl", line, reloadTime);
   return true;
 }
 
-static bool loadYoumailMappingFile(const std::string &path, folly::dynamic meta)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  YoumailMapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
+static bool loadStirKeys() {
+  if (FLAGS_stir_keys.empty()) {
+    LOG(ERROR) << "No --stir_keys given";
     return false;
   }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingYoumail);
-  folly::hazptr_cleanup();
-  return true;
-}
-
-static bool loadGeoMappingFile(const std::string &path, folly::dynamic meta)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  GeoMapping::Builder builder;
-  size_t nrows = 0;
-
   try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
-
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
+    KeyManager::load(FLAGS_stir_keys);
+  } catch (std::exception& e) {
+    LOG(ERROR) << "Keeping current STIR keys: " << e.what();
     return false;
   }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingGeo);
-  folly::hazptr_cleanup();
+  LOG(INFO) << "Reloaded STIR keys from " << FLAGS_stir_keys;
   return true;
 }
 
-static bool loadFtcMappingFile(const std::string &path, folly::dynamic meta)
+static bool loadMappingFile(const std::string &path, folly::dynamic meta)
 {
   int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
   const std::string &name = meta.getDefault("file_name", path).asString();
+  const std::string &country = meta.getDefault("country", "US").asString();
+  const char *dataset = (country == "CA") ? "ca" : "us";
 
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
+  DatasetStream in;
   folly::stop_watch<> watch;
+  folly::stop_watch<> reloadTime;
 
-  FtcMapping::Builder builder;
+  PhoneMapping::Builder builder;
   size_t nrows = 0;
 
   try {
     in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
     in.open(path);
 
     builder.sizeHint(estimate + estimate / 20);
@@ -454,110 +295,115 @@ static bool loadFtcMappingFile(const std::string &path, folly::dynamic meta)
 
     while (in.good()) {
       builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
+      if (watch.lap(reportPeriod))
+        reportProgress(in, nrows);
     }
     in.close();
   } catch (std::runtime_error &e) {
     LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
+    recordReload(dataset, false, nrows, reloadTime.elapsed());
     return false;
   }
 
   LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mappingFtc);
-  folly::hazptr_cleanup();
+  auto *replicas = (country == "CA") ? mappingCA : mappingUS;
+  builder.commit(replicas[0]);
+  replicateToNodes<PhoneMapping>(replicas);
+  Datasets::publish();
+  finishReload(dataset, nrows, reloadTime);
   return true;
 }
 
-static bool load404MappingFile(const std::string &path, folly::dynamic meta)
+/** Control command reloading a generic mapping or one of its key levels */
+struct DatasetCommand {
+  const char *cmd;
+  // name in logs and metrics
+  const char *dataset;
+  bool (*load)(const std::string &path, const folly::dynamic &meta,
+               const DatasetCommand &command);
+  // key level replaced by the command, others are kept; -1 replaces all
+  int level;
+};
+
+template <class Policy>
+static bool loadDataset(const std::string &path, const folly::dynamic &meta,
+                        const DatasetCommand &command)
 {
+  using MappingT = Mapping<Policy>;
   int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
   const std::string &name = meta.getDefault("file_name", path).asString();
+  unsigned level = std::max(command.level, 0);
 
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
+  // Level reloads start from the current dataset, don't let them race
+  static std::mutex reloadMutex;
+  std::lock_guard<std::mutex> lock(reloadMutex);
+
+  DatasetStream in;
   folly::stop_watch<> watch;
+  folly::stop_watch<> reloadTime;
 
-  F404Mapping::Builder builder;
+  typename MappingT::Builder builder;
   size_t nrows = 0;
 
   try {
     in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
     in.open(path);
 
-    builder.sizeHint(estimate + estimate / 20);
+    if (command.level >= 0)
+      builder.inherit(MappingT::get(), level);
+    builder.sizeHint(estimate + estimate / 20, level);
     builder.setMetadata(meta);
 
     LOG(INFO) << "Reading database from " << name
       << " (" << estimate << " rows estimated)";
 
     while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
+      builder.fromCSV(in, nrows, 10000, level);
+      if (watch.lap(reportPeriod))
+        reportProgress(in, nrows);
     }
     in.close();
   } catch (std::runtime_error &e) {
     LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
+    recordReload(command.dataset, false, nrows, reloadTime.elapsed());
     return false;
   }
 
   LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mapping404);
-  folly::hazptr_cleanup();
+  builder.commit(mappingReplicas<Policy>[0]);
+  if (MappingT::kReplicated)
+    replicateToNodes<MappingT>(mappingReplicas<Policy>);
+  Datasets::publish();
+  finishReload(command.dataset, nrows, reloadTime);
   return true;
 }
 
-static bool load606MappingFile(const std::string &path, folly::dynamic meta)
-{
-  int64_t estimate = meta.getDefault("row_estimate", 0).asInt();
-  const std::string &name = meta.getDefault("file_name", path).asString();
-
-  std::ifstream in;
-  std::vector<char> rbuf(1ull << 19);
-  folly::stop_watch<> watch;
-
-  F606Mapping::Builder builder;
-  size_t nrows = 0;
-
-  try {
-    in.exceptions(std::ios_base::failbit | std::ios_base::badbit);
-    in.rdbuf()->pubsetbuf(rbuf.data(), rbuf.size());
-    in.open(path);
-
-    builder.sizeHint(estimate + estimate / 20);
-    builder.setMetadata(meta);
-
-    LOG(INFO) << "Reading database from " << name
-      << " (" << estimate << " rows estimated)";
+static const DatasetCommand datasetCommands[] = {
+  { "dnc_reload", "dnc", &loadDataset<DncPolicy>, -1 },
+  { "dno_reload", "dno", &loadDataset<DnoPolicy>, DnoPolicy::PN },
+  { "dno_npa_reload", "dno", &loadDataset<DnoPolicy>, DnoPolicy::NPA },
+  { "dno_npa_nxx_reload", "dno", &loadDataset<DnoPolicy>, DnoPolicy::NPA_NXX },
+  { "dno_npa_nxx_x_reload", "dno", &loadDataset<DnoPolicy>, DnoPolicy::NPA_NXX_X },
+  { "tollfree_reload", "tollfree", &loadDataset<TollFreePolicy>, -1 },
+  { "lerg_reload", "lerg", &loadDataset<LergPolicy>, -1 },
+  { "youmail_reload", "youmail", &loadDataset<YoumailPolicy>, -1 },
+  { "geo_reload", "geo", &loadDataset<GeoPolicy>, -1 },
+  { "ftc_reload", "ftc", &loadDataset<FtcPolicy>, -1 },
+  { "404_reload", "404", &loadDataset<F404Policy>, -1 },
+  { "606_reload", "606", &loadDataset<F606Policy>, -1 },
+};
 
-    while (in.good()) {
-      builder.fromCSV(in, nrows, 10000);
-      if (watch.lap(reportPeriod)) {
-        LOG_IF(INFO, estimate != 0) << nrows * 100 / estimate << "% completed";
-        LOG_IF(INFO, estimate == 0) << nrows << " rows read";
-      }
-    }
-    in.close();
-  } catch (std::runtime_error &e) {
-    LOG(ERROR) << osBasename(name) << ':' << nrows << ": " << e.what();
-    return false;
+static const DatasetCommand* findDatasetCommand(StringPiece cmd)
+{
+  for (const DatasetCommand &command : datasetCommands) {
+    if (cmd == command.cmd)
+      return &command;
   }
-
-  LOG(INFO) << "Building index (" << nrows << " rows)...";
-  builder.commit(mapping606);
-  folly::hazptr_cleanup();
-  return true;
+  return nullptr;
 }
-
 static bool verifyMappingFile(const std::string &path, folly::dynamic meta)
 {
-  std::ifstream in;
+  DatasetStream in;
   std::string linebuf;
   std::vector<uint64_t> row;
   folly::stop_watch<> watch;
@@ -643,6 +489,67 @@ static bool dumpMappingFile(const std::string &path, folly::dynamic meta)
   return true;
 }
 
+folly::dynamic memoryReport()
+{
+  folly::dynamic datasets = folly::dynamic::object;
+  size_t total = 0;
+  auto account = [&](const char *name, const auto &db, unsigned replicas) {
+    MemoryUsage usage;
+    db.memoryUsage(usage);
+    folly::dynamic entry = usage.toDynamic();
+    entry["replicas"] = replicas;
+    datasets[name] = std::move(entry);
+    total += usage.total() * replicas;
+  };
+
+  // Replicas are copies of the first one, account it once per node
+  account("us", PhoneMapping::getUS(), numaReplicas());
+  account("ca", PhoneMapping::getCA(), numaReplicas());
+  account("dnc", DncMapping::get(), numaReplicas());
+  account("dno", DnoMapping::get(), 1);
+  account("tollfree", TollFreeMapping::get(), 1);
+  account("lerg", LergMapping::get(), 1);
+  account("youmail", YoumailMapping::get(), 1);
+  account("geo", GeoMapping::get(), 1);
+  account("ftc", FtcMapping::get(), 1);
+  account("404", F404Mapping::get(), 1);
+  account("606", F606Mapping::get(), 1);
+
+  RetiredMemory retired = retiredMemory();
+  return folly::dynamic::object
+    ("datasets", std::move(datasets))
+    ("retired", folly::dynamic::object
+       ("datasets", retired.datasets)
+       ("bytes", retired.bytes))
+    ("huge_pages", hugePageBytes())
+    ("total", total + retired.bytes);
+}
+
+static void printMemoryReport()
+{
+  folly::dynamic report = memoryReport();
+  auto pretty = [](const folly::dynamic &bytes) {
+    return folly::prettyPrint(bytes.asInt(), folly::PRETTY_BYTES_IEC);
+  };
+
+  for (const auto &kv : report["datasets"].items()) {
+    std::string components;
+    for (const auto &c : kv.second.items()) {
+      if (c.first == "total" || c.first == "replicas")
+        continue;
+      folly::format(&components, " {}={}", c.first.asString(), pretty(c.second));
+    }
+    LOG(INFO) << "Memory " << kv.first.asString() << ": "
+              << pretty(kv.second["total"]) << " x"
+              << kv.second["replicas"].asInt() << components;
+  }
+  const folly::dynamic &retired = report["retired"];
+  LOG(INFO) << "Memory retired: " << pretty(retired["bytes"])
+            << " in " << retired["datasets"].asInt() << " datasets";
+  LOG(INFO) << "Memory total: " << pretty(report["total"])
+            << ", huge pages " << pretty(report["huge_pages"]);
+}
+
 class FdLogSink : public google::LogSink {
 public:
   FdLogSink(int fd)
@@ -763,6 +670,7 @@ void ControlThread::dispatch(sockaddr_t peer, folly::dynamic msg,
                              std::vector<int> argfd) const noexcept
 try {
   std::unique_ptr<google::LogSink> sink;
+  numaInterleave();
 
   auto mapfd = [&](int index) { return (index >= 0) ? argfd.at(index) : index; };
 
@@ -785,41 +693,8 @@ try {
   if (cmd == "reload") {
     if (loadMappingFile(stdinPath, msg))
       status = 'S';
-  } else if (cmd == "dnc_reload") {
-    if (loadDNCMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "tollfree_reload") {
-    if (loadTollFreeMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "dno_npa_reload") {
-    if (loadDnoMappingFile(stdinPath, msg, std::string("dno_npa")))
-      status = 'S';
-  } else if (cmd == "dno_reload") {
-    if (loadDnoMappingFile(stdinPath, msg, std::string("dno")))
-      status = 'S';
-  } else if (cmd == "dno_npa_nxx_reload") {
-    if (loadDnoMappingFile(stdinPath, msg, std::string("dno_npa_nxx")))
-      status = 'S';
-  } else if (cmd == "dno_npa_nxx_x_reload") {
-    if (loadDnoMappingFile(stdinPath, msg, std::string("dno_npa_nxx_x")))
-      status = 'S';
-  } else if (cmd == "lerg_reload") {
-    if (loadLergMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "youmail_reload") {
-    if (loadYoumailMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "geo_reload") {
-    if (loadGeoMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "ftc_reload") {
-    if (loadFtcMappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "404_reload") {
-    if (load404MappingFile(stdinPath, msg))
-      status = 'S';
-  } else if (cmd == "606_reload") {
-    if (load606MappingFile(stdinPath, msg))
+  } else if (const DatasetCommand *command = findDatasetCommand(cmd)) {
+    if (command->load(stdinPath, msg, *command))
       status = 'S';
   } else if (cmd == "verify") {
     if (verifyMappingFile(stdinPath, msg))
@@ -830,12 +705,17 @@ try {
   } else if (cmd == "acl") {
     if (loadACLFile(stdinPath))
       status = 'S';
-  } else if (cmd == "meta") {
+  } else if (cmd == "stir-keys") {
+    if (loadStirKeys())
+      status = 'S';
+  } else if (cmd == "meta" || cmd == "status") {
     PhoneMapping::getUS().printMetadata();
     PhoneMapping::getCA().printMetadata();
-    DncMapping::getDNC().printMetadata();
-    TollFreeMapping::getTollFree().printMetadata();
-    LergMapping::getLerg().printMetadata();
+    DncMapping::get().printMetadata();
+    TollFreeMapping::get().printMetadata();
+    LergMapping::get().printMetadata();
+    if (cmd == "status")
+      printMemoryReport();
     status = 'S';
   } else {
     LOG(WARNING) << "Unrecognized command: " << cmd << "(fds: " << argfd.size() << ")";
@@ -0,0 +1,334 @@
+#include "DatasetStream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+static constexpr size_t kChunkSize = 1ull << 20;
+static constexpr size_t kQueueDepth = 4;
+static constexpr size_t kTarBlock = 512;
+
+class DatasetStream::Buffer : public std::streambuf {
+ public:
+  explicit Buffer(int fd);
+  ~Buffer() override;
+
+  int progress() const noexcept;
+  void stop();
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  void produce() noexcept;
+  bool push(std::vector<char> chunk);
+  uint64_t tarMember(char *header);
+  size_t readRaw(char *buf, size_t len);
+  size_t decode(char *buf, size_t len);
+  size_t decodeFull(char *buf, size_t len);
+  void decodeExact(char *buf, size_t len);
+
+  int fd_;
+  uint64_t total_ = 0;
+  std::atomic<uint64_t> consumed_{0};
+
+  // producer state
+  std::vector<char> raw_;
+  z_stream zs_;
+  bool gzip_ = false;
+  bool member_end_ = false;
+  bool raw_eof_ = false;
+
+  // shared state
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::vector<char>> queue_;
+  std::exception_ptr error_;
+  bool done_ = false;
+  bool stop_ = false;
+
+  // consumer state
+  std::vector<char> current_;
+  std::thread thread_;
+};
+
+DatasetStream::Buffer::Buffer(int fd)
+  : fd_(fd)
+  , raw_(kChunkSize)
+{
+  struct stat st;
+  if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode))
+    total_ = st.st_size;
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // Sniff gzip magic from the first raw block
+  memset(&zs_, 0, sizeof(zs_));
+  zs_.avail_in = readRaw(raw_.data(), raw_.size());
+  zs_.next_in = reinterpret_cast<Bytef*>(raw_.data());
+  if (zs_.avail_in >= 2 && uint8_t(raw_[0]) == 0x1f && uint8_t(raw_[1]) == 0x8b) {
+    if (inflateInit2(&zs_, 15 + 16) != Z_OK)
+      throw std::runtime_error("inflateInit2 failed");
+    gzip_ = true;
+  }
+
+  thread_ = std::thread([this] { produce(); });
+}
+
+DatasetStream::Buffer::~Buffer() {
+  stop();
+}
+
+void DatasetStream::Buffer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    done_ = true;
+    queue_.clear();
+  }
+  cv_.notify_all();
+  if (!thread_.joinable())
+    return;
+
+  thread_.join();
+  if (gzip_)
+    inflateEnd(&zs_);
+  ::close(fd_);
+}
+
+int DatasetStream::Buffer::progress() const noexcept {
+  if (total_ == 0)
+    return -1;
+  return std::min<uint64_t>(consumed_.load() * 100 / total_, 100);
+}
+
+size_t DatasetStream::Buffer::readRaw(char *buf, size_t len) {
+  for (;;) {
+    ssize_t n = ::read(fd_, buf, len);
+    if (n >= 0) {
+      consumed_ += n;
+      return n;
+    }
+    if (errno != EINTR)
+      throw std::system_error(errno, std::generic_category(), "read");
+  }
+}
+
+/** Produce some bytes of payload, returns 0 at the end of input. */
+size_t DatasetStream::Buffer::decode(char *buf, size_t len) {
+  if (!gzip_) {
+    if (zs_.avail_in > 0) {
+      size_t n = std::min<size_t>(len, zs_.avail_in);
+      memcpy(buf, zs_.next_in, n);
+      zs_.next_in += n;
+      zs_.avail_in -= n;
+      return n;
+    }
+    return readRaw(buf, len);
+  }
+
+  zs_.next_out = reinterpret_cast<Bytef*>(buf);
+  zs_.avail_out = len;
+  while (zs_.avail_out == len) {
+    if (zs_.avail_in == 0) {
+      if (!raw_eof_) {
+        zs_.avail_in = readRaw(raw_.data(), raw_.size());
+        zs_.next_in = reinterpret_cast<Bytef*>(raw_.data());
+        raw_eof_ = zs_.avail_in == 0;
+      }
+      if (raw_eof_) {
+        if (!member_end_)
+          throw std::runtime_error("unexpected end of gzip stream");
+        break;
+      }
+    }
+
+    int ret = inflate(&zs_, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      // Concatenated gzip members (e.g. from parallel compressors)
+      member_end_ = true;
+      inflateReset(&zs_);
+    } else if (ret == Z_OK) {
+      member_end_ = false;
+    } else if (ret != Z_BUF_ERROR) {
+      throw std::runtime_error(std::string("gzip: ") +
+                               (zs_.msg ? zs_.msg : "corrupted stream"));
+    }
+  }
+  return len - zs_.avail_out;
+}
+
+/** Fill as much of `buf` as possible, short only at the end of input. */
+size_t DatasetStream::Buffer::decodeFull(char *buf, size_t len) {
+  size_t filled = 0;
+  while (filled < len) {
+    size_t n = decode(buf + filled, len - filled);
+    if (n == 0)
+      break;
+    filled += n;
+  }
+  return filled;
+}
+
+void DatasetStream::Buffer::decodeExact(char *buf, size_t len) {
+  if (decodeFull(buf, len) != len)
+    throw std::runtime_error("truncated tar archive");
+}
+
+static uint64_t parseTarSize(const char *field) {
+  // GNU base-256 extension for members over 8GB
+  if (uint8_t(field[0]) & 0x80) {
+    uint64_t size = 0;
+    for (size_t i = 1; i < 12; ++i)
+      size = (size << 8) | uint8_t(field[i]);
+    return size;
+  }
+  uint64_t size = 0;
+  for (size_t i = 0; i < 12 && field[i] >= '0' && field[i] <= '7'; ++i)
+    size = size * 8 + (field[i] - '0');
+  return size;
+}
+
+/** Skip tar headers until the first regular file, return its size. */
+uint64_t DatasetStream::Buffer::tarMember(char *header) {
+  std::vector<char> scratch;
+  uint64_t paxSize = 0;
+
+  for (;;) {
+    if (std::all_of(header, header + kTarBlock, [](char c) { return c == 0; }))
+      throw std::runtime_error("no files in tar archive");
+
+    uint64_t size = parseTarSize(header + 124);
+    char type = header[156];
+    if (type == '0' || type == '\0' || type == '7')
+      return paxSize ? paxSize : size;
+
+    // Skip metadata entry, remembering size override from pax header
+    uint64_t padded = (size + kTarBlock - 1) / kTarBlock * kTarBlock;
+    scratch.resize(padded);
+    decodeExact(scratch.data(), padded);
+    if (type == 'x') {
+      std::string records(scratch.data(), size);
+      size_t pos = records.find(" size=");
+      if (pos != std::string::npos)
+        paxSize = std::stoull(records.substr(pos + 6));
+    }
+    decodeExact(header, kTarBlock);
+  }
+}
+
+void DatasetStream::Buffer::produce() noexcept
+try {
+  uint64_t remaining = UINT64_MAX;
+  std::vector<char> chunk(kChunkSize);
+  size_t filled = decodeFull(chunk.data(), kTarBlock);
+
+  // ustar magic is present in both POSIX and GNU archives
+  if (filled == kTarBlock && memcmp(chunk.data() + 257, "ustar", 5) == 0) {
+    remaining = tarMember(chunk.data());
+    filled = 0;
+  }
+
+  while (remaining > 0) {
+    size_t want = filled + std::min<uint64_t>(chunk.size() - filled, remaining);
+    if (remaining != UINT64_MAX)
+      remaining -= want - filled;
+    size_t got = filled + decodeFull(chunk.data() + filled, want - filled);
+    if (got < want && remaining != UINT64_MAX)
+      throw std::runtime_error("truncated tar archive");
+    if (got == 0)
+      break;
+
+    chunk.resize(got);
+    if (!push(std::move(chunk)))
+      return;
+    if (got < want)
+      break;
+    chunk.resize(kChunkSize);
+    filled = 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  done_ = true;
+  cv_.notify_all();
+} catch (...) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  error_ = std::current_exception();
+  done_ = true;
+  cv_.notify_all();
+}
+
+bool DatasetStream::Buffer::push(std::vector<char> chunk) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return queue_.size() < kQueueDepth || stop_; });
+  if (stop_)
+    return false;
+  queue_.push_back(std::move(chunk));
+  cv_.notify_all();
+  return true;
+}
+
+DatasetStream::Buffer::int_type DatasetStream::Buffer::underflow() {
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !queue_.empty() || done_; });
+    if (queue_.empty()) {
+      if (error_)
+        std::rethrow_exception(error_);
+      return traits_type::eof();
+    }
+    current_ = std::move(queue_.front());
+    queue_.pop_front();
+    cv_.notify_all();
+  }
+
+  setg(current_.data(), current_.data(), current_.data() + current_.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+DatasetStream::DatasetStream()
+  : std::istream(nullptr)
+{
+  // Start in a good state so exceptions() may be set before open()
+  rdbuf(&empty_);
+}
+
+DatasetStream::~DatasetStream() = default;
+
+void DatasetStream::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), path);
+
+  try {
+    buf_ = std::make_unique<Buffer>(fd);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  rdbuf(buf_.get());
+  clear();
+}
+
+void DatasetStream::close() {
+  if (buf_)
+    buf_->stop();
+}
+
+int DatasetStream::progress() const noexcept {
+  return buf_ ? buf_->progress() : -1;
+}
@@ -0,0 +1,35 @@
+#ifndef CALLFWD_DATASETSTREAM_H
+#define CALLFWD_DATASETSTREAM_H
+
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+/** Input stream over a dataset file.
+  * Gzip compressed files and the first file of a (compressed) tar archive
+  * are unpacked on the fly. Reading and decompression run in a background
+  * thread, so they overlap with parsing of already unpacked rows. */
+class DatasetStream : public std::istream {
+ public:
+  DatasetStream();
+  ~DatasetStream() override;
+
+  /** Open file, compression and archive format are detected from content.
+    * Throws `runtime_error` if file can't be opened. */
+  void open(const std::string &path);
+
+  /** Stop background thread and close file. */
+  void close();
+
+  /** Percent of the file consumed, counted in compressed bytes for
+    * compressed input. Returns -1 if file size is unknown (e.g. a pipe). */
+  int progress() const noexcept;
+
+ private:
+  class Buffer;
+  std::stringbuf empty_;
+  std::unique_ptr<Buffer> buf_;
+};
+
+#endif // CALLFWD_DATASETSTREAM_H
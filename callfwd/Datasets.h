@@ -0,0 +1,74 @@
+#ifndef CALLFWD_DATASETS_H
+#define CALLFWD_DATASETS_H
+
+#include <cstdint>
+#include <atomic>
+
+#if USE_RCU
+#include <folly/synchronization/Rcu.h>
+#else
+#include <folly/synchronization/HazptrHolder.h>
+#endif
+
+#include "ACL.h"
+#include "PhoneMapping.h"
+#include "DncMapping.h"
+#include "DnoMapping.h"
+#include "TollFreeMapping.h"
+#include "LergMapping.h"
+#include "YoumailMapping.h"
+#include "GeoMapping.h"
+#include "FtcMapping.h"
+#include "F404Mapping.h"
+#include "F606Mapping.h"
+
+/** Snapshot of all datasets and access rules published together after
+  * every reload. The snapshot holds protected references to the datasets
+  * it lists, so a request protecting just the snapshot sees one
+  * consistent set of datasets even if some of them are reloaded
+  * meanwhile. Every NUMA node has its own snapshot listing local replicas.
+  *
+  * Readers protect the snapshot with a hazard pointer, or with an RCU
+  * read-side critical section if built with USE_RCU. The latter is
+  * cheaper to enter, but a reload waits for every request in flight,
+  * so don't hold a snapshot across blocking calls. */
+class Datasets {
+ public:
+  class Data; /* opaque */
+
+  /** Protect the current snapshot of the calling thread's NUMA node. */
+  static Datasets get() noexcept;
+  /** Publish a new generation of snapshots from the committed datasets.
+    * Called by reloads once all NUMA replicas of a dataset are copied. */
+  static void publish();
+  /** Ensure move constructor exists */
+  Datasets(Datasets&& rhs) noexcept;
+  ~Datasets() noexcept;
+
+  /** Number of publications up to this snapshot, 0 if none happened. */
+  uint64_t generation() const noexcept;
+
+  /** Check if US and CA LRN tables are loaded. */
+  bool isAvailable() const noexcept;
+
+  /** LRN tables and access rules, valid only if isAvailable(). */
+  const PhoneMapping& us() const noexcept;
+  const PhoneMapping& ca() const noexcept;
+  const ACL& acl() const noexcept;
+
+  /** Auxiliary dataset (e.g. `get<DncMapping>()`), nullptr if not loaded. */
+  template <class M>
+  const M* get() const noexcept;
+
+ private:
+  Datasets(std::atomic<Data*> &global);
+
+#if USE_RCU
+  folly::rcu_reader guard_;
+#else
+  folly::hazptr_holder<> holder_;
+#endif
+  const Data *data_;
+};
+
+#endif // CALLFWD_DATASETS_H
@@ -0,0 +1,64 @@
+#ifndef CALLFWD_HOTCACHE_H
+#define CALLFWD_HOTCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <folly/lang/Bits.h>
+
+/** Fixed-size direct mapped cache of per-number results in front of the
+  * dataset lookups. Every thread owns its cache, so neither lookups nor
+  * updates need synchronization. Entries are stamped with the dataset
+  * generation they were computed from and never match after a reload. */
+template <class Value>
+class HotCache {
+ public:
+  /** `capacity` is rounded up to a power of two, 0 disables the cache. */
+  explicit HotCache(size_t capacity)
+    : slots_(capacity ? folly::nextPowTwo(capacity) : 0)
+    , shift_(64 - folly::findLastSet(slots_.size() | 1) + 1)
+  {}
+
+  bool enabled() const noexcept { return !slots_.empty(); }
+
+  /** Cached value of `key` computed at `generation`, nullptr on miss. */
+  const Value* find(uint64_t key, uint64_t generation) const noexcept {
+    if (slots_.empty())
+      return nullptr;
+    const Slot &slot = slots_[index(key)];
+    if (slot.key != key || slot.generation != generation)
+      return nullptr;
+    return &slot.value;
+  }
+
+  /** Store `value` of `key`, evicting the entry sharing its slot. */
+  template <class V>
+  void insert(uint64_t key, uint64_t generation, V &&value) {
+    if (slots_.empty())
+      return;
+    Slot &slot = slots_[index(key)];
+    slot.key = key;
+    slot.generation = generation;
+    slot.value = std::forward<V>(value);
+  }
+
+ private:
+  struct Slot {
+    uint64_t key = 0;
+    // generations start from 1, so empty slots never match
+    uint64_t generation = 0;
+    Value value{};
+  };
+
+  /** Fibonacci hashing, sequential numbers spread over all slots. */
+  size_t index(uint64_t key) const noexcept {
+    return shift_ < 64 ? (key * 0x9E3779B97F4A7C15ull) >> shift_ : 0;
+  }
+
+  std::vector<Slot> slots_;
+  unsigned shift_;
+};
+
+#endif // CALLFWD_HOTCACHE_H
@@ -0,0 +1,151 @@
+#include "HugePages.h"
+
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <glog/logging.h>
+#include <folly/Synchronized.h>
+#include <folly/container/F14Map.h>
+#include <folly/portability/GFlags.h>
+
+DEFINE_string(huge_pages, "thp",
+              "Back large lookup tables with huge pages: off, thp "
+              "(madvise transparent huge pages) or hugetlb (reserved "
+              "hugetlbfs pool, 1GB pages for tables over 1GB that fill "
+              "them well)");
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+static constexpr size_t kHugePage = 2ull << 20;
+static constexpr size_t kGiantPage = 1ull << 30;
+// 1GB pages are used only if rounding up wastes less than 1/8 of them
+static constexpr unsigned kGiantWasteShift = 3;
+
+namespace {
+
+enum HugePageMode { OFF, THP, HUGETLB };
+
+HugePageMode hugePageMode() {
+  static const HugePageMode mode = [] {
+    if (FLAGS_huge_pages == "off")
+      return OFF;
+    if (FLAGS_huge_pages == "hugetlb")
+      return HUGETLB;
+    LOG_IF(WARNING, FLAGS_huge_pages != "thp")
+      << "Unknown --huge_pages mode " << FLAGS_huge_pages << ", using thp";
+    return THP;
+  }();
+  return mode;
+}
+
+/** Length of every mapping, hugetlb and THP regions are rounded
+  * differently and fallbacks make it impossible to guess on free.
+  * Leaked to outlive datasets reclaimed during shutdown. */
+folly::Synchronized<folly::F14FastMap<void*, size_t>>& mappings() {
+  static auto *map = new folly::Synchronized<folly::F14FastMap<void*, size_t>>();
+  return *map;
+}
+std::atomic<size_t> mappedBytes{0};
+
+size_t roundUp(size_t bytes, size_t align) {
+  return (bytes + align - 1) & ~(align - 1);
+}
+
+void* mapHugeTLB(size_t bytes, size_t &len) {
+  len = roundUp(bytes, kGiantPage);
+  if (bytes >= kGiantPage && len - bytes < len >> kGiantWasteShift) {
+    void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB,
+                     -1, 0);
+    if (ptr != MAP_FAILED)
+      return ptr;
+  }
+
+  len = roundUp(bytes, kHugePage);
+  void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB,
+                   -1, 0);
+  if (ptr != MAP_FAILED)
+    return ptr;
+
+  LOG_FIRST_N(WARNING, 1) << "hugetlbfs pool exhausted, "
+                             "falling back to transparent huge pages";
+  return nullptr;
+}
+
+void* mapTHP(size_t bytes, size_t &len) {
+  // Over-allocate to align the region on a huge page boundary
+  len = roundUp(bytes, kHugePage);
+  void *raw = mmap(nullptr, len + kHugePage, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED)
+    return nullptr;
+
+  char *begin = static_cast<char*>(raw);
+  char *ptr = reinterpret_cast<char*>(
+      roundUp(reinterpret_cast<uintptr_t>(begin), kHugePage));
+  if (ptr != begin)
+    munmap(begin, ptr - begin);
+  munmap(ptr + len, begin + kHugePage - ptr);
+
+  if (madvise(ptr, len, MADV_HUGEPAGE) != 0)
+    PLOG_FIRST_N(WARNING, 1) << "madvise(MADV_HUGEPAGE)";
+  return ptr;
+}
+
+} // namespace
+
+void* hugePageAlloc(size_t bytes) {
+  HugePageMode mode = hugePageMode();
+  if (mode == OFF || bytes < kHugePage) {
+    if (void *ptr = std::malloc(bytes))
+      return ptr;
+    throw std::bad_alloc();
+  }
+
+  size_t len = 0;
+  void *ptr = nullptr;
+  if (mode == HUGETLB)
+    ptr = mapHugeTLB(bytes, len);
+  if (!ptr)
+    ptr = mapTHP(bytes, len);
+  if (!ptr)
+    throw std::bad_alloc();
+
+  mappings().wlock()->emplace(ptr, len);
+  mappedBytes += len;
+  return ptr;
+}
+
+void hugePageFree(void *ptr, size_t bytes) noexcept {
+  if (!ptr)
+    return;
+  if (hugePageMode() == OFF || bytes < kHugePage) {
+    std::free(ptr);
+    return;
+  }
+
+  size_t len = 0;
+  mappings().withWLock([&](auto &map) {
+    auto it = map.find(ptr);
+    CHECK(it != map.end()) << "Unknown huge page region";
+    len = it->second;
+    map.erase(it);
+  });
+  munmap(ptr, len);
+  mappedBytes -= len;
+}
+
+size_t hugePageBytes() noexcept {
+  return mappedBytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,57 @@
+#ifndef CALLFWD_HUGEPAGES_H
+#define CALLFWD_HUGEPAGES_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <folly/container/F14Map.h>
+
+/** Allocate memory for a large immutable table.
+  * Depending on `--huge_pages` it's backed by explicit hugetlbfs pages,
+  * transparent huge pages or regular pages. Falls back to the next
+  * option when the preferred one is unavailable.
+  * Throws `std::bad_alloc` on failure. */
+void* hugePageAlloc(size_t bytes);
+
+/** Release memory obtained from hugePageAlloc(). */
+void hugePageFree(void *ptr, size_t bytes) noexcept;
+
+/** Number of bytes currently mapped by hugePageAlloc(). */
+size_t hugePageBytes() noexcept;
+
+/** STL allocator over hugePageAlloc(). */
+template <class T>
+class HugePageAllocator {
+ public:
+  using value_type = T;
+
+  HugePageAllocator() noexcept = default;
+  template <class U>
+  HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(hugePageAlloc(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) noexcept {
+    hugePageFree(ptr, n * sizeof(T));
+  }
+
+  template <class U>
+  bool operator==(const HugePageAllocator<U>&) const noexcept { return true; }
+  template <class U>
+  bool operator!=(const HugePageAllocator<U>&) const noexcept { return false; }
+};
+
+template <class T>
+using HugeVector = std::vector<T, HugePageAllocator<T>>;
+
+template <class K, class V>
+using HugeF14ValueMap = folly::F14ValueMap<
+  K, V,
+  folly::f14::DefaultHasher<K>,
+  folly::f14::DefaultKeyEqual<K>,
+  HugePageAllocator<std::pair<const K, V>>>;
+
+#endif // CALLFWD_HUGEPAGES_H
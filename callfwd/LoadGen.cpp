@@ -0,0 +1,586 @@
+#include <glog/logging.h>
+#include <folly/init/Init.h>
+#include <folly/Conv.h>
+#include <folly/Format.h>
+#include <folly/Random.h>
+#include <folly/String.h>
+#include <folly/SocketAddress.h>
+#include <folly/container/F14Map.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/AsyncUDPSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GFlags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "PhoneMapping.h"
+
+#include <lib/LoadGenReport.h>
+
+extern "C" {
+#include <lib/osips_parser/msg_parser.h>
+}
+
+using folly::StringPiece;
+using folly::SocketAddress;
+using folly::EventBase;
+using folly::AsyncSocket;
+using folly::AsyncUDPSocket;
+using Clock = std::chrono::steady_clock;
+using TimePoint = Clock::time_point;
+
+DEFINE_string(host, "127.0.0.1", "Address of callfwd under test");
+DEFINE_uint32(http_port, 11000, "HTTP port of callfwd");
+DEFINE_uint32(sip_port, 5061, "SIP port of callfwd");
+DEFINE_double(http_rate, 0, "/target requests per second, 0 disables HTTP");
+DEFINE_double(sip_rate, 0, "INVITEs per second, 0 disables SIP");
+DEFINE_uint32(duration, 10, "Seconds to generate load for");
+DEFINE_uint32(threads, 1, "Number of event loops to split the load across");
+DEFINE_uint32(connections, 4, "Keep-alive HTTP connections per thread");
+DEFINE_uint32(pipeline, 8, "Maximum in-flight requests per HTTP connection");
+DEFINE_uint32(batch, 10, "Phone numbers per /target request");
+DEFINE_uint32(timeout_ms, 1000, "Count a request as lost after this time");
+DEFINE_string(numbers, "",
+              "File with phone numbers to query (one per line, sipp "
+              "injection format is accepted). Random NANP numbers if empty");
+DEFINE_uint64(seed, 1, "Random seed for number selection");
+
+/** Latency samples and outcome counters of a single event loop. */
+struct Stats {
+  /** Time from the scheduled send to the reply, in microseconds.
+    * Includes time spent waiting for a free connection, so a stalled
+    * server is not hidden by a slowed-down client. */
+  std::vector<uint32_t> latency;
+  /** Time from the actual write to the reply, in microseconds. */
+  std::vector<uint32_t> service;
+  uint64_t ok = 0;
+  uint64_t bad = 0;
+  uint64_t lost = 0;
+
+  void record(TimePoint intended, TimePoint sent, TimePoint now, bool valid) {
+    using namespace std::chrono;
+    latency.push_back(duration_cast<microseconds>(now - intended).count());
+    service.push_back(duration_cast<microseconds>(now - sent).count());
+    ++(valid ? ok : bad);
+  }
+
+  void merge(Stats &&other) {
+    latency.insert(latency.end(), other.latency.begin(), other.latency.end());
+    service.insert(service.end(), other.service.begin(), other.service.end());
+    ok += other.ok;
+    bad += other.bad;
+    lost += other.lost;
+  }
+};
+
+/** Open-loop schedule: request k is due at start + k/rate no matter
+  * how quickly previous requests were answered. */
+class Schedule {
+ public:
+  Schedule(double rate, TimePoint start)
+    : start_(start)
+    , interval_(rate > 0 ? 1e9 / rate : 0)
+  {}
+
+  /** Pop the next request that is due by `now`. */
+  bool next(TimePoint now, TimePoint &due) {
+    if (interval_ == 0)
+      return false;
+    due = start_ + std::chrono::nanoseconds(int64_t(k_ * interval_));
+    if (due > now)
+      return false;
+    ++k_;
+    return true;
+  }
+
+ private:
+  TimePoint start_;
+  double interval_;
+  uint64_t k_ = 0;
+};
+
+/** Pick phone numbers from `--numbers` or synthesize NANP numbers. */
+class NumberSource {
+ public:
+  explicit NumberSource(const std::vector<uint64_t> &numbers, uint64_t seed)
+    : numbers_(numbers)
+    , rng_(seed)
+  {}
+
+  uint64_t next() {
+    if (!numbers_.empty())
+      return numbers_[folly::Random::rand64(numbers_.size(), rng_)];
+    uint64_t npa = 200 + folly::Random::rand32(800, rng_);
+    uint64_t nxx = 200 + folly::Random::rand32(800, rng_);
+    return npa * 10000000 + nxx * 10000 + folly::Random::rand32(10000, rng_);
+  }
+
+ private:
+  const std::vector<uint64_t> &numbers_;
+  std::mt19937_64 rng_;
+};
+
+/** Keep-alive HTTP/1.1 connection issuing pipelined POST /target. */
+class HttpConnection : private AsyncSocket::ConnectCallback,
+                       private AsyncSocket::ReadCallback {
+ public:
+  HttpConnection(EventBase *evb, const SocketAddress &addr, Stats &stats)
+    : socket_(new AsyncSocket(evb))
+    , stats_(stats)
+  {
+    socket_->connect(this, addr, FLAGS_timeout_ms);
+  }
+
+  bool ready() const {
+    return connected_ && inflight_.size() < FLAGS_pipeline;
+  }
+
+  size_t inflight() const { return inflight_.size(); }
+
+  void send(TimePoint intended, NumberSource &numbers) {
+    request_.clear();
+    body_.clear();
+    for (uint32_t i = 0; i < FLAGS_batch; ++i)
+      folly::format(&body_, "{}phone[]={}", i ? "&" : "", numbers.next());
+    folly::format(&request_,
+                  "POST /target HTTP/1.1\r\n"
+                  "Host: {}\r\n"
+                  "Content-Type: application/x-www-form-urlencoded\r\n"
+                  "Content-Length: {}\r\n\r\n",
+                  FLAGS_host, body_.size());
+    request_ += body_;
+
+    inflight_.push_back({intended, Clock::now()});
+    socket_->writeChain(nullptr, folly::IOBuf::copyBuffer(request_));
+  }
+
+  /** Give up on the connection at the end of the run. */
+  void abandon() {
+    stats_.lost += inflight_.size();
+    inflight_.clear();
+    socket_->closeNow();
+  }
+
+ private:
+  struct Pending {
+    TimePoint intended;
+    TimePoint sent;
+  };
+
+  void connectSuccess() noexcept override {
+    connected_ = true;
+    socket_->setReadCB(this);
+  }
+
+  void connectErr(const folly::AsyncSocketException &ex) noexcept override {
+    LOG(ERROR) << "HTTP connect failed: " << ex.what();
+  }
+
+  void getReadBuffer(void **buf, size_t *len) noexcept override {
+    if (pos_ > 0 && pos_ * 2 >= in_.size()) {
+      in_.erase(0, pos_);
+      pos_ = 0;
+    }
+    readOff_ = in_.size();
+    in_.resize(readOff_ + kReadSize);
+    *buf = &in_[readOff_];
+    *len = kReadSize;
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    in_.resize(readOff_ + len);
+    TimePoint now = Clock::now();
+    unsigned status;
+    size_t lines;
+    while (!inflight_.empty() && consumeResponse(status, lines)) {
+      const Pending &req = inflight_.front();
+      stats_.record(req.intended, req.sent, now,
+                    status == 200 && lines == FLAGS_batch);
+      inflight_.pop_front();
+    }
+  }
+
+  void readEOF() noexcept override {
+    LOG(ERROR) << "HTTP connection closed by server";
+    fail();
+  }
+
+  void readErr(const folly::AsyncSocketException &ex) noexcept override {
+    LOG(ERROR) << "HTTP read failed: " << ex.what();
+    fail();
+  }
+
+  void fail() {
+    connected_ = false;
+    stats_.lost += inflight_.size();
+    inflight_.clear();
+  }
+
+  /** Parse one complete response at `pos_`, supports both
+    * Content-Length and chunked bodies. Returns false if more input
+    * is needed. `lines` is set to the number of body lines. */
+  bool consumeResponse(unsigned &status, size_t &lines) {
+    StringPiece data(in_.data() + pos_, in_.size() - pos_);
+    size_t eoh = data.find("\r\n\r\n");
+    if (eoh == StringPiece::npos)
+      return false;
+
+    std::vector<StringPiece> header;
+    folly::split("\r\n", data.subpiece(0, eoh), header);
+    StringPiece statusLine = header[0];
+    statusLine.advance(std::min(statusLine.find(' ') + 1, statusLine.size()));
+    status = folly::tryTo<unsigned>(statusLine.subpiece(0, 3)).value_or(0);
+
+    bool chunked = false;
+    size_t length = 0;
+    for (size_t i = 1; i < header.size(); ++i) {
+      StringPiece name, value;
+      if (!folly::split(':', header[i], name, value))
+        continue;
+      value = folly::trimWhitespace(value);
+      if (folly::caseInsensitiveEqual(name, "content-length"))
+        length = folly::tryTo<size_t>(value).value_or(0);
+      else if (folly::caseInsensitiveEqual(name, "transfer-encoding"))
+        chunked = value.find("chunked") != StringPiece::npos;
+    }
+
+    size_t off = eoh + 4;
+    lines = 0;
+    if (!chunked) {
+      if (data.size() < off + length)
+        return false;
+      lines = std::count(data.begin() + off, data.begin() + off + length, '\n');
+      pos_ += off + length;
+      return true;
+    }
+
+    for (;;) {
+      size_t eol = data.find("\r\n", off);
+      if (eol == StringPiece::npos)
+        return false;
+      size_t n = strtoul(data.data() + off, nullptr, 16);
+      off = eol + 2;
+      if (n == 0) {
+        // Last chunk is followed by optional trailers and an empty line
+        size_t end = data.find("\r\n\r\n", off - 2);
+        if (end == StringPiece::npos)
+          return false;
+        off = end + 4;
+        break;
+      }
+      if (data.size() < off + n + 2)
+        return false;
+      lines += std::count(data.begin() + off, data.begin() + off + n, '\n');
+      off += n + 2;
+    }
+    pos_ += off;
+    return true;
+  }
+
+  static constexpr size_t kReadSize = 16384;
+
+  AsyncSocket::UniquePtr socket_;
+  Stats &stats_;
+  bool connected_ = false;
+  std::deque<Pending> inflight_;
+  std::string request_;
+  std::string body_;
+  std::string in_;
+  size_t pos_ = 0;
+  size_t readOff_ = 0;
+};
+
+/** Sends INVITEs over UDP and validates 302 replies with osips_parser. */
+class SipClient : private AsyncUDPSocket::ReadCallback {
+ public:
+  SipClient(EventBase *evb, const SocketAddress &server,
+            unsigned id, Stats &stats)
+    : socket_(evb)
+    , server_(server)
+    , id_(id)
+    , stats_(stats)
+    , recvbuf_(1500)
+  {
+    socket_.bind(SocketAddress(server.getFamily() == AF_INET6
+                               ? "::" : "0.0.0.0", 0));
+    local_ = socket_.address();
+    socket_.resumeRead(this);
+  }
+
+  size_t inflight() const { return pending_.size(); }
+
+  void send(TimePoint intended, NumberSource &numbers) {
+    uint64_t seq = seq_++;
+    uint64_t pn = numbers.next();
+
+    request_.clear();
+    folly::format(&request_,
+                  "INVITE sip:+1{0}@{1}:{2};user=phone SIP/2.0\r\n"
+                  "Via: SIP/2.0/UDP {3}:{4};branch=z9hG4bK-{5}-{6}\r\n"
+                  "From: <sip:loadgen@{3}:{4}>;tag={6}\r\n"
+                  "To: <sip:+1{0}@{1}:{2}>\r\n"
+                  "Call-ID: lg-{5}-{6}\r\n"
+                  "CSeq: 1 INVITE\r\n"
+                  "Max-Forwards: 70\r\n"
+                  "Content-Length: 0\r\n\r\n",
+                  pn, server_.getAddressStr(), server_.getPort(),
+                  local_.getAddressStr(), local_.getPort(), id_, seq);
+
+    TimePoint sent = Clock::now();
+    pending_.emplace(seq, Pending{intended, sent, pn});
+    order_.emplace_back(seq, sent);
+    socket_.write(server_, folly::IOBuf::copyBuffer(request_));
+  }
+
+  /** Account INVITEs without a reply for longer than `--timeout_ms`. */
+  void expire(TimePoint now) {
+    auto timeout = std::chrono::milliseconds(FLAGS_timeout_ms);
+    while (!order_.empty() && order_.front().second + timeout <= now) {
+      if (pending_.erase(order_.front().first))
+        ++stats_.lost;
+      order_.pop_front();
+    }
+  }
+
+ private:
+  struct Pending {
+    TimePoint intended;
+    TimePoint sent;
+    uint64_t pn;
+  };
+
+  void getReadBuffer(void **buf, size_t *len) noexcept override {
+    *buf = recvbuf_.data();
+    *len = recvbuf_.size();
+  }
+
+  void onReadError(const folly::AsyncSocketException &ex) noexcept override {
+    LOG_FIRST_N(ERROR, 20) << ex.what();
+    socket_.resumeRead(this);
+  }
+
+  void onReadClosed() noexcept override {
+  }
+
+  void onDataAvailable(const SocketAddress & /*client*/,
+                       size_t len, bool truncated,
+                       OnDataAvailableParams /*params*/) noexcept override
+  {
+    TimePoint now = Clock::now();
+    struct sip_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.buf = recvbuf_.data();
+    msg.len = len;
+
+    if (!truncated && parse_msg(msg.buf, msg.len, &msg) == 0 &&
+        msg.first_line.type == SIP_REPLY && msg.callid)
+      onReply(msg, now);
+    else
+      LOG_FIRST_N(WARNING, 20) << "Malformed SIP reply received";
+
+    free_sip_msg(&msg);
+  }
+
+  void onReply(const struct sip_msg &msg, TimePoint now) {
+    StringPiece callid = folly::trimWhitespace(
+        StringPiece(msg.callid->body.s, msg.callid->body.len));
+    std::string prefix = folly::to<std::string>("lg-", id_, "-");
+    if (!callid.removePrefix(prefix))
+      return;
+    auto seq = folly::tryTo<uint64_t>(callid);
+    if (!seq)
+      return;
+    auto it = pending_.find(*seq);
+    if (it == pending_.end())
+      return;  // late reply, already counted as lost
+
+    bool valid = false;
+    if (msg.first_line.u.reply.statuscode == 302 && msg.contact) {
+      StringPiece contact(msg.contact->body.s, msg.contact->body.len);
+      std::string user = folly::to<std::string>("sip:+1", it->second.pn, ";");
+      valid = contact.find(user) != StringPiece::npos &&
+              contact.find(";rn=") != StringPiece::npos;
+    }
+    stats_.record(it->second.intended, it->second.sent, now, valid);
+    pending_.erase(it);
+  }
+
+  AsyncUDPSocket socket_;
+  SocketAddress server_;
+  SocketAddress local_;
+  unsigned id_;
+  Stats &stats_;
+  std::vector<char> recvbuf_;
+  std::string request_;
+  uint64_t seq_ = 0;
+  folly::F14FastMap<uint64_t, Pending> pending_;
+  std::deque<std::pair<uint64_t, TimePoint>> order_;
+};
+
+/** Event loop generating its share of HTTP and SIP load. */
+class Worker {
+ public:
+  Worker(unsigned id, TimePoint start, const std::vector<uint64_t> &numbers)
+    : id_(id)
+    , numbers_(numbers, FLAGS_seed + id)
+    , http_(FLAGS_http_rate / FLAGS_threads, start)
+    , sip_(FLAGS_sip_rate / FLAGS_threads, start)
+    , end_(start + std::chrono::seconds(FLAGS_duration))
+  {}
+
+  void run() {
+    evb_.runInEventBaseThread([this] {
+      connect();
+      tick();
+    });
+    evb_.loopForever();
+    for (auto &conn : conns_)
+      conn->abandon();
+    httpStats.lost += backlog_.size();
+    if (sipClient_)
+      sipStats.lost += sipClient_->inflight();
+  }
+
+  Stats httpStats;
+  Stats sipStats;
+
+ private:
+  void connect() {
+    timer_ = folly::AsyncTimeout::make(evb_, [this]() noexcept { tick(); });
+    if (FLAGS_http_rate > 0) {
+      SocketAddress addr(FLAGS_host, FLAGS_http_port, true);
+      for (uint32_t i = 0; i < FLAGS_connections; ++i)
+        conns_.push_back(std::make_unique<HttpConnection>(&evb_, addr, httpStats));
+    }
+    if (FLAGS_sip_rate > 0) {
+      SocketAddress addr(FLAGS_host, FLAGS_sip_port, true);
+      sipClient_ = std::make_unique<SipClient>(&evb_, addr, id_, sipStats);
+    }
+  }
+
+  void tick() {
+    TimePoint now = Clock::now();
+    TimePoint due;
+    TimePoint until = std::min(now, end_);
+
+    while (http_.next(until, due))
+      backlog_.push_back(due);
+    for (size_t tries = 0; !backlog_.empty() && tries < conns_.size(); ) {
+      auto &conn = conns_[next_++ % conns_.size()];
+      if (conn->ready()) {
+        conn->send(backlog_.front(), numbers_);
+        backlog_.pop_front();
+        tries = 0;
+      } else {
+        ++tries;
+      }
+    }
+
+    if (sipClient_) {
+      while (sip_.next(until, due))
+        sipClient_->send(due, numbers_);
+      sipClient_->expire(now);
+    }
+
+    if (now >= end_ && (drained() ||
+        now >= end_ + std::chrono::milliseconds(FLAGS_timeout_ms))) {
+      evb_.terminateLoopSoon();
+      return;
+    }
+    timer_->scheduleTimeout(1);
+  }
+
+  bool drained() const {
+    if (!backlog_.empty())
+      return false;
+    for (auto &conn : conns_) {
+      if (conn->inflight())
+        return false;
+    }
+    return !sipClient_ || sipClient_->inflight() == 0;
+  }
+
+  EventBase evb_;
+  std::unique_ptr<folly::AsyncTimeout> timer_;
+  unsigned id_;
+  NumberSource numbers_;
+  Schedule http_;
+  Schedule sip_;
+  TimePoint end_;
+  std::vector<std::unique_ptr<HttpConnection>> conns_;
+  std::unique_ptr<SipClient> sipClient_;
+  std::deque<TimePoint> backlog_;
+  size_t next_ = 0;
+};
+
+static std::vector<uint64_t> loadNumbers(const std::string &path) {
+  std::vector<uint64_t> numbers;
+  if (path.empty())
+    return numbers;
+
+  std::ifstream in(path);
+  if (!in)
+    LOG(FATAL) << "Could not open " << path;
+  std::string line;
+  while (std::getline(in, line)) {
+    StringPiece field(line);
+    field = field.subpiece(0, std::min(field.find(';'), field.find(',')));
+    uint64_t pn = PhoneNumber::fromString(folly::trimWhitespace(field));
+    if (pn != PhoneNumber::NONE)
+      numbers.push_back(pn);
+  }
+  LOG(INFO) << "Loaded " << numbers.size() << " numbers from " << path;
+  return numbers;
+}
+
+static void report(const char *name, Stats &stats, double seconds) {
+  uint64_t total = stats.ok + stats.bad + stats.lost;
+  if (total == 0)
+    return;
+
+  std::cout << folly::format(
+      "{}: {} requests, {} ok, {} invalid, {} lost, {:.1f} replies/s\n",
+      name, total, stats.ok, stats.bad, stats.lost,
+      (stats.ok + stats.bad) / seconds);
+
+  reportPercentiles(std::cout, "latency", stats.latency);
+  reportPercentiles(std::cout, "service", stats.service);
+}
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+  CHECK(FLAGS_threads > 0);
+  CHECK(FLAGS_http_rate > 0 || FLAGS_sip_rate > 0)
+    << "Set --http_rate and/or --sip_rate";
+
+  std::vector<uint64_t> numbers = loadNumbers(FLAGS_numbers);
+  TimePoint start = Clock::now() + std::chrono::milliseconds(100);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (unsigned i = 0; i < FLAGS_threads; ++i)
+    workers.push_back(std::make_unique<Worker>(i, start, numbers));
+
+  std::vector<std::thread> threads;
+  for (auto &worker : workers)
+    threads.emplace_back([&worker] { worker->run(); });
+  for (auto &thread : threads)
+    thread.join();
+
+  Stats http, sip;
+  for (auto &worker : workers) {
+    http.merge(std::move(worker->httpStats));
+    sip.merge(std::move(worker->sipStats));
+  }
+  report("HTTP /target", http, FLAGS_duration);
+  report("SIP INVITE", sip, FLAGS_duration);
+  return http.bad + http.lost + sip.bad + sip.lost ? 1 : 0;
+}
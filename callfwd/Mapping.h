@@ -0,0 +1,162 @@
+#ifndef CALLFWD_MAPPING_H
+#define CALLFWD_MAPPING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <istream>
+#include <vector>
+
+#include <folly/Range.h>
+#include <folly/synchronization/HazptrHolder.h>
+
+namespace folly { struct dynamic; }
+class MemoryUsage;
+
+/** Key derived from a 10-digit phone number by dropping trailing digits. */
+template <uint64_t Divisor>
+struct PhonePrefix {
+  static constexpr uint64_t kDivisor = Divisor;
+  static uint64_t key(uint64_t pn) noexcept { return pn / Divisor; }
+};
+
+struct FullNumber : PhonePrefix<1> { static constexpr const char *kName = "pn"; };
+struct Npa : PhonePrefix<10000000> { static constexpr const char *kName = "npa"; };
+struct NpaNxx : PhonePrefix<10000> { static constexpr const char *kName = "npa_nxx"; };
+struct NpaNxxX : PhonePrefix<1000> { static constexpr const char *kName = "npa_nxx_x"; };
+
+/** Ordered list of key levels, lookups probe them from first to last
+  * and stop at the first hit. */
+template <class... Levels>
+struct KeyLevels {
+  static constexpr unsigned size = sizeof...(Levels);
+  static_assert(size > 0, "at least one key level is required");
+
+  static uint64_t key(uint64_t pn, unsigned level) noexcept {
+    static constexpr uint64_t divisor[] = { Levels::kDivisor... };
+    return pn / divisor[level];
+  }
+
+  static const char* name(unsigned level) noexcept {
+    static constexpr const char *names[] = { Levels::kName... };
+    return names[level];
+  }
+};
+
+/** Parsed CSV row of a mapping. */
+template <class Value>
+struct MappingRow {
+  unsigned level;
+  uint64_t key;
+  Value value;
+};
+
+/** Immutable phone number keyed dataset, published through a global
+  * pointer and protected by hazard pointers while in use.
+  *
+  * `Policy` describes a particular dataset:
+  *  - `Keys`: KeyLevels<...> the phone number is looked up at
+  *  - `Value`: payload, value-initialized `Value` is returned on miss
+  *  - `kName`: used in log and error messages
+  *  - `kReplicated`: keep a copy per NUMA node with `--numa=replicate`
+  *  - `kUniqueKeys`: throw on duplicate keys instead of keeping the first
+  *  - `parseRow(line, fields, row)`: parse comma separated `fields` of
+  *    CSV `line` into `row`, returns false to skip the line
+  *  - `payloadBytes(value)`: heap memory owned by a non-scalar `Value`
+  *  - `Table` (optional): key level table, F14 hash map by default;
+  *    PhoneBitmap for datasets of full numbers without payload
+  *
+  * Member definitions live in MappingImpl.h, every dataset explicitly
+  * instantiates its mapping. */
+template <class Policy>
+class Mapping {
+ public:
+  using Keys = typename Policy::Keys;
+  using Value = typename Policy::Value;
+  using Row = MappingRow<Value>;
+  static constexpr unsigned kLevels = Keys::size;
+  static constexpr bool kReplicated = Policy::kReplicated;
+
+  class Data; /* opaque */
+
+  class Builder {
+  public:
+    Builder();
+    ~Builder() noexcept;
+
+    /** Attach arbitrary metadata. */
+    void setMetadata(const folly::dynamic &meta);
+
+    /** Preallocate memory for expected number of records in `level`. */
+    void sizeHint(size_t numRecords, unsigned level = 0);
+
+    /** Add a new row into the scratch buffer. Throws `runtime_error` if
+      * key already exists and the dataset requires unique keys. */
+    Builder& addRow(uint64_t key, Value value, unsigned level = 0);
+
+    /** Add many rows from CSV text stream, `level` is the default for
+      * rows which don't select one themselves. */
+    void fromCSV(std::istream &in, size_t &line, size_t limit, unsigned level = 0);
+
+    /** Copy all key levels but `level` from a loaded dataset, so a
+      * single level can be reloaded on its own. */
+    void inherit(const Mapping &from, unsigned level);
+
+    /** Build indexes and release the data. */
+    Mapping build();
+
+    /** Build indexes and commit data to global. */
+    void commit(std::atomic<Data*> &global);
+
+  private:
+    std::unique_ptr<Data> data_;
+    std::vector<folly::StringPiece> fields_;
+  };
+
+  /** Construct taking ownership of Data. Used for tests. */
+  Mapping(std::unique_ptr<Data> data);
+  /** Construct from globals and hold protected reference. */
+  Mapping(std::atomic<Data*> &global);
+  /** Ensure move constructor exists */
+  Mapping(Mapping&& rhs) noexcept;
+  /** Get current instance from global variable, NUMA local if replicated. */
+  static Mapping get() noexcept;
+  /** Replace `replica` with a copy of `source`. Memory is allocated
+    * by the calling thread, so it follows its NUMA placement. */
+  static void replicate(std::atomic<Data*> &source, std::atomic<Data*> &replica);
+  /** Check if DB fully loaded into memory. */
+  static bool isAvailable() noexcept;
+  ~Mapping() noexcept;
+
+  /** Check if instance holds a dataset, it doesn't if taken before
+    * the first load. */
+  bool isLoaded() const noexcept { return data_ != nullptr; }
+
+  /** Get total number of records over all levels */
+  size_t size() const noexcept;
+
+  /** Log metadata to system journal */
+  void printMetadata();
+
+  /** Add memory used by the dataset, nothing if not loaded. */
+  void memoryUsage(MemoryUsage &usage) const;
+
+  /** Get a value for phone number.
+    * If no key level matches returns value-initialized `Value`. */
+  Value lookup(uint64_t pn) const;
+
+  /** Get values for a batch of phone numbers.
+    * Faster than calling lookup() multiple times. */
+  void lookups(size_t N, const uint64_t *pn, Value *out) const;
+
+  /** Number of keys of `level` in [from, to). Answered from the rank
+    * index of bitmap tables, hash tables are scanned. */
+  size_t count(uint64_t from, uint64_t to, unsigned level = 0) const;
+
+ private:
+  folly::hazptr_holder<> holder_;
+  const Data *data_;
+};
+
+#endif // CALLFWD_MAPPING_H
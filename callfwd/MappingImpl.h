@@ -0,0 +1,332 @@
+#ifndef CALLFWD_MAPPINGIMPL_H
+#define CALLFWD_MAPPINGIMPL_H
+
+/* Member definitions of Mapping<Policy>, included only by translation
+ * units which explicitly instantiate a mapping. */
+
+#include "Mapping.h"
+#include "HugePages.h"
+#include "MemoryUsage.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <glog/logging.h>
+#include <folly/json.h>
+#include <folly/dynamic.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/small_vector.h>
+#include <folly/container/F14Map.h>
+#include <folly/synchronization/Hazptr.h>
+#include <folly/portability/GFlags.h>
+
+DECLARE_uint32(f14map_prefetch);
+
+/** Default key level table, an F14 hash map from key to value. */
+template <class V>
+class HashTable {
+ public:
+  using Value = V;
+  using Token = folly::F14HashToken;
+  static constexpr const char *kKind = "hash_table";
+
+  bool empty() const noexcept { return map_.empty(); }
+  size_t size() const noexcept { return map_.size(); }
+  void reserve(size_t numRecords) { map_.reserve(numRecords); }
+  void finalize() {}
+
+  /** Add a key, returns false if already present. */
+  bool insert(uint64_t key, Value value) {
+    return map_.emplace(key, std::move(value)).second;
+  }
+
+  /** Compute hash and prefetch bucket into CPU cache. */
+  Token prefetch(uint64_t key) const { return map_.prehash(key); }
+
+  /** Copy value of a prefetched key into `out`, false if not found. */
+  bool find(Token token, uint64_t key, Value &out) const {
+    const auto it = map_.find(token, key);
+    if (it == map_.cend())
+      return false;
+    out = it->second;
+    return true;
+  }
+
+  /** Number of keys in [from, to), scans the whole table. */
+  size_t count(uint64_t from, uint64_t to) const noexcept {
+    size_t ret = 0;
+    for (const auto &kv : map_)
+      ret += kv.first >= from && kv.first < to;
+    return ret;
+  }
+
+  size_t memory() const noexcept { return memoryOf(map_); }
+
+  template <class F>
+  void forEachValue(F &&fn) const {
+    for (const auto &kv : map_)
+      fn(kv.second);
+  }
+
+ private:
+  HugeF14ValueMap<uint64_t, Value> map_;
+};
+
+/** Key level table of a policy: `Policy::Table` if given, hash table otherwise. */
+template <class Policy, class = void>
+struct MappingTable {
+  using type = HashTable<typename Policy::Value>;
+};
+
+template <class Policy>
+struct MappingTable<Policy, std::void_t<typename Policy::Table>> {
+  using type = typename Policy::Table;
+};
+
+template <class Policy>
+class Mapping<Policy>::Data : public folly::hazptr_obj_base<Data> {
+ public:
+  using Table = typename MappingTable<Policy>::type;
+  static_assert(std::is_same<typename Table::Value, Value>::value,
+                "table must store the policy value");
+
+  void lookups(size_t N, const uint64_t *pn, Value *out) const;
+  void memoryUsage(MemoryUsage &usage) const;
+  /** Finalize tables once the last row is added. */
+  void finalize();
+  ~Data() noexcept;
+
+  // metadata
+  folly::dynamic meta;
+  // key->value table for every key level
+  std::array<Table, kLevels> tables;
+  // bytes accounted by retireDataset()
+  size_t retiredBytes = 0;
+  // payloads not fitting into inline buffers, counted by finalize()
+  size_t payloadBytes = 0;
+};
+
+template <class Policy>
+Mapping<Policy>::Data::~Data() noexcept {
+  memoryReclaimed(retiredBytes);
+}
+
+template <class Policy>
+void Mapping<Policy>::Data::finalize() {
+  for (auto &table : tables)
+    table.finalize();
+
+  // Counted while building, so memoryUsage() doesn't walk the values
+  if constexpr (!std::is_scalar<Value>::value) {
+    payloadBytes = 0;
+    for (const auto &table : tables) {
+      table.forEachValue([&](const Value &value) {
+        payloadBytes += Policy::payloadBytes(value);
+      });
+    }
+  }
+}
+
+template <class Policy>
+void Mapping<Policy>::Data::lookups(size_t N, const uint64_t *pn, Value *out) const {
+  size_t batch = std::min<size_t>(N, FLAGS_f14map_prefetch);
+  folly::small_vector<typename Table::Token, kLevels> token(batch * kLevels);
+
+  while (N > 0) {
+    size_t M = std::min<size_t>(N, batch);
+
+    // Locate keys of every level and prefetch them into CPU cache
+    for (unsigned l = 0; l < kLevels; ++l) {
+      if (tables[l].empty())
+        continue;
+      for (size_t i = 0; i < M; ++i)
+        token[l * batch + i] = tables[l].prefetch(Keys::key(pn[i], l));
+    }
+
+    // Fill output vector, the first matching level wins
+    for (size_t i = 0; i < M; ++i) {
+      out[i] = Value{};
+      for (unsigned l = 0; l < kLevels; ++l) {
+        if (!tables[l].empty() &&
+            tables[l].find(token[l * batch + i], Keys::key(pn[i], l), out[i]))
+          break;
+      }
+    }
+
+    pn += M;
+    out += M;
+    N -= M;
+  }
+}
+
+template <class Policy>
+void Mapping<Policy>::lookups(size_t N, const uint64_t *pn, Value *out) const {
+  data_->lookups(N, pn, out);
+}
+
+template <class Policy>
+typename Mapping<Policy>::Value Mapping<Policy>::lookup(uint64_t pn) const {
+  Value value;
+  lookups(1, &pn, &value);
+  return value;
+}
+
+template <class Policy>
+Mapping<Policy>::Builder::Builder()
+  : data_(std::make_unique<Data>())
+{}
+
+template <class Policy>
+Mapping<Policy>::Builder::~Builder() noexcept = default;
+
+template <class Policy>
+void Mapping<Policy>::Builder::sizeHint(size_t numRecords, unsigned level) {
+  data_->tables.at(level).reserve(numRecords);
+}
+
+template <class Policy>
+void Mapping<Policy>::Builder::setMetadata(const folly::dynamic &meta) {
+  data_->meta = meta;
+}
+
+template <class Policy>
+typename Mapping<Policy>::Builder&
+Mapping<Policy>::Builder::addRow(uint64_t key, Value value, unsigned level) {
+  bool inserted = data_->tables.at(level).insert(key, std::move(value));
+  if (!inserted && Policy::kUniqueKeys)
+    throw std::runtime_error(std::string(Policy::kName) + "::Builder: duplicate key");
+  return *this;
+}
+
+template <class Policy>
+void Mapping<Policy>::Builder::fromCSV(std::istream &in, size_t &line,
+                                       size_t limit, unsigned level) {
+  std::string linebuf;
+  Row row;
+
+  for (limit += line; line < limit; ++line) {
+    if (in.peek() == EOF)
+      break;
+    std::getline(in, linebuf);
+
+    fields_.clear();
+    folly::split(',', linebuf, fields_);
+    row.level = level;
+    if (Policy::parseRow(linebuf, fields_, row))
+      addRow(row.key, std::move(row.value), row.level);
+  }
+}
+
+template <class Policy>
+void Mapping<Policy>::Builder::inherit(const Mapping &from, unsigned level) {
+  if (!from.data_)
+    return;
+  for (unsigned l = 0; l < kLevels; ++l) {
+    if (l != level)
+      data_->tables[l] = from.data_->tables[l];
+  }
+}
+
+template <class Policy>
+Mapping<Policy> Mapping<Policy>::Builder::build() {
+  auto data = std::make_unique<Data>();
+  std::swap(data, data_);
+  data->finalize();
+  return Mapping(std::move(data));
+}
+
+template <class Policy>
+void Mapping<Policy>::Builder::commit(std::atomic<Data*> &global) {
+  auto data = std::make_unique<Data>();
+  std::swap(data, data_);
+  data->finalize();
+
+  std::string counts;
+  for (unsigned l = 0; l < kLevels; ++l)
+    folly::format(&counts, " {}={}", Keys::name(l), data->tables[l].size());
+  if (Data *veteran = global.exchange(data.release()))
+    retireDataset(veteran);
+  LOG(INFO) << Policy::kName << " updated:" << counts;
+}
+
+template <class Policy>
+void Mapping<Policy>::replicate(std::atomic<Data*> &source, std::atomic<Data*> &replica) {
+  Mapping master(source);
+  if (!master.data_)
+    return;
+
+  auto data = std::make_unique<Data>(*master.data_);
+  if (Data *veteran = replica.exchange(data.release()))
+    retireDataset(veteran);
+}
+
+template <class Policy>
+Mapping<Policy>::Mapping(std::unique_ptr<Data> data) {
+  CHECK(FLAGS_f14map_prefetch > 0);
+  holder_.reset(data.get());
+  data->retire();
+  data_ = data.release();
+}
+
+template <class Policy>
+Mapping<Policy>::Mapping(std::atomic<Data*> &global)
+  : data_(holder_.get_protected(global))
+{
+  CHECK(FLAGS_f14map_prefetch > 0);
+}
+
+template <class Policy>
+Mapping<Policy>::Mapping(Mapping&& rhs) noexcept = default;
+
+template <class Policy>
+Mapping<Policy>::~Mapping() noexcept = default;
+
+template <class Policy>
+void Mapping<Policy>::printMetadata() {
+  if (!data_)
+    return;
+  LOG(INFO) << Policy::kName << " info:";
+  for (auto kv : data_->meta.items())
+    LOG(INFO) << "  " << kv.first.asString()
+                  << ": " << folly::toJson(kv.second);
+}
+
+template <class Policy>
+void Mapping<Policy>::Data::memoryUsage(MemoryUsage &usage) const {
+  usage.add("metadata", sizeof(*this) + memoryOf(meta));
+  for (unsigned l = 0; l < kLevels; ++l) {
+    if (kLevels == 1)
+      usage.add(Table::kKind, tables[l].memory());
+    else
+      usage.add(std::string(Table::kKind) + "_" + Keys::name(l), tables[l].memory());
+  }
+
+  // Payloads not fitting into inline buffers
+  if constexpr (!std::is_scalar<Value>::value)
+    usage.add("strings", payloadBytes);
+}
+
+template <class Policy>
+void Mapping<Policy>::memoryUsage(MemoryUsage &usage) const {
+  if (data_)
+    data_->memoryUsage(usage);
+}
+
+template <class Policy>
+size_t Mapping<Policy>::size() const noexcept {
+  size_t total = 0;
+  for (const auto &table : data_->tables)
+    total += table.size();
+  return total;
+}
+
+template <class Policy>
+size_t Mapping<Policy>::count(uint64_t from, uint64_t to, unsigned level) const {
+  return data_->tables.at(level).count(from, to);
+}
+
+#endif // CALLFWD_MAPPINGIMPL_H
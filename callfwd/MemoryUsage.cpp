@@ -0,0 +1,77 @@
+#include "MemoryUsage.h"
+
+#include <atomic>
+#include <folly/dynamic.h>
+
+static std::atomic<size_t> retiredDatasets{0};
+static std::atomic<size_t> retiredBytes{0};
+
+void MemoryUsage::add(folly::StringPiece component, size_t bytes) {
+  for (auto &kv : components_) {
+    if (kv.first == component) {
+      kv.second += bytes;
+      return;
+    }
+  }
+  components_.emplace_back(component.str(), bytes);
+}
+
+size_t MemoryUsage::total() const noexcept {
+  size_t sum = 0;
+  for (const auto &kv : components_)
+    sum += kv.second;
+  return sum;
+}
+
+folly::dynamic MemoryUsage::toDynamic() const {
+  folly::dynamic ret = folly::dynamic::object;
+  for (const auto &kv : components_)
+    ret[kv.first] = kv.second;
+  ret["total"] = total();
+  return ret;
+}
+
+size_t memoryOf(const std::string &s) noexcept {
+  // Short strings are stored inline
+  const char *self = reinterpret_cast<const char*>(&s);
+  if (s.data() >= self && s.data() < self + sizeof(s))
+    return 0;
+  return s.capacity() + 1;
+}
+
+size_t memoryOf(const folly::dynamic &d) {
+  switch (d.type()) {
+  case folly::dynamic::STRING:
+    return memoryOf(d.getString());
+  case folly::dynamic::ARRAY: {
+    size_t sum = d.size() * sizeof(folly::dynamic);
+    for (const auto &v : d)
+      sum += memoryOf(v);
+    return sum;
+  }
+  case folly::dynamic::OBJECT: {
+    size_t sum = d.size() * 2 * sizeof(folly::dynamic);
+    for (const auto &kv : d.items())
+      sum += memoryOf(kv.first) + memoryOf(kv.second);
+    return sum;
+  }
+  default:
+    return 0;
+  }
+}
+
+void memoryRetired(size_t bytes) noexcept {
+  ++retiredDatasets;
+  retiredBytes += bytes;
+}
+
+void memoryReclaimed(size_t bytes) noexcept {
+  if (bytes == 0)
+    return; // never retired by reload
+  --retiredDatasets;
+  retiredBytes -= bytes;
+}
+
+RetiredMemory retiredMemory() noexcept {
+  return { retiredDatasets.load(), retiredBytes.load() };
+}
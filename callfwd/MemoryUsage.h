@@ -0,0 +1,67 @@
+#ifndef CALLFWD_MEMORYUSAGE_H
+#define CALLFWD_MEMORYUSAGE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <folly/Range.h>
+#include <folly/container/F14Map.h>
+
+namespace folly { struct dynamic; }
+
+/** Bytes allocated by a dataset, broken down by component. */
+class MemoryUsage {
+ public:
+  /** Add `bytes` to a named component. */
+  void add(folly::StringPiece component, size_t bytes);
+
+  /** Sum of all components. */
+  size_t total() const noexcept;
+
+  /** Object mapping component names to bytes, plus "total". */
+  folly::dynamic toDynamic() const;
+
+ private:
+  std::vector<std::pair<std::string, size_t>> components_;
+};
+
+/** Heap bytes owned by a container, the object itself is not counted. */
+template <class T, class A>
+size_t memoryOf(const std::vector<T, A> &v) noexcept {
+  return v.capacity() * sizeof(T);
+}
+
+template <class K, class V, class H, class E, class A>
+size_t memoryOf(const folly::F14ValueMap<K, V, H, E, A> &m) noexcept {
+  return m.getAllocatedMemorySize();
+}
+
+size_t memoryOf(const std::string &s) noexcept;
+size_t memoryOf(const folly::dynamic &d);
+
+/** Retired datasets still waiting for readers to release them. */
+struct RetiredMemory {
+  size_t datasets;
+  size_t bytes;
+};
+
+/** Account retirement and reclamation of a dataset. */
+void memoryRetired(size_t bytes) noexcept;
+void memoryReclaimed(size_t bytes) noexcept;
+RetiredMemory retiredMemory() noexcept;
+
+/** Retire a dataset replaced by reload and track its memory until
+  * reclaimed. `Data` provides `memoryUsage()` and `retiredBytes`, the
+  * latter is passed to memoryReclaimed() from its destructor. */
+template <class Data>
+void retireDataset(Data *veteran) {
+  MemoryUsage usage;
+  veteran->memoryUsage(usage);
+  veteran->retiredBytes = usage.total();
+  memoryRetired(veteran->retiredBytes);
+  veteran->retire();
+}
+
+#endif // CALLFWD_MEMORYUSAGE_H
@@ -0,0 +1,414 @@
+#include "Metrics.h"
+#include "CallFwd.h"
+
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <vector>
+#include <glog/logging.h>
+#include <folly/Conv.h>
+#include <folly/Format.h>
+#include <folly/Synchronized.h>
+#include <folly/ThreadLocal.h>
+#include <folly/lang/Bits.h>
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+
+using folly::StringPiece;
+using proxygen::RequestHandler;
+using proxygen::RequestHandlerFactory;
+using proxygen::HTTPMessage;
+
+static constexpr size_t kMaxSlots = 4096;
+// Histogram geometry: values below 2^kSubBits are exact, then every
+// power of two is split into 2^kSubBits linear sub-buckets.
+static constexpr unsigned kSubBits = 3;
+static constexpr unsigned kSubBuckets = 1 << kSubBits;
+static constexpr unsigned kMaxExp = 36;
+static constexpr size_t kBuckets = kSubBuckets + (kMaxExp - kSubBits) * kSubBuckets;
+// Status codes tracked separately, anything else goes to "other"
+static constexpr unsigned kStatusCodes[] = {
+  200, 302, 400, 401, 404, 405, 429, 500, 503
+};
+static constexpr size_t kStatusSlots = std::size(kStatusCodes) + 1;
+static constexpr double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+enum class MetricKind { COUNTER, STATUS, HISTOGRAM };
+
+struct MetricInfo {
+  const char *name;
+  const char *help;
+  const char *labels;
+  MetricKind kind;
+  double scale;
+  size_t slot;
+};
+
+using SlotArray = std::array<std::atomic<uint64_t>, kMaxSlots>;
+
+// Totals of exited threads
+static SlotArray orphanSlots{};
+
+struct MetricSlab {
+  SlotArray slot{};
+
+  ~MetricSlab() {
+    for (size_t i = 0; i < kMaxSlots; ++i) {
+      if (uint64_t v = slot[i].load(std::memory_order_relaxed))
+        orphanSlots[i].fetch_add(v, std::memory_order_relaxed);
+    }
+  }
+};
+
+struct MetricTag {};
+using SlabPerThread = folly::ThreadLocal<MetricSlab, MetricTag, folly::AccessModeStrict>;
+
+static SlabPerThread& slabs() {
+  static SlabPerThread instance;
+  return instance;
+}
+
+struct MetricRegistry {
+  std::vector<MetricInfo> metrics;
+  size_t used = 0;
+};
+
+static folly::Synchronized<MetricRegistry>& registry() {
+  static folly::Synchronized<MetricRegistry> instance;
+  return instance;
+}
+
+static size_t registerMetric(MetricInfo info, size_t nslots) {
+  auto r = registry().wlock();
+  CHECK(r->used + nslots <= kMaxSlots) << "too many metrics";
+  info.slot = r->used;
+  r->used += nslots;
+  r->metrics.push_back(info);
+  return info.slot;
+}
+
+/** Single writer per slab, so plain load/store is enough */
+static inline void bump(size_t slot, uint64_t n) noexcept {
+  std::atomic<uint64_t> &cell = slabs()->slot[slot];
+  cell.store(cell.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+/** Sum slots of all threads including exited ones */
+static std::vector<uint64_t> snapshot() {
+  std::vector<uint64_t> sum(kMaxSlots);
+  for (size_t i = 0; i < kMaxSlots; ++i)
+    sum[i] = orphanSlots[i].load(std::memory_order_relaxed);
+  for (const MetricSlab &slab : slabs().accessAllThreads()) {
+    for (size_t i = 0; i < kMaxSlots; ++i)
+      sum[i] += slab.slot[i].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+size_t MetricHistogram::bucketOf(uint64_t value) noexcept {
+  if (value < kSubBuckets)
+    return value;
+  unsigned exp = folly::findLastSet(value) - 1;
+  if (exp >= kMaxExp)
+    return kBuckets - 1;
+  return kSubBuckets * (exp - kSubBits + 1)
+    + ((value >> (exp - kSubBits)) & (kSubBuckets - 1));
+}
+
+uint64_t MetricHistogram::bucketLowerBound(size_t bucket) noexcept {
+  if (bucket < kSubBuckets)
+    return bucket;
+  unsigned exp = bucket / kSubBuckets - 1 + kSubBits;
+  return (kSubBuckets + bucket % kSubBuckets) << (exp - kSubBits);
+}
+
+MetricCounter::MetricCounter(const char *name, const char *help, const char *labels)
+  : slot_(registerMetric({name, help, labels, MetricKind::COUNTER, 1, 0}, 1))
+{}
+
+void MetricCounter::inc(uint64_t n) noexcept {
+  bump(slot_, n);
+}
+
+MetricStatusCounter::MetricStatusCounter(const char *name, const char *help,
+                                         const char *labels)
+  : slot_(registerMetric({name, help, labels, MetricKind::STATUS, 1, 0},
+                         kStatusSlots))
+{}
+
+void MetricStatusCounter::inc(unsigned status) noexcept {
+  size_t i = 0;
+  while (i < std::size(kStatusCodes) && kStatusCodes[i] != status)
+    ++i;
+  bump(slot_ + i, 1);
+}
+
+MetricHistogram::MetricHistogram(const char *name, const char *help,
+                                 const char *labels, double scale)
+  : slot_(registerMetric({name, help, labels, MetricKind::HISTOGRAM, scale, 0},
+                         kBuckets + 1))
+{}
+
+void MetricHistogram::record(uint64_t value) noexcept {
+  bump(slot_ + bucketOf(value), 1);
+  bump(slot_ + kBuckets, value);
+}
+
+struct ReloadStats {
+  size_t rows = 0;
+  uint64_t success = 0;
+  uint64_t failure = 0;
+  double lastReload = 0;
+  double took = 0;
+  double reclaim = 0;
+};
+
+static folly::Synchronized<std::map<std::string, ReloadStats>> reloadStats;
+
+void recordReload(StringPiece dataset, bool success, size_t rows,
+                  std::chrono::nanoseconds took,
+                  std::chrono::nanoseconds reclaim)
+{
+  using namespace std::chrono;
+  using fsec = duration<double>;
+
+  auto stats = reloadStats.wlock();
+  ReloadStats &entry = (*stats)[dataset.str()];
+  if (!success) {
+    ++entry.failure;
+    return;
+  }
+
+  ++entry.success;
+  entry.rows = rows;
+  entry.took = duration_cast<fsec>(took).count();
+  entry.reclaim = duration_cast<fsec>(reclaim).count();
+  entry.lastReload = duration_cast<fsec>(system_clock::now().time_since_epoch()).count();
+}
+
+static void appendSample(std::string &out, StringPiece name, StringPiece labels,
+                         StringPiece extra, double value)
+{
+  out.append(name.begin(), name.end());
+  if (!labels.empty() || !extra.empty()) {
+    out += '{';
+    out.append(labels.begin(), labels.end());
+    if (!labels.empty() && !extra.empty())
+      out += ',';
+    out.append(extra.begin(), extra.end());
+    out += '}';
+  }
+  out += ' ';
+  folly::toAppend(value, &out);
+  out += '\n';
+}
+
+static void renderHistogram(std::string &out, const MetricInfo &m,
+                            const std::vector<uint64_t> &sum)
+{
+  const uint64_t *bucket = &sum[m.slot];
+  uint64_t total = 0;
+  for (size_t i = 0; i < kBuckets; ++i)
+    total += bucket[i];
+
+  // Export coarse power of two buckets, they are aligned with fine ones
+  // so each one counts integer values strictly below 2^exp, that is up to
+  // and including 2^exp - 1 as the "le" label means.
+  std::string name = folly::to<std::string>(m.name, "_bucket");
+  uint64_t cumulative = 0;
+  size_t i = 0;
+  for (unsigned exp = 0; exp < kMaxExp; ++exp) {
+    for (size_t end = MetricHistogram::bucketOf(uint64_t(1) << exp); i < end; ++i)
+      cumulative += bucket[i];
+    double le = ((uint64_t(1) << exp) - 1) / m.scale;
+    appendSample(out, name, m.labels,
+                 folly::to<std::string>("le=\"", le, "\""), cumulative);
+  }
+  appendSample(out, name, m.labels, "le=\"+Inf\"", total);
+  appendSample(out, folly::to<std::string>(m.name, "_sum"), m.labels, "",
+               bucket[kBuckets] / m.scale);
+  appendSample(out, folly::to<std::string>(m.name, "_count"), m.labels, "",
+               total);
+}
+
+static void renderQuantiles(std::string &out, const MetricInfo &m,
+                            const std::vector<uint64_t> &sum)
+{
+  const uint64_t *bucket = &sum[m.slot];
+  uint64_t total = 0;
+  for (size_t i = 0; i < kBuckets; ++i)
+    total += bucket[i];
+
+  std::string name = folly::to<std::string>(m.name, "_quantile");
+  for (double q : kQuantiles) {
+    // Report upper bound of the bucket holding the requested rank
+    uint64_t rank = q * total;
+    uint64_t seen = 0;
+    size_t i = 0;
+    while (i + 1 < kBuckets && seen + bucket[i] <= rank)
+      seen += bucket[i++];
+    double value = total ? MetricHistogram::bucketLowerBound(i + 1) / m.scale : 0;
+    appendSample(out, name, m.labels,
+                 folly::to<std::string>("quantile=\"", q, "\""), value);
+  }
+}
+
+std::string renderMetrics() {
+  std::vector<uint64_t> sum = snapshot();
+  std::map<std::string, std::vector<MetricInfo>> families;
+  for (const MetricInfo &m : registry().rlock()->metrics)
+    families[m.name].push_back(m);
+
+  std::string out;
+  for (const auto &family : families) {
+    const MetricInfo &head = family.second.front();
+    const char *type = head.kind == MetricKind::HISTOGRAM ? "histogram" : "counter";
+    folly::format(&out, "# HELP {} {}\n# TYPE {} {}\n",
+                  head.name, head.help, head.name, type);
+
+    for (const MetricInfo &m : family.second) {
+      switch (m.kind) {
+      case MetricKind::COUNTER:
+        appendSample(out, m.name, m.labels, "", sum[m.slot]);
+        break;
+      case MetricKind::STATUS:
+        for (size_t i = 0; i < kStatusSlots; ++i) {
+          std::string code = i < std::size(kStatusCodes)
+            ? folly::sformat("code=\"{}\"", kStatusCodes[i])
+            : std::string("code=\"other\"");
+          appendSample(out, m.name, m.labels, code, sum[m.slot + i]);
+        }
+        break;
+      case MetricKind::HISTOGRAM:
+        renderHistogram(out, m, sum);
+        break;
+      }
+    }
+
+    if (head.kind == MetricKind::HISTOGRAM) {
+      folly::format(&out, "# HELP {}_quantile {} (quantile estimate)\n"
+                    "# TYPE {}_quantile gauge\n",
+                    head.name, head.help, head.name);
+      for (const MetricInfo &m : family.second)
+        renderQuantiles(out, m, sum);
+    }
+  }
+
+  auto stats = reloadStats.rlock();
+  auto gauge = [&](const char *name, const char *help, auto get) {
+    folly::format(&out, "# HELP {} {}\n# TYPE {} gauge\n", name, help, name);
+    for (const auto &kv : *stats) {
+      appendSample(out, name, folly::sformat("dataset=\"{}\"", kv.first), "",
+                   get(kv.second));
+    }
+  };
+  gauge("callfwd_dataset_rows", "Number of rows in the active dataset",
+        [](const ReloadStats &s) { return double(s.rows); });
+  gauge("callfwd_dataset_last_reload_timestamp_seconds",
+        "Unix time of the last successful reload",
+        [](const ReloadStats &s) { return s.lastReload; });
+  gauge("callfwd_dataset_reload_duration_seconds",
+        "Time spent reading and indexing the last reload",
+        [](const ReloadStats &s) { return s.took; });
+  gauge("callfwd_dataset_reclaim_duration_seconds",
+        "Time spent waiting for readers of the retired dataset",
+        [](const ReloadStats &s) { return s.reclaim; });
+
+  const char *reloads = "callfwd_dataset_reloads_total";
+  folly::format(&out, "# HELP {} Number of reload attempts\n"
+                "# TYPE {} counter\n", reloads, reloads);
+  for (const auto &kv : *stats) {
+    appendSample(out, reloads, folly::sformat("dataset=\"{}\"", kv.first),
+                 "result=\"success\"", kv.second.success);
+    appendSample(out, reloads, folly::sformat("dataset=\"{}\"", kv.first),
+                 "result=\"failure\"", kv.second.failure);
+  }
+  return out;
+}
+
+static MetricHistogram targetLatency("callfwd_request_duration_seconds",
+                                     "Time from request to complete response",
+                                     "endpoint=\"target\"", 1e6);
+static MetricHistogram reverseLatency("callfwd_request_duration_seconds",
+                                      "Time from request to complete response",
+                                      "endpoint=\"reverse\"", 1e6);
+static MetricHistogram portedLatency("callfwd_request_duration_seconds",
+                                     "Time from request to complete response",
+                                     "endpoint=\"ported\"", 1e6);
+static MetricStatusCounter targetStatus("callfwd_responses_total",
+                                        "Number of responses by status code",
+                                        "endpoint=\"target\"");
+static MetricStatusCounter reverseStatus("callfwd_responses_total",
+                                         "Number of responses by status code",
+                                         "endpoint=\"reverse\"");
+static MetricStatusCounter portedStatus("callfwd_responses_total",
+                                        "Number of responses by status code",
+                                        "endpoint=\"ported\"");
+
+class MetricsFilter final : public proxygen::Filter {
+ public:
+  MetricsFilter(RequestHandler* upstream, MetricHistogram &latency,
+                MetricStatusCounter &status)
+    : Filter(upstream)
+    , latency_(latency)
+    , status_(status)
+    , start_(std::chrono::steady_clock::now())
+  {}
+
+  void sendHeaders(HTTPMessage& msg) noexcept override {
+    code_ = msg.getStatusCode();
+    Filter::sendHeaders(msg);
+  }
+
+  void requestComplete() noexcept override {
+    account();
+    Filter::requestComplete();
+  }
+
+  void onError(proxygen::ProxygenError err) noexcept override {
+    account();
+    Filter::onError(err);
+  }
+
+ private:
+  void account() noexcept {
+    latency_.record(std::chrono::steady_clock::now() - start_);
+    status_.inc(code_);
+  }
+
+  MetricHistogram &latency_;
+  MetricStatusCounter &status_;
+  std::chrono::steady_clock::time_point start_;
+  unsigned code_ = 0;
+};
+
+class MetricsHandlerFactory : public RequestHandlerFactory {
+ public:
+  void onServerStart(folly::EventBase* /*evb*/) noexcept override {
+  }
+
+  void onServerStop() noexcept override {
+  }
+
+  RequestHandler* onRequest(RequestHandler *upstream, HTTPMessage *msg) noexcept override {
+    const StringPiece path = msg->getPathAsStringPiece();
+
+    if (path == "/target") {
+      return new MetricsFilter(upstream, targetLatency, targetStatus);
+    } else if (path == "/reverse") {
+      return new MetricsFilter(upstream, reverseLatency, reverseStatus);
+    } else if (path == "/ported" || path == "/ported/count") {
+      return new MetricsFilter(upstream, portedLatency, portedStatus);
+    } else {
+      return upstream;
+    }
+  }
+};
+
+std::unique_ptr<RequestHandlerFactory> makeMetricsHandlerFactory()
+{
+  return std::make_unique<MetricsHandlerFactory>();
+}
@@ -0,0 +1,69 @@
+#ifndef CALLFWD_METRICS_H
+#define CALLFWD_METRICS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <string>
+
+#include <folly/Range.h>
+
+/** Monotonic counter. Each thread increments its own slot without
+  * atomic RMW, slots are summed only when metrics are scraped. */
+class MetricCounter {
+ public:
+  MetricCounter(const char *name, const char *help, const char *labels = "");
+
+  void inc(uint64_t n = 1) noexcept;
+
+ private:
+  size_t slot_;
+};
+
+/** Counter of response status codes split by a fixed set of codes. */
+class MetricStatusCounter {
+ public:
+  MetricStatusCounter(const char *name, const char *help, const char *labels);
+
+  void inc(unsigned status) noexcept;
+
+ private:
+  size_t slot_;
+};
+
+/** HDR-style log-linear histogram with 8 sub-buckets per power of two.
+  * Values are recorded in integer units (e.g. microseconds, rows) and
+  * exported divided by `scale` (e.g. 1e6 to get seconds). */
+class MetricHistogram {
+ public:
+  MetricHistogram(const char *name, const char *help,
+                  const char *labels = "", double scale = 1);
+
+  void record(uint64_t value) noexcept;
+
+  template <class Rep, class Period>
+  void record(std::chrono::duration<Rep, Period> d) noexcept {
+    using namespace std::chrono;
+    record(duration_cast<microseconds>(d).count());
+  }
+
+  /** Fine bucket counting `value`. */
+  static size_t bucketOf(uint64_t value) noexcept;
+  /** Smallest value counted by `bucket`. */
+  static uint64_t bucketLowerBound(size_t bucket) noexcept;
+
+ private:
+  size_t slot_;
+};
+
+/** Account a dataset reload attempt.
+  * `took` covers reading and index building, `reclaim` is spent waiting
+  * for readers to release the retired dataset. */
+void recordReload(folly::StringPiece dataset, bool success, size_t rows,
+                  std::chrono::nanoseconds took,
+                  std::chrono::nanoseconds reclaim = {});
+
+/** Render all metrics in Prometheus text exposition format. */
+std::string renderMetrics();
+
+#endif // CALLFWD_METRICS_H
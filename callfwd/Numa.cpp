@@ -0,0 +1,177 @@
+#include "Numa.h"
+#include "CallFwd.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <folly/portability/GFlags.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+
+using proxygen::RequestHandlerFactory;
+using proxygen::RequestHandler;
+
+DEFINE_string(numa, "off",
+              "NUMA placement: off, replicate (per-node copy of LRN and DNC "
+              "tables) or interleave (spread all datasets across nodes). "
+              "Worker threads are pinned to nodes unless off");
+
+namespace {
+
+struct NumaNode {
+  unsigned id;
+  std::vector<unsigned> cpus;
+};
+
+struct NumaTopology {
+  enum { OFF, REPLICATE, INTERLEAVE } mode = OFF;
+  std::vector<NumaNode> nodes;
+  unsigned long allNodes = 0;
+};
+
+/** Parse sysfs cpu/node lists like "0-15,32-47". */
+std::vector<unsigned> parseList(const std::string &path) {
+  std::vector<unsigned> ret;
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line))
+    return ret;
+
+  std::vector<folly::StringPiece> ranges;
+  folly::split(',', folly::trimWhitespace(line), ranges, true);
+  for (folly::StringPiece range : ranges) {
+    folly::StringPiece first, last;
+    if (!folly::split('-', range, first, last))
+      first = last = range;
+    auto lo = folly::tryTo<unsigned>(first);
+    auto hi = folly::tryTo<unsigned>(last);
+    if (!lo || !hi)
+      continue;
+    for (unsigned i = *lo; i <= *hi; ++i)
+      ret.push_back(i);
+  }
+  return ret;
+}
+
+const NumaTopology& topology() {
+  static const NumaTopology topo = [] {
+    NumaTopology t;
+    if (FLAGS_numa == "replicate")
+      t.mode = NumaTopology::REPLICATE;
+    else if (FLAGS_numa == "interleave")
+      t.mode = NumaTopology::INTERLEAVE;
+    else if (FLAGS_numa != "off")
+      LOG(FATAL) << "Unknown --numa mode: " << FLAGS_numa;
+    if (t.mode == NumaTopology::OFF)
+      return t;
+
+    for (unsigned id : parseList("/sys/devices/system/node/online")) {
+      std::string path = folly::to<std::string>(
+          "/sys/devices/system/node/node", id, "/cpulist");
+      std::vector<unsigned> cpus = parseList(path);
+      if (cpus.empty())
+        continue; // memory-only node
+      if (t.nodes.size() == kMaxNumaNodes || id >= 8 * sizeof(t.allNodes)) {
+        LOG(WARNING) << "Too many NUMA nodes, node " << id << " ignored";
+        continue;
+      }
+      t.nodes.push_back({id, std::move(cpus)});
+      t.allNodes |= 1ul << id;
+    }
+
+    if (t.nodes.size() < 2) {
+      LOG(WARNING) << "Single NUMA node detected, --numa ignored";
+      t.mode = NumaTopology::OFF;
+      t.nodes.clear();
+    } else {
+      LOG(INFO) << "NUMA " << FLAGS_numa << " across "
+                << t.nodes.size() << " nodes";
+    }
+    return t;
+  }();
+  return topo;
+}
+
+thread_local unsigned localReplica = 0;
+
+void bindToNode(const NumaNode &node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : node.cpus)
+    CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0)
+    LOG(WARNING) << "Failed to pin thread to node " << node.id
+                 << ": " << folly::errnoStr(err);
+}
+
+void setMemPolicy(int mode, unsigned long mask) {
+  if (syscall(SYS_set_mempolicy, mode, &mask, 8 * sizeof(mask) + 1) != 0)
+    PLOG(WARNING) << "set_mempolicy";
+}
+
+class NumaHandlerFactory : public RequestHandlerFactory {
+ public:
+  void onServerStart(folly::EventBase*) noexcept override {
+    numaPinWorker();
+  }
+
+  void onServerStop() noexcept override {
+  }
+
+  RequestHandler* onRequest(RequestHandler *h, proxygen::HTTPMessage*) noexcept override {
+    return h;
+  }
+};
+
+} // namespace
+
+unsigned numaReplicas() noexcept {
+  const NumaTopology &t = topology();
+  return t.mode == NumaTopology::REPLICATE ? t.nodes.size() : 1;
+}
+
+unsigned numaReplica() noexcept {
+  return localReplica;
+}
+
+void numaPinWorker() {
+  static std::atomic<unsigned> nextNode{0};
+  const NumaTopology &t = topology();
+  if (t.mode == NumaTopology::OFF)
+    return;
+
+  unsigned idx = nextNode++ % t.nodes.size();
+  bindToNode(t.nodes[idx]);
+  if (t.mode == NumaTopology::REPLICATE)
+    localReplica = idx;
+}
+
+void numaRunOn(unsigned node, folly::Function<void()> fn) {
+  const NumaTopology &t = topology();
+  std::thread([&] {
+    if (node < t.nodes.size()) {
+      bindToNode(t.nodes[node]);
+      setMemPolicy(MPOL_BIND, 1ul << t.nodes[node].id);
+    }
+    fn();
+  }).join();
+}
+
+void numaInterleave() {
+  const NumaTopology &t = topology();
+  if (t.mode == NumaTopology::INTERLEAVE)
+    setMemPolicy(MPOL_INTERLEAVE, t.allNodes);
+}
+
+std::unique_ptr<RequestHandlerFactory> makeNumaHandlerFactory() {
+  return std::make_unique<NumaHandlerFactory>();
+}
@@ -0,0 +1,29 @@
+#ifndef CALLFWD_NUMA_H
+#define CALLFWD_NUMA_H
+
+#include <folly/Function.h>
+
+/** Upper bound on the number of per-node dataset replicas. */
+constexpr unsigned kMaxNumaNodes = 8;
+
+/** Number of replicas kept for hot datasets: number of NUMA nodes with
+  * `--numa=replicate`, 1 otherwise. */
+unsigned numaReplicas() noexcept;
+
+/** Index of the replica local to the calling thread.
+  * Threads not pinned by numaPinWorker() use replica 0. */
+unsigned numaReplica() noexcept;
+
+/** Pin calling thread to the CPUs of a node, nodes are assigned
+  * round-robin. No-op with `--numa=off`. */
+void numaPinWorker();
+
+/** Run `fn` on a temporary thread bound to CPUs and memory of `node`
+  * and wait for it. Memory touched by `fn` ends up local to the node. */
+void numaRunOn(unsigned node, folly::Function<void()> fn);
+
+/** Interleave pages allocated by the calling thread across all nodes.
+  * No-op unless `--numa=interleave`. */
+void numaInterleave();
+
+#endif // CALLFWD_NUMA_H
@@ -0,0 +1,94 @@
+#include "PhoneBitmap.h"
+#include "MemoryUsage.h"
+
+#include <stdexcept>
+
+bool parseListedNumber(folly::StringPiece text, uint64_t &pn) noexcept {
+  uint64_t number = 0;
+  unsigned digits = 0;
+  for (char c : text) {
+    if (c == ',')
+      continue;
+    if (c < '0' || c > '9')
+      break;
+    // Longer numbers are rejected below, stop before overflow
+    if (++digits > 11)
+      return false;
+    number = number * 10 + (c - '0');
+  }
+
+  if (digits == 11 && number / 10000000000ull == 1)
+    number -= 10000000000ull;
+  else if (digits != 10)
+    return false;
+  pn = number;
+  return true;
+}
+
+bool PhoneBitmap::insert(uint64_t key, Value) {
+  if (key >= kBlocks * kBlockSize)
+    throw std::runtime_error("PhoneBitmap: not a 10-digit number");
+
+  // Directory is allocated with the first member
+  if (dir_.empty()) {
+    dir_.assign(kBlocks + 1, 0);
+    words_.assign(kBlockWords, 0);
+  }
+
+  uint64_t block = key / kBlockSize;
+  uint64_t line = key % kBlockSize;
+  if (dir_[block] == 0) {
+    dir_[block] = words_.size() / kBlockWords;
+    words_.resize(words_.size() + kBlockWords, 0);
+  }
+
+  uint64_t &word = words_[dir_[block] * kBlockWords + line / 64];
+  uint64_t mask = 1ull << (line % 64);
+  if (word & mask)
+    return false;
+  word |= mask;
+  ++size_;
+  return true;
+}
+
+void PhoneBitmap::finalize() {
+  words_.shrink_to_fit();
+  if (dir_.empty())
+    return;
+
+  ranks_.resize(kBlocks + 1);
+  uint64_t total = 0;
+  for (uint64_t block = 0; block <= kBlocks; ++block) {
+    ranks_[block] = total;
+    if (dir_[block] == 0)
+      continue;
+    const uint64_t *word = words_.data() + dir_[block] * kBlockWords;
+    for (uint64_t i = 0; i < kBlockWords; ++i)
+      total += __builtin_popcountll(word[i]);
+  }
+}
+
+size_t PhoneBitmap::rank(uint64_t key) const noexcept {
+  uint64_t block = key / kBlockSize;
+  if (block >= kBlocks)
+    return size_;
+
+  uint64_t line = key % kBlockSize;
+  const uint64_t *word = words_.data() + dir_[block] * kBlockWords;
+  size_t ret = ranks_[block];
+  for (uint64_t i = 0; i < line / 64; ++i)
+    ret += __builtin_popcountll(word[i]);
+  if (line % 64)
+    ret += __builtin_popcountll(word[line / 64] << (64 - line % 64));
+  return ret;
+}
+
+size_t PhoneBitmap::count(uint64_t from, uint64_t to) const noexcept {
+  if (empty() || from >= to)
+    return 0;
+  return rank(to) - rank(from);
+}
+
+size_t PhoneBitmap::memory() const noexcept {
+  return memoryOf(dir_) + memoryOf(ranks_) + memoryOf(words_);
+}
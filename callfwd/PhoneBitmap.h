@@ -0,0 +1,83 @@
+#ifndef CALLFWD_PHONEBITMAP_H
+#define CALLFWD_PHONEBITMAP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <folly/Range.h>
+
+#include "HugePages.h"
+
+/** Read the number of a flag list row: digits up to the first character
+  * other than a digit or comma. An 11-digit number with the leading 1 of
+  * the NANP country code is shortened to 10 digits, returns false for any
+  * other length. */
+bool parseListedNumber(folly::StringPiece text, uint64_t &pn) noexcept;
+
+/** Set of 10-digit phone numbers stored as one bitmap per NPA-NXX block.
+  * Absent blocks share an all-zero bitmap, so membership is a directory
+  * load plus a bit test without branches. A per-block rank index answers
+  * range counts in constant time.
+  *
+  * Implements the key level table interface of Mapping, the value of
+  * a member is 1 and of any other number 0. */
+class PhoneBitmap {
+ public:
+  using Value = uint64_t;
+  static constexpr const char *kKind = "bitmap";
+
+  struct Token {
+    const uint64_t *word;
+    unsigned bit;
+  };
+
+  bool empty() const noexcept { return size_ == 0; }
+  size_t size() const noexcept { return size_; }
+  void reserve(size_t) noexcept {}
+
+  /** Add a number, returns false if already present. Loaders only pass
+    * 10-digit numbers, others throw `runtime_error`. */
+  bool insert(uint64_t key, Value value);
+
+  /** Build rank index, must be called after the last insert(). */
+  void finalize();
+
+  /** Locate the bit of `key` and prefetch it into CPU cache. */
+  Token prefetch(uint64_t key) const noexcept {
+    uint64_t block = key / kBlockSize;
+    uint64_t line = key % kBlockSize;
+    block = block < kBlocks ? block : kBlocks;
+    const uint64_t *word = words_.data() + dir_[block] * kBlockWords + line / 64;
+    __builtin_prefetch(word);
+    return { word, unsigned(line % 64) };
+  }
+
+  /** Store membership of a located key into `out`, returns it too. */
+  bool find(Token token, uint64_t, Value &out) const noexcept {
+    out = (*token.word >> token.bit) & 1;
+    return out;
+  }
+
+  /** Number of members in [from, to). */
+  size_t count(uint64_t from, uint64_t to) const noexcept;
+
+  /** Heap bytes owned by the bitmap. */
+  size_t memory() const noexcept;
+
+ private:
+  static constexpr uint64_t kBlockSize = 10000;
+  static constexpr uint64_t kBlocks = 1000000;
+  static constexpr uint64_t kBlockWords = (kBlockSize + 63) / 64;
+
+  /** Number of members below `key`. */
+  size_t rank(uint64_t key) const noexcept;
+
+  // block index of every NPA-NXX, plus a sentinel for keys out of range
+  HugeVector<uint32_t> dir_;
+  // members in all NPA-NXX blocks before the one
+  HugeVector<uint64_t> ranks_;
+  // bitmaps, block 0 is empty
+  HugeVector<uint64_t> words_;
+  size_t size_ = 0;
+};
+
+#endif // CALLFWD_PHONEBITMAP_H
@@ -1,8 +1,12 @@
 #include "PhoneMapping.h"
+#include "HugePages.h"
+#include "MemoryUsage.h"
 
 #include <algorithm>
 #include <array>
+#include <numeric>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 #if HAVE_STD_PARALLEL
 #include <execution>
@@ -14,12 +18,13 @@
 #include <folly/String.h>
 #include <folly/Conv.h>
 #include <folly/small_vector.h>
+#include <folly/stop_watch.h>
 #include <folly/container/F14Map.h>
 #include <folly/synchronization/Hazptr.h>
 #include <folly/portability/GFlags.h>
 
 
-// TODO: benchmark prefetch size
+// MappingBenchmark sweeps the prefetch size, see test/MappingBenchmark.cpp
 DEFINE_uint32(f14map_prefetch, 16, "Maximum number of keys to prefetch");
 
 struct PhoneList {
@@ -32,40 +37,49 @@ class PhoneMapping::Data : public folly::hazptr_obj_base<PhoneMapping::Data> {
  public:
   void getRNs(size_t N, const uint64_t *pn, uint64_t *rn) const;
   std::unique_ptr<Cursor> inverseRNs(uint64_t fromRN, uint64_t toRN) const;
+  std::unique_ptr<Cursor> inversePNs(uint64_t fromPN, uint64_t toPN) const;
+  HugeVector<PhoneList>::const_iterator lowerPN(uint64_t pn) const;
   std::unique_ptr<Cursor> visitRows() const;
   void build();
+  void memoryUsage(MemoryUsage &usage) const;
   ~Data() noexcept;
 
   // metadata
   folly::dynamic meta;
   // pn->rn mapping
-  folly::F14ValueMap<uint64_t, uint64_t> dict;
-  // pn column joined with sorted rn column
-  std::vector<PhoneList> pnColumn;
-  // unique-sorted rn column joined with pn
-  std::vector<PhoneList> rnIndex;
+  HugeF14ValueMap<uint64_t, uint64_t> dict;
+  // pn column sorted by rn, rows of the same rn keep insertion order,
+  // `next` is the position of rn in rnIndex
+  HugeVector<PhoneList> pnColumn;
+  // pn column sorted by pn, `next` is the position of rn in rnIndex
+  HugeVector<PhoneList> pnIndex;
+  // unique-sorted rn column, `next` is the first row of rn in pnColumn
+  HugeVector<PhoneList> rnIndex;
+  // bytes accounted by retireDataset()
+  size_t retiredBytes = 0;
 };
 
 PhoneMapping::Data::~Data() noexcept {
   LOG_IF(INFO, pnColumn.size() > 0) << "Reclaiming memory";
+  memoryReclaimed(retiredBytes);
 }
 
+/** Sequential scan over a range of pnColumn or pnIndex. */
 class PhoneMapping::Cursor {
  public:
-  virtual ~Cursor() = default;
-
-  bool hasRow() const noexcept { return size_ != 0; }
-  uint64_t currentPN() const noexcept { return pn_[pos_]; }
-  uint64_t currentRN() const noexcept { return rn_[pos_]; }
-  void prefetch(const Data *data) noexcept;
-  void advance(const Data *data) noexcept;
-  virtual void refill() = 0;
-
- protected:
-  std::array<uint64_t, 8> pn_;
-  std::array<uint64_t, 8> rn_;
-  unsigned size_;
-  unsigned pos_;
+  Cursor(const PhoneList *row, const PhoneList *end, const PhoneList *rns)
+    : row_(row), end_(end), rns_(rns)
+  {}
+
+  bool hasRow() const noexcept { return row_ != end_; }
+  uint64_t currentPN() const noexcept { return row_->phone; }
+  uint64_t currentRN() const noexcept { return rns_[row_->next].phone; }
+  void advance() noexcept { ++row_; }
+
+ private:
+  const PhoneList *row_;
+  const PhoneList *end_;
+  const PhoneList *rns_;
 };
 
 void PhoneMapping::Data::getRNs(size_t N, const uint64_t *pn, uint64_t *rn) const {
@@ -104,47 +118,19 @@ uint64_t PhoneMapping::getRN(uint64_t pn) const {
   return rn;
 }
 
-class InverseRNVisitor final : public PhoneMapping::Cursor {
- public:
-  InverseRNVisitor(const PhoneMapping::Data *data, uint64_t it, uint64_t end)
-    : base_(data->pnColumn.data())
-    , it_(it), end_(end)
-  {
-    prefetch(data);
-  }
-  void refill() override;
- private:
-  const PhoneList *base_;
-  uint64_t it_, end_;
-};
-
-class RowVisitor final : public PhoneMapping::Cursor {
- public:
-  using Iterator = std::vector<PhoneList>::const_iterator;
-  RowVisitor(const PhoneMapping::Data *data, Iterator it, Iterator end)
-    : it_(it), end_(end)
-  {
-    prefetch(data);
-  }
-  void refill() override;
- private:
-  Iterator it_, end_;
-};
-
 std::unique_ptr<PhoneMapping::Cursor>
 PhoneMapping::Data::inverseRNs(uint64_t fromRN, uint64_t toRN) const {
-  std::vector<uint64_t> ret;
-
   static auto cmp = [](const PhoneList &lhs, const PhoneList &rhs) {
     return lhs.phone < rhs.phone;
   };
   auto rnLeft = std::lower_bound(rnIndex.begin(), rnIndex.end(), PhoneList{fromRN, 0}, cmp);
   auto rnRight = std::lower_bound(rnLeft, rnIndex.end(), PhoneList{toRN, 0}, cmp);
-  uint64_t pnBegin = rnLeft == rnIndex.end() ? MAXROWS : rnLeft->next;
-  uint64_t pnEnd = rnRight == rnIndex.end() ? MAXROWS : rnRight->next;
+  uint64_t pnBegin = rnLeft == rnIndex.end() ? pnColumn.size() : rnLeft->next;
+  uint64_t pnEnd = rnRight == rnIndex.end() ? pnColumn.size() : rnRight->next;
 
-  if (pnBegin != pnEnd)
-    return std::make_unique<InverseRNVisitor>(this, pnBegin, pnEnd);
+  if (pnBegin < pnEnd)
+    return std::make_unique<Cursor>(pnColumn.data() + pnBegin,
+                                    pnColumn.data() + pnEnd, rnIndex.data());
   else
     return nullptr;
 }
@@ -159,46 +145,77 @@ PhoneMapping&& PhoneMapping::inverseRNs(uint64_t fromRN, uint64_t toRN) && {
   return std::move(*this);
 }
 
+HugeVector<PhoneList>::const_iterator
+PhoneMapping::Data::lowerPN(uint64_t pn) const {
+  return std::lower_bound(pnIndex.begin(), pnIndex.end(), pn,
+                          [](const PhoneList &lhs, uint64_t rhs) {
+                            return lhs.phone < rhs;
+                          });
+}
+
 std::unique_ptr<PhoneMapping::Cursor>
-PhoneMapping::Data::visitRows() const {
-  if (pnColumn.size() > 0)
-    return std::make_unique<RowVisitor>(this, pnColumn.begin(), pnColumn.end());
+PhoneMapping::Data::inversePNs(uint64_t fromPN, uint64_t toPN) const {
+  auto left = lowerPN(fromPN);
+  auto right = lowerPN(std::max(fromPN, toPN));
+  if (left != right)
+    return std::make_unique<Cursor>(pnIndex.data() + (left - pnIndex.begin()),
+                                    pnIndex.data() + (right - pnIndex.begin()),
+                                    rnIndex.data());
   else
     return nullptr;
 }
 
-PhoneMapping& PhoneMapping::visitRows() & {
-  cursor_ = data_->visitRows();
+PhoneMapping& PhoneMapping::inversePNs(uint64_t fromPN, uint64_t toPN) & {
+  cursor_ = data_->inversePNs(fromPN, toPN);
   return *this;
 }
 
-PhoneMapping&& PhoneMapping::visitRows() && {
-  cursor_ = data_->visitRows();
+PhoneMapping&& PhoneMapping::inversePNs(uint64_t fromPN, uint64_t toPN) && {
+  cursor_ = data_->inversePNs(fromPN, toPN);
   return std::move(*this);
 }
 
-void InverseRNVisitor::refill() {
-  for (; it_ != end_ && size_ < pn_.size(); it_ = base_[it_].next) {
-    pn_[size_++] = base_[it_].phone;
-  }
+size_t PhoneMapping::countPNs(uint64_t fromPN, uint64_t toPN) const {
+  if (fromPN >= toPN)
+    return 0;
+  return data_->lowerPN(toPN) - data_->lowerPN(fromPN);
 }
 
-void RowVisitor::refill() {
-  for (; it_ != end_ && size_ < pn_.size(); ++it_) {
-    pn_[size_++] = it_->phone;
+void PhoneMapping::countPNs(uint64_t fromPN, uint64_t toPN, uint64_t groupSize,
+                            folly::FunctionRef<void(uint64_t, size_t)> fn) const {
+  auto it = data_->lowerPN(fromPN);
+  auto end = data_->lowerPN(std::max(fromPN, toPN));
+  while (it != end) {
+    // Jump over the group of the current row, empty groups are skipped
+    uint64_t group = it->phone / groupSize;
+    uint64_t groupEnd = std::min(toPN, (group + 1) * groupSize);
+    auto next = std::lower_bound(it, end, groupEnd,
+                                 [](const PhoneList &lhs, uint64_t rhs) {
+                                   return lhs.phone < rhs;
+                                 });
+    fn(group, next - it);
+    it = next;
   }
 }
 
-void PhoneMapping::Cursor::prefetch(const Data *data) noexcept {
-  pos_ = size_ = 0;
-  refill();
-  data->getRNs(size_, pn_.begin(), rn_.begin());
+std::unique_ptr<PhoneMapping::Cursor>
+PhoneMapping::Data::visitRows() const {
+  if (pnColumn.size() > 0)
+    return std::make_unique<Cursor>(pnColumn.data(),
+                                    pnColumn.data() + pnColumn.size(),
+                                    rnIndex.data());
+  else
+    return nullptr;
 }
 
-void PhoneMapping::Cursor::advance(const Data *data) noexcept {
-  ++pos_;
-  if (UNLIKELY(pos_ == size_))
-    prefetch(data);
+PhoneMapping& PhoneMapping::visitRows() & {
+  cursor_ = data_->visitRows();
+  return *this;
+}
+
+PhoneMapping&& PhoneMapping::visitRows() && {
+  cursor_ = data_->visitRows();
+  return std::move(*this);
 }
 
 PhoneMapping::Builder::Builder()
@@ -246,35 +263,120 @@ void PhoneMapping::Builder::fromCSV(std::istream &in, size_t &line, size_t limit
   }
 }
 
-void PhoneMapping::Data::build() {
-  size_t N = pnColumn.size();
-
-  // Connect rnIndex_ with pnColumn_ before shuffling
-  for (size_t i = 0; i < N; ++i)
-    rnIndex[i].next = i;
-
-  static auto cmp = [](const PhoneList &lhs, const PhoneList &rhs) {
-    if (lhs.phone == rhs.phone)
-      return lhs.next < rhs.next;
-    return lhs.phone < rhs.phone;
-  };
-
+/** Run `fn(block, begin, end)` over [0, N) split into contiguous blocks. */
+template <class F>
+static void parallelBlocks(size_t N, size_t nblocks, F fn) {
+  std::vector<size_t> blocks(nblocks);
+  std::iota(blocks.begin(), blocks.end(), 0);
+  auto run = [&](size_t b) { fn(b, N * b / nblocks, N * (b + 1) / nblocks); };
 #if HAVE_STD_PARALLEL
-  std::stable_sort(std::execution::par_unseq, rnIndex.begin(), rnIndex.end(), cmp);
+  std::for_each(std::execution::par, blocks.begin(), blocks.end(), run);
 #else
-  std::stable_sort(rnIndex.begin(), rnIndex.end(), cmp);
+  std::for_each(blocks.begin(), blocks.end(), run);
 #endif
+}
 
-  // Wire pnColumn_ list by target
-  for (size_t i = 0; i + 1 < N; ++i)
-    pnColumn[rnIndex[i].next].next = rnIndex[i+1].next;
+/** Stable LSD radix sort by the 34-bit phone field, 12 bits per pass.
+  * Each block scatters its items in order, so equal keys keep their
+  * relative position. */
+static void radixSortByPhone(HugeVector<PhoneList> &rows, size_t nblocks) {
+  constexpr unsigned kBits = 12;
+  constexpr size_t kBuckets = 1 << kBits;
+  const size_t N = rows.size();
+
+  HugeVector<PhoneList> scratch(N);
+  std::vector<std::array<size_t, kBuckets>> offset(nblocks);
+
+  for (unsigned shift = 0; shift < 34; shift += kBits) {
+    auto digit = [shift](const PhoneList &row) {
+      return (row.phone >> shift) & (kBuckets - 1);
+    };
+
+    parallelBlocks(N, nblocks, [&](size_t b, size_t begin, size_t end) {
+      offset[b].fill(0);
+      for (size_t i = begin; i < end; ++i)
+        ++offset[b][digit(rows[i])];
+    });
+
+    // Exclusive prefix sum in (digit, block) order
+    size_t sum = 0;
+    bool trivial = false;
+    for (size_t d = 0; d < kBuckets; ++d) {
+      size_t first = sum;
+      for (size_t b = 0; b < nblocks; ++b) {
+        size_t count = offset[b][d];
+        offset[b][d] = sum;
+        sum += count;
+      }
+      trivial |= (sum - first == N);
+    }
+    if (trivial)
+      continue; // all keys share this digit
+
+    parallelBlocks(N, nblocks, [&](size_t b, size_t begin, size_t end) {
+      auto &pos = offset[b];
+      for (size_t i = begin; i < end; ++i)
+        scratch[pos[digit(rows[i])]++] = rows[i];
+    });
+    rows.swap(scratch);
+  }
+}
 
-  static auto equal = [](const PhoneList &lhs, const PhoneList &rhs) {
-    return lhs.phone == rhs.phone;
-  };
-  auto last = std::unique(rnIndex.begin(), rnIndex.end(), equal);
-  rnIndex.erase(last, rnIndex.end());
-  rnIndex.shrink_to_fit();
+void PhoneMapping::Data::build() {
+  size_t N = pnColumn.size();
+  size_t nblocks = std::max<size_t>(1, std::min<size_t>(
+      std::thread::hardware_concurrency(), N / 65536));
+  folly::stop_watch<std::chrono::milliseconds> watch;
+
+  // Remember source row of every RN before shuffling
+  parallelBlocks(N, nblocks, [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      rnIndex[i].next = i;
+  });
+
+  // Rows come in insertion order, so stable sort by RN keeps PNs of
+  // the same RN ordered by row id
+  radixSortByPhone(rnIndex, nblocks);
+  auto sortTime = watch.lap();
+
+  // Count unique RNs in each block
+  std::vector<size_t> uniqueOffset(nblocks + 1, 0);
+  parallelBlocks(N, nblocks, [&](size_t b, size_t begin, size_t end) {
+    size_t heads = 0;
+    for (size_t i = begin; i < end; ++i) {
+      if (i == 0 || rnIndex[i].phone != rnIndex[i-1].phone)
+        ++heads;
+    }
+    uniqueOffset[b + 1] = heads;
+  });
+  std::partial_sum(uniqueOffset.begin(), uniqueOffset.end(), uniqueOffset.begin());
+
+  // Gather PNs into RN order, so rows of an RN are contiguous, and keep
+  // the first row of every RN. Rows are linked to their RN by position
+  HugeVector<PhoneList> sorted(N);
+  HugeVector<PhoneList> unique(uniqueOffset[nblocks]);
+  parallelBlocks(N, nblocks, [&](size_t b, size_t begin, size_t end) {
+    size_t out = uniqueOffset[b];
+    for (size_t i = begin; i < end; ++i) {
+      if (i == 0 || rnIndex[i].phone != rnIndex[i-1].phone)
+        unique[out++] = PhoneList{rnIndex[i].phone, i};
+      sorted[i] = PhoneList{pnColumn[rnIndex[i].next].phone, out - 1};
+    }
+  });
+  pnColumn.swap(sorted);
+  rnIndex.swap(unique);
+  sorted = HugeVector<PhoneList>();
+  unique = HugeVector<PhoneList>();
+  auto gatherTime = watch.lap();
+
+  // Ordered PN index for range queries
+  pnIndex = pnColumn;
+  radixSortByPhone(pnIndex, nblocks);
+  auto pnIndexTime = watch.lap();
+
+  LOG_IF(INFO, N > 0) << "Index built in " << nblocks << " threads: sort "
+                      << sortTime.count() << "ms, gather " << gatherTime.count()
+                      << "ms, pn index " << pnIndexTime.count() << "ms";
 }
 
 PhoneMapping PhoneMapping::Builder::build() {
@@ -292,10 +394,20 @@ void PhoneMapping::Builder::commit(std::atomic<Data*> &global) {
   size_t pn_count = data->pnColumn.size();
   size_t rn_count = data->rnIndex.size();
   if (Data *veteran = global.exchange(data.release()))
-    veteran->retire();
+    retireDataset(veteran);
   LOG(INFO) << "Database updated: PNs=" << pn_count << " RNs=" << rn_count;
 }
 
+void PhoneMapping::replicate(std::atomic<Data*> &source, std::atomic<Data*> &replica) {
+  PhoneMapping master(source);
+  if (!master.data_)
+    return;
+
+  auto data = std::make_unique<Data>(*master.data_);
+  if (Data *veteran = replica.exchange(data.release()))
+    retireDataset(veteran);
+}
+
 PhoneMapping::PhoneMapping(std::unique_ptr<Data> data) {
   CHECK(FLAGS_f14map_prefetch > 0);
   holder_.reset(data.get());
@@ -321,6 +433,19 @@ void PhoneMapping::printMetadata() {
                   << ": " << folly::toJson(kv.second);
 }
 
+void PhoneMapping::Data::memoryUsage(MemoryUsage &usage) const {
+  usage.add("metadata", sizeof(*this) + memoryOf(meta));
+  usage.add("hash_table", memoryOf(dict));
+  usage.add("pn_column", memoryOf(pnColumn));
+  usage.add("pn_index", memoryOf(pnIndex));
+  usage.add("rn_index", memoryOf(rnIndex));
+}
+
+void PhoneMapping::memoryUsage(MemoryUsage &usage) const {
+  if (data_)
+    data_->memoryUsage(usage);
+}
+
 size_t PhoneMapping::size() const noexcept {
   return data_->pnColumn.size();
 }
@@ -338,7 +463,7 @@ uint64_t PhoneMapping::currentRN() const noexcept {
 }
 
 PhoneMapping& PhoneMapping::advance() noexcept {
-  cursor_->advance(data_);
+  cursor_->advance();
   if (!cursor_->hasRow())
     cursor_.reset();
   return *this;
@@ -8,10 +8,12 @@
 #include <atomic>
 #include <istream>
 
+#include <folly/Function.h>
 #include <folly/Range.h>
 #include <folly/synchronization/HazptrHolder.h>
 
 namespace folly { struct dynamic; }
+class MemoryUsage;
 
 class PhoneNumber {
 public:
@@ -62,16 +64,26 @@ class PhoneMapping {
   static PhoneMapping getUS() noexcept;
   /** Get default CA instance from global variable. */
   static PhoneMapping getCA() noexcept;
+  /** Replace `replica` with a copy of `source`. Memory is allocated
+    * by the calling thread, so it follows its NUMA placement. */
+  static void replicate(std::atomic<Data*> &source, std::atomic<Data*> &replica);
   /** Check if DB fully loaded into memory. */
   static bool isAvailable() noexcept;
   ~PhoneMapping() noexcept;
 
+  /** Check if instance holds a dataset, it doesn't if taken before
+    * the first load. */
+  bool isLoaded() const noexcept { return data_ != nullptr; }
+
   /** Get total number of records */
   size_t size() const noexcept;
 
   /** Log metadata to system journal */
   void printMetadata();
 
+  /** Add memory used by the dataset, nothing if not loaded. */
+  void memoryUsage(MemoryUsage &usage) const;
+
   /** Get a routing number from portability number.
     * If key wasn't found returns NONE. */
   uint64_t getRN(uint64_t pn) const;
@@ -85,6 +97,20 @@ class PhoneMapping {
   PhoneMapping& inverseRNs(uint64_t fromRN, uint64_t toRN) &;
   PhoneMapping&& inverseRNs(uint64_t fromRN, uint64_t toRN) &&;
 
+  /** Select rows by portability number range, ordered by PN.
+    * Use cursor methods to retrieve relevent rows. */
+  PhoneMapping& inversePNs(uint64_t fromPN, uint64_t toPN) &;
+  PhoneMapping&& inversePNs(uint64_t fromPN, uint64_t toPN) &&;
+
+  /** Count rows with portability number in [fromPN, toPN). */
+  size_t countPNs(uint64_t fromPN, uint64_t toPN) const;
+
+  /** Count rows with portability number in [fromPN, toPN) grouped
+    * by `pn / groupSize`. Calls `fn(group, count)` for every non-empty
+    * group in ascending order. */
+  void countPNs(uint64_t fromPN, uint64_t toPN, uint64_t groupSize,
+                folly::FunctionRef<void(uint64_t, size_t)> fn) const;
+
   /** Select all rows. Use cursor methods to retrieve relevent rows.*/
   PhoneMapping& visitRows() &;
   PhoneMapping&& visitRows() &&;
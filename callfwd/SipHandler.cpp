@@ -1,4 +1,6 @@
+#include <chrono>
 #include <glog/logging.h>
+#include <folly/Conv.h>
 #include <folly/Format.h>
 #include <folly/Likely.h>
 #include <folly/portability/GFlags.h>
@@ -6,13 +8,19 @@
 #include <folly/io/IOBufQueue.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
 
-#include "PhoneMapping.h"
+#include <stir/CryptoPool.h>
+#include <stir/Passport.h>
+#include <stir/RequestId.h>
+
+#include "Datasets.h"
 #include "AccessLog.h"
-#include "ACL.h"
+#include "HotCache.h"
+#include "Metrics.h"
 
 extern "C" {
 #include <lib/osips_parser/msg_parser.h>
 #include <lib/osips_parser/parse_uri.h>
+#include <lib/osips_parser/parse_to.h>
 }
 
 using proxygen::RequestHandlerFactory;
@@ -26,6 +34,34 @@ using folly::EventBase;
 
 DEFINE_uint32(sip_max_length, 1500, "Maximum length of a SIP payload");
 DEFINE_bool(rfc4694, false, "Follow RFC4694 for non-ported numbers");
+DECLARE_uint32(hot_cache_size);
+DECLARE_string(stir_keys);
+
+static MetricHistogram inviteLatency("callfwd_request_duration_seconds",
+                                     "Time from request to complete response",
+                                     "endpoint=\"sip_invite\"", 1e6);
+static MetricStatusCounter sipStatus("callfwd_responses_total",
+                                     "Number of responses by status code",
+                                     "endpoint=\"sip\"");
+static MetricCounter sipCacheHits("callfwd_hot_cache_lookups_total",
+                                  "Number of phone numbers looked up in hot cache",
+                                  "endpoint=\"sip_invite\",result=\"hit\"");
+static MetricCounter sipCacheMisses("callfwd_hot_cache_lookups_total",
+                                    "Number of phone numbers looked up in hot cache",
+                                    "endpoint=\"sip_invite\",result=\"miss\"");
+
+static MetricCounter sipSigned("callfwd_stir_signatures_total",
+                               "Number of 302 replies signed with SHAKEN Identity",
+                               "result=\"ok\"");
+static MetricCounter sipSignFailed("callfwd_stir_signatures_total",
+                                   "Number of 302 replies signed with SHAKEN Identity",
+                                   "result=\"error\"");
+
+/** Routing numbers of the calling thread */
+static HotCache<uint64_t>& rnCache() {
+  static thread_local HotCache<uint64_t> cache(FLAGS_hot_cache_size);
+  return cache;
+}
 
 inline StringPiece SP(str s) { return StringPiece(s.s, s.len); }
 
@@ -72,27 +108,64 @@ class SIPHandler : public AsyncUDPSocket::ReadCallback {
                    SP(REQ_LINE(&msg_).uri),
                    proxygen::toTimeT(recvtime_));
 
-    if (UNLIKELY(!PhoneMapping::isAvailable())) {
-      reply(503, "Service Unavailable");
-      goto finish;
+    {
+      Datasets db = Datasets::get();
+      if (UNLIKELY(!db.isAvailable())) {
+        reply(503, "Service Unavailable");
+        goto finish;
+      }
+
+      switch (msg_.REQ_METHOD) {
+      case METHOD_OPTIONS:
+        reply(200, "OK");
+        break;
+      case METHOD_INVITE:
+        handleInvite(db);
+        break;
+      default:
+        reply(405, "Method Not Allowed");
+        break;
+      }
     }
 
-    switch (msg_.REQ_METHOD) {
-    case METHOD_OPTIONS:
-      reply(200, "OK");
-      break;
-    case METHOD_INVITE:
-      handleInvite();
-      break;
-    default:
-      reply(405, "Method Not Allowed");
-      break;
+  finish:
+    log_.onResponse(status_, 0);
+    sipStatus.inc(status_);
+    if (identity_.valid()) {
+      sendSigned();
+      return;
     }
 
-  finish:
     output("Content-Length: 0\r\n\r\n");
     socket_.writeChain(peer_, reply_.move(), {});
-    log_.onResponse(status_, 0);
+    if (msg_.REQ_METHOD == METHOD_INVITE)
+      inviteLatency.record(TimePoint::clock::now() - recvtime_);
+  }
+
+  /** Send the reply once its Identity is signed, later datagrams are
+    * handled meanwhile. The reply goes out unsigned if signing fails. */
+  void sendSigned()
+  {
+    auto done = [alive = std::weak_ptr<bool>(alive_), this, peer = peer_,
+                 reply = reply_.move(), recvtime = recvtime_]
+                (folly::Try<Identity> identity) mutable {
+      if (alive.expired())
+        return;
+      if (identity.hasValue() && identity->hasValue()) {
+        sipSigned.inc();
+        reply->prependChain(folly::IOBuf::copyBuffer(
+            folly::sformat("Identity: {};alg=ES256;ppt=shaken\r\n", identity->value())));
+      } else {
+        sipSignFailed.inc();
+        LOG_FIRST_N(WARNING, 20) << "Failed to sign INVITE from " << peer;
+      }
+      reply->prependChain(folly::IOBuf::copyBuffer("Content-Length: 0\r\n\r\n"));
+      socket_.writeChain(peer, std::move(reply), {});
+      inviteLatency.record(TimePoint::clock::now() - recvtime);
+    };
+    std::move(identity_)
+      .via(folly::getKeepAliveToken(socket_.getEventBase()))
+      .thenTry(std::move(done));
   }
 
   int parseMessage(size_t len, bool truncated) {
@@ -112,9 +185,9 @@ class SIPHandler : public AsyncUDPSocket::ReadCallback {
     return 0;
   }
 
-  void handleInvite()
+  void handleInvite(const Datasets &db)
   {
-    switch (ACL::get().isCallAllowed(peer_.getIPAddress())) {
+    switch (db.acl().isCallAllowed(peer_.getIPAddress())) {
     case 429:
       reply(429, "Too Many Requests");
       return;
@@ -128,11 +201,7 @@ class SIPHandler : public AsyncUDPSocket::ReadCallback {
     StringPiece port = SP(msg_.parsed_uri.port);
 
     uint64_t pn = PhoneNumber::fromString(user);
-    uint64_t rn = PhoneNumber::NONE;
-    if (pn != PhoneNumber::NONE)
-      rn = PhoneMapping::getUS().getRN(pn);
-    if (rn == PhoneNumber::NONE)
-      rn = PhoneMapping::getCA().getRN(pn);
+    uint64_t rn = routingNumber(db, pn);
 
     reply(302, "Moved Temporarily");
     if (rn != PhoneNumber::NONE) {
@@ -146,6 +215,86 @@ class SIPHandler : public AsyncUDPSocket::ReadCallback {
              user, user, host, port);
     }
     output("Location-Info: N\r\n");
+
+    if (!FLAGS_stir_keys.empty()) {
+      if (const ACL::Attestation *attest = db.acl().attestation(peer_.getIPAddress()))
+        signInvite(*attest, user, pn);
+    }
+  }
+
+  /** Start signing the SHAKEN PASSporT of the call on the crypto pool */
+  void signInvite(const ACL::Attestation &attest, StringPiece user, uint64_t pn)
+  {
+    SigningRequest req;
+    req.attest = attest.attest;
+    req.dest.push_back(telephoneNumber(user, pn));
+    req.orig = callingNumber();
+    req.origid = attest.origid;
+    if (req.origid.empty())
+      req.origid = makeRequestId();
+    using namespace std::chrono;
+    req.iat = duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+
+    if (StirApiType<SigningRequest>::validate(req)) {
+      sipSignFailed.inc();
+      LOG_FIRST_N(WARNING, 20) << "Not signing INVITE from " << peer_
+                               << ": bad calling or called number";
+      return;
+    }
+    identity_ = CryptoPool::get().run([req = std::move(req)] {
+      return makePassport(req);
+    });
+  }
+
+  /** SHAKEN form of a number: digits with country code, no '+' */
+  static folly::fbstring telephoneNumber(StringPiece user, uint64_t pn)
+  {
+    if (pn != PhoneNumber::NONE)
+      return folly::to<folly::fbstring>(1, pn);
+    user.removePrefix('+');
+    return user.str();
+  }
+
+  /** Number in the From URI, empty if it isn't a SIP URI */
+  folly::fbstring callingNumber()
+  {
+    if (!msg_.from)
+      return {};
+    struct to_body from;
+    memset(&from, 0, sizeof(from));
+    parse_to(msg_.from->body.s, msg_.from->body.s + msg_.from->body.len + 1, &from);
+    folly::fbstring tn;
+    if (from.error != PARSE_ERROR &&
+        parse_uri(from.uri.s, from.uri.len, &from.parsed_uri) == 0) {
+      StringPiece user = SP(from.parsed_uri.user);
+      tn = telephoneNumber(user, PhoneNumber::fromString(user));
+    }
+    free_to_params(&from);
+    return tn;
+  }
+
+  /** US routing number of `pn`, CA one if it isn't ported in US */
+  uint64_t routingNumber(const Datasets &db, uint64_t pn)
+  {
+    HotCache<uint64_t> &cache = rnCache();
+    uint64_t generation = db.generation();
+    bool cacheable = cache.enabled() && pn != PhoneNumber::NONE;
+    if (cacheable) {
+      if (const uint64_t *rn = cache.find(pn, generation)) {
+        sipCacheHits.inc();
+        return *rn;
+      }
+      sipCacheMisses.inc();
+    }
+
+    uint64_t rn = PhoneNumber::NONE;
+    if (pn != PhoneNumber::NONE)
+      rn = db.us().getRN(pn);
+    if (rn == PhoneNumber::NONE)
+      rn = db.ca().getRN(pn);
+    if (cacheable)
+      cache.insert(pn, generation, rn);
+    return rn;
   }
 
   void reply(uint64_t status, StringPiece message)
@@ -184,6 +333,11 @@ class SIPHandler : public AsyncUDPSocket::ReadCallback {
 
   uint64_t status_;
   struct sip_msg msg_;
+
+  using Identity = folly::Expected<std::string, StirApiError>;
+  folly::SemiFuture<Identity> identity_ = folly::SemiFuture<Identity>::makeEmpty();
+  // expires with the handler, signatures finishing later are dropped
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
 };
 
 class SipHandlerFactory : public RequestHandlerFactory {
@@ -0,0 +1,115 @@
+#include <callfwd/DatasetStream.h>
+#include <zlib.h>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+
+/** Compress `text` as one gzip member. */
+static std::string gzip(const std::string &text) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  EXPECT_EQ(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY), Z_OK);
+  std::string out(deflateBound(&zs, text.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+  zs.avail_in = text.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = out.size();
+  EXPECT_EQ(deflate(&zs, Z_FINISH), Z_STREAM_END);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+/** A 512-byte ustar header of a `type` entry with octal `size`. */
+static std::string tarHeader(const std::string &name, char type, uint64_t size) {
+  std::string header(512, '\0');
+  memcpy(&header[0], name.data(), name.size());
+  snprintf(&header[124], 12, "%011llo", (unsigned long long)size);
+  header[156] = type;
+  memcpy(&header[257], "ustar\0" "00", 8);
+  return header;
+}
+
+/** `data` padded to whole tar blocks. */
+static std::string tarData(const std::string &data) {
+  return data + std::string((512 - data.size() % 512) % 512, '\0');
+}
+
+class DatasetStreamTest : public testing::Test {
+ protected:
+  /** Unpack `content` the way reload commands read datasets. */
+  std::string read(const std::string &content, int *progress = nullptr) {
+    std::string path = (dir.path() / "dataset").string();
+    std::ofstream(path, std::ios::binary) << content;
+
+    DatasetStream in;
+    in.exceptions(std::ios_base::badbit);
+    in.open(path);
+    std::string text, line;
+    while (std::getline(in, line))
+      text += line + "\n";
+    if (progress)
+      *progress = in.progress();
+    in.close();
+    return text;
+  }
+
+  folly::test::TemporaryDirectory dir;
+  const std::string rows = "2012001234,2012000000\n2012001235,2012000000\n";
+};
+
+TEST_F(DatasetStreamTest, Plain) {
+  int progress = 0;
+  EXPECT_EQ(read(rows, &progress), rows);
+  EXPECT_EQ(progress, 100);
+  EXPECT_EQ(read(""), "");
+}
+
+TEST_F(DatasetStreamTest, GzipMembers) {
+  // Parallel compressors write concatenated members
+  std::string second = "3032001234,3032000000\n";
+  EXPECT_EQ(read(gzip(rows) + gzip(second)), rows + second);
+
+  std::string compressed = gzip(rows);
+  compressed.resize(compressed.size() / 2);
+  EXPECT_THROW(read(compressed), std::runtime_error);
+}
+
+TEST_F(DatasetStreamTest, Tar) {
+  // Only the first regular file is read, directories are skipped
+  std::string archive = tarHeader("data/", '5', 0) +
+    tarHeader("data/us.csv", '0', rows.size()) + tarData(rows) +
+    tarHeader("data/other.csv", '0', 4) + tarData("xxx\n") +
+    std::string(1024, '\0');
+  EXPECT_EQ(read(archive), rows);
+  EXPECT_EQ(read(gzip(archive)), rows);
+
+  EXPECT_THROW(read(tarHeader("data/", '5', 0) + std::string(1024, '\0')),
+               std::runtime_error);
+}
+
+TEST_F(DatasetStreamTest, TarSizeExtensions) {
+  // pax record overrides the size of the next member
+  std::string records = " size=" + std::to_string(rows.size()) + "\n";
+  records.insert(0, std::to_string(records.size() + 2));
+  std::string pax = tarHeader("PaxHeaders/us.csv", 'x', records.size()) +
+    tarData(records) + tarHeader("us.csv", '0', 0) + tarData(rows);
+  EXPECT_EQ(read(pax), rows);
+
+  // GNU base-256 size
+  std::string gnu = tarHeader("us.csv", '0', 0);
+  memset(&gnu[124], 0, 12);
+  gnu[124] = char(0x80);
+  gnu[135] = char(rows.size());
+  EXPECT_EQ(read(gnu + tarData(rows)), rows);
+}
+
+TEST_F(DatasetStreamTest, TruncatedTar) {
+  std::string archive = tarHeader("us.csv", '0', 4096) + rows;
+  EXPECT_THROW(read(archive), std::runtime_error);
+  EXPECT_THROW(read(gzip(archive)), std::runtime_error);
+}
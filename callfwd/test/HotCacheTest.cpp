@@ -0,0 +1,30 @@
+#include <callfwd/HotCache.h>
+#include <string>
+#include <folly/portability/GTest.h>
+
+TEST(HotCacheTest, Disabled) {
+  HotCache<std::string> cache(0);
+  ASSERT_FALSE(cache.enabled());
+  cache.insert(5550001, 1, "a");
+  ASSERT_EQ(cache.find(5550001, 1), nullptr);
+}
+
+TEST(HotCacheTest, Generation) {
+  HotCache<std::string> cache(16);
+  ASSERT_TRUE(cache.enabled());
+  ASSERT_EQ(cache.find(5550001, 1), nullptr);
+  cache.insert(5550001, 1, "a");
+  ASSERT_EQ(*cache.find(5550001, 1), "a");
+  ASSERT_EQ(cache.find(5550001, 2), nullptr);
+  cache.insert(5550001, 2, "b");
+  ASSERT_EQ(*cache.find(5550001, 2), "b");
+  ASSERT_EQ(cache.find(5550001, 1), nullptr);
+}
+
+TEST(HotCacheTest, Evict) {
+  HotCache<uint64_t> cache(1);
+  cache.insert(5550001, 1, 111);
+  cache.insert(5550002, 1, 222);
+  ASSERT_EQ(cache.find(5550001, 1), nullptr);
+  ASSERT_EQ(*cache.find(5550002, 1), 222);
+}
@@ -0,0 +1,453 @@
+#include <callfwd/PhoneMapping.h>
+#include <callfwd/DncMapping.h>
+#include <callfwd/DnoMapping.h>
+#include <callfwd/TollFreeMapping.h>
+#include <callfwd/LergMapping.h>
+#include <callfwd/YoumailMapping.h>
+#include <callfwd/GeoMapping.h>
+#include <callfwd/FtcMapping.h>
+#include <callfwd/F404Mapping.h>
+#include <callfwd/F606Mapping.h>
+
+#include <array>
+#include <random>
+#include <vector>
+#include <folly/Benchmark.h>
+#include <folly/Optional.h>
+#include <folly/init/Init.h>
+#include <folly/portability/GFlags.h>
+#include <folly/synchronization/Hazptr.h>
+
+DEFINE_uint64(bm_rows, 4000000, "Number of rows in LRN mapping fixture");
+DEFINE_uint64(bm_aux_rows, 1000000, "Number of rows in auxiliary mapping fixtures");
+DEFINE_uint64(bm_seed, 42, "Seed of synthetic data generator");
+
+DECLARE_uint32(f14map_prefetch);
+
+// Keys per getXXXs() call, matches a typical /target batch
+static constexpr size_t kBatch = 16;
+// Number of pregenerated query keys, must be a multiple of kBatch
+static constexpr size_t kQueries = 1 << 20;
+// Number of lines in NPA-NXX block
+static constexpr uint64_t kBlock = 10000;
+// Number of valid NPA-NXX blocks: NPA [2-9][0-8][0-9], NXX [2-9][0-9][0-9]
+static constexpr uint64_t kMaxBlocks = 720 * 800;
+
+/** i-th synthetic NANP number. Lines inside NPA-NXX block are
+  * scrambled so neighbour rows don't end up in neighbour buckets. */
+static uint64_t nanpNumber(uint64_t i) {
+  uint64_t block = (i / kBlock) % kMaxBlocks;
+  uint64_t line = (i % kBlock) * 7919 % kBlock;
+  uint64_t npa = block / 800;
+  uint64_t nxx = 200 + block % 800;
+  npa = (2 + npa / 90) * 100 + (npa / 10 % 9) * 10 + npa % 10;
+  return (npa * 1000 + nxx) * kBlock + line;
+}
+
+/** Routing number of i-th row. Roughly 64 ported numbers per LRN. */
+static uint64_t nanpRouting(uint64_t i, uint64_t rows) {
+  uint64_t lrns = std::max<uint64_t>(rows / 64, 1);
+  return nanpNumber((i * 2654435761u) % lrns * kBlock);
+}
+
+/** Random keys of existing (hit) or absent (miss) rows */
+static std::vector<uint64_t> makeQueries(uint64_t rows, bool hit) {
+  std::mt19937_64 rng(FLAGS_bm_seed);
+  std::uniform_int_distribution<uint64_t> dist(0, rows - 1);
+  std::vector<uint64_t> keys(kQueries);
+  for (uint64_t &key : keys)
+    key = nanpNumber(hit ? dist(rng) : rows + dist(rng));
+  return keys;
+}
+
+template <class F>
+static void lookupLoop(size_t n, const std::vector<uint64_t> &keys, F &&lookup) {
+  for (size_t i = 0; i < n; i += kBatch) {
+    size_t M = std::min(kBatch, n - i);
+    lookup(M, &keys[i % keys.size()]);
+  }
+}
+
+static PhoneMapping& lrnFixture() {
+  static folly::Optional<PhoneMapping> db;
+  if (!db) {
+    PhoneMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_rows; ++i)
+      builder.addRow(nanpNumber(i), nanpRouting(i, FLAGS_bm_rows));
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+static const std::vector<uint64_t>& lrnQueries(bool hit) {
+  static std::vector<uint64_t> hits = makeQueries(FLAGS_bm_rows, true);
+  static std::vector<uint64_t> misses = makeQueries(FLAGS_bm_rows, false);
+  return hit ? hits : misses;
+}
+
+static const std::vector<uint64_t>& auxQueries() {
+  static std::vector<uint64_t> hits = makeQueries(FLAGS_bm_aux_rows, true);
+  return hits;
+}
+
+static void getRNs(size_t n, uint32_t prefetch, bool hit) {
+  std::array<uint64_t, kBatch> rn;
+  BENCHMARK_SUSPEND {
+    lrnFixture();
+    lrnQueries(hit);
+    FLAGS_f14map_prefetch = prefetch;
+  }
+  const PhoneMapping &db = lrnFixture();
+  lookupLoop(n, lrnQueries(hit), [&](size_t M, const uint64_t *pn) {
+    db.getRNs(M, pn, rn.data());
+    folly::doNotOptimizeAway(rn);
+  });
+}
+
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_1, 1, true)
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_4, 4, true)
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_8, 8, true)
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_16, 16, true)
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_32, 32, true)
+BENCHMARK_NAMED_PARAM(getRNs, hit_prefetch_64, 64, true)
+BENCHMARK_NAMED_PARAM(getRNs, miss_prefetch_1, 1, false)
+BENCHMARK_NAMED_PARAM(getRNs, miss_prefetch_16, 16, false)
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(visitRows, n) {
+  BENCHMARK_SUSPEND { lrnFixture(); }
+  PhoneMapping &db = lrnFixture();
+  db.visitRows();
+  for (size_t i = 0; i < n; ++i) {
+    if (!db.hasRow())
+      db.visitRows();
+    folly::doNotOptimizeAway(db.currentRN());
+    db.advance();
+  }
+}
+
+BENCHMARK(inverseRNs, n) {
+  BENCHMARK_SUSPEND { lrnFixture(); }
+  PhoneMapping &db = lrnFixture();
+  // Walk the whole RN space prefix by prefix, like compliance exports do
+  uint64_t prefix = 200;
+  for (size_t i = 0; i < n; ++i) {
+    while (!db.hasRow()) {
+      db.inverseRNs(prefix * 10000000, (prefix + 1) * 10000000);
+      prefix = (prefix < 999) ? prefix + 1 : 200;
+    }
+    folly::doNotOptimizeAway(db.currentPN());
+    db.advance();
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(PhoneMapping_addRow, n) {
+  folly::Optional<PhoneMapping::Builder> builder;
+  BENCHMARK_SUSPEND {
+    builder.emplace();
+    builder->sizeHint(n);
+  }
+  for (size_t i = 0; i < n; ++i)
+    builder->addRow(nanpNumber(i), nanpRouting(i, n));
+  BENCHMARK_SUSPEND { builder.clear(); }
+}
+
+BENCHMARK(PhoneMapping_build, n) {
+  folly::Optional<PhoneMapping::Builder> builder;
+  folly::Optional<PhoneMapping> db;
+  BENCHMARK_SUSPEND {
+    builder.emplace();
+    builder->sizeHint(n);
+    for (size_t i = 0; i < n; ++i)
+      builder->addRow(nanpNumber(i), nanpRouting(i, n));
+  }
+  db.emplace(builder->build());
+  BENCHMARK_SUSPEND {
+    db.clear();
+    folly::hazptr_cleanup();
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+static DncMapping& dncFixture() {
+  static folly::Optional<DncMapping> db;
+  if (!db) {
+    DncMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i)
+      builder.addRow(nanpNumber(i), 1);
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+static void getDNCs(size_t n, uint32_t prefetch) {
+  std::array<uint64_t, kBatch> dnc;
+  BENCHMARK_SUSPEND {
+    dncFixture();
+    auxQueries();
+    FLAGS_f14map_prefetch = prefetch;
+  }
+  const DncMapping &db = dncFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, dnc.data());
+    folly::doNotOptimizeAway(dnc);
+  });
+}
+
+BENCHMARK_NAMED_PARAM(getDNCs, prefetch_1, 1)
+BENCHMARK_NAMED_PARAM(getDNCs, prefetch_4, 4)
+BENCHMARK_NAMED_PARAM(getDNCs, prefetch_16, 16)
+BENCHMARK_NAMED_PARAM(getDNCs, prefetch_64, 64)
+
+BENCHMARK(DncMapping_build, n) {
+  folly::Optional<DncMapping::Builder> builder;
+  folly::Optional<DncMapping> db;
+  BENCHMARK_SUSPEND {
+    builder.emplace();
+    builder->sizeHint(n);
+  }
+  for (size_t i = 0; i < n; ++i)
+    builder->addRow(nanpNumber(i), 1);
+  db.emplace(builder->build());
+  BENCHMARK_SUSPEND {
+    db.clear();
+    folly::hazptr_cleanup();
+  }
+}
+
+static DnoMapping& dnoFixture() {
+  static folly::Optional<DnoMapping> db;
+  if (!db) {
+    DnoMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; i += 2)
+      builder.addRow(nanpNumber(i), 1, DnoPolicy::PN);
+    // Coarse NPA-NXX and NPA-NXX-X entries for every 16th block
+    for (uint64_t j = 0; j <= FLAGS_bm_aux_rows / kBlock; j += 16) {
+      uint64_t base = nanpNumber(j * kBlock);
+      builder.addRow(base / 10000, 1, DnoPolicy::NPA_NXX);
+      builder.addRow(base / 1000 + 1, 1, DnoPolicy::NPA_NXX_X);
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getDNOs, n) {
+  std::array<uint64_t, kBatch> dno;
+  BENCHMARK_SUSPEND {
+    dnoFixture();
+    auxQueries();
+  }
+  const DnoMapping &db = dnoFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, dno.data());
+    folly::doNotOptimizeAway(dno);
+  });
+}
+
+static TollFreeMapping& tollFreeFixture() {
+  static folly::Optional<TollFreeMapping> db;
+  if (!db) {
+    TollFreeMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i)
+      builder.addRow(nanpNumber(i), 1);
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getTollFrees, n) {
+  std::array<uint64_t, kBatch> tollfree;
+  BENCHMARK_SUSPEND {
+    tollFreeFixture();
+    auxQueries();
+  }
+  const TollFreeMapping &db = tollFreeFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, tollfree.data());
+    folly::doNotOptimizeAway(tollfree);
+  });
+}
+
+static LergMapping& lergFixture() {
+  static folly::Optional<LergMapping> db;
+  if (!db) {
+    LergMapping::Builder builder;
+    // One NPA-NXX-X row per thousand block covered by aux queries
+    uint64_t rows = std::min(FLAGS_bm_aux_rows / 1000 + 1, kMaxBlocks * 10);
+    builder.sizeHint(rows);
+    for (uint64_t i = 0; i < rows; ++i) {
+      uint64_t key = nanpNumber(i * 1000 / kBlock * kBlock) / 1000 + i % 10;
+      builder.addRow(key, {key, "NJ", "Synthetic Telephone Co", "1234",
+                           "NEWARK", "ILEC", "224", "US"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getLergs, n) {
+  std::array<LergData, kBatch> lerg;
+  BENCHMARK_SUSPEND {
+    lergFixture();
+    auxQueries();
+  }
+  const LergMapping &db = lergFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, lerg.data());
+    folly::doNotOptimizeAway(lerg);
+  });
+}
+
+static YoumailMapping& youmailFixture() {
+  static folly::Optional<YoumailMapping> db;
+  if (!db) {
+    YoumailMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i) {
+      uint64_t pn = nanpNumber(i);
+      builder.addRow(pn, {pn, "87", "0.42", "false", "0.13"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getYoumails, n) {
+  std::array<YoumailData, kBatch> youmail;
+  BENCHMARK_SUSPEND {
+    youmailFixture();
+    auxQueries();
+  }
+  const YoumailMapping &db = youmailFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, youmail.data());
+    folly::doNotOptimizeAway(youmail);
+  });
+}
+
+static GeoMapping& geoFixture() {
+  static folly::Optional<GeoMapping> db;
+  if (!db) {
+    GeoMapping::Builder builder;
+    uint64_t rows = std::min(FLAGS_bm_aux_rows / kBlock + 1, kMaxBlocks);
+    builder.sizeHint(rows);
+    for (uint64_t i = 0; i < rows; ++i) {
+      uint64_t npanxx = nanpNumber(i * kBlock) / kBlock;
+      builder.addRow(npanxx, {npanxx, "07102", "Essex", "Newark",
+                              "40.7357", "-74.1724", "America/New_York"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getGeos, n) {
+  std::array<GeoData, kBatch> geo;
+  BENCHMARK_SUSPEND {
+    geoFixture();
+    auxQueries();
+  }
+  const GeoMapping &db = geoFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, geo.data());
+    folly::doNotOptimizeAway(geo);
+  });
+}
+
+static FtcMapping& ftcFixture() {
+  static folly::Optional<FtcMapping> db;
+  if (!db) {
+    FtcMapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i) {
+      uint64_t pn = nanpNumber(i);
+      builder.addRow(pn, {pn, "2021-07-03", "2021-02-09", "3"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getFtcs, n) {
+  std::array<FtcData, kBatch> ftc;
+  BENCHMARK_SUSPEND {
+    ftcFixture();
+    auxQueries();
+  }
+  const FtcMapping &db = ftcFixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, ftc.data());
+    folly::doNotOptimizeAway(ftc);
+  });
+}
+
+static F404Mapping& f404Fixture() {
+  static folly::Optional<F404Mapping> db;
+  if (!db) {
+    F404Mapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i) {
+      uint64_t pn = nanpNumber(i);
+      builder.addRow(pn, {pn, "2021-07-03 14:53:37", "2021-02-09 04:11:39"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getF404s, n) {
+  std::array<F404Data, kBatch> f404;
+  BENCHMARK_SUSPEND {
+    f404Fixture();
+    auxQueries();
+  }
+  const F404Mapping &db = f404Fixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, f404.data());
+    folly::doNotOptimizeAway(f404);
+  });
+}
+
+static F606Mapping& f606Fixture() {
+  static folly::Optional<F606Mapping> db;
+  if (!db) {
+    F606Mapping::Builder builder;
+    builder.sizeHint(FLAGS_bm_aux_rows);
+    for (uint64_t i = 0; i < FLAGS_bm_aux_rows; ++i) {
+      uint64_t pn = nanpNumber(i);
+      builder.addRow(pn, {pn, "2021-07-03 14:53:37", "2021-02-09 04:11:39"});
+    }
+    db.emplace(builder.build());
+  }
+  return *db;
+}
+
+BENCHMARK(getF606s, n) {
+  std::array<F606Data, kBatch> f606;
+  BENCHMARK_SUSPEND {
+    f606Fixture();
+    auxQueries();
+  }
+  const F606Mapping &db = f606Fixture();
+  lookupLoop(n, auxQueries(), [&](size_t M, const uint64_t *pn) {
+    db.lookups(M, pn, f606.data());
+    folly::doNotOptimizeAway(f606);
+  });
+}
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+  // Use --json or --bm_json_verbose=<file> for machine-readable output
+  folly::runBenchmarks();
+  folly::hazptr_cleanup();
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <callfwd/DncMapping.h>
+#include <callfwd/DnoMapping.h>
+#include <callfwd/LergMapping.h>
+#include <callfwd/TollFreeMapping.h>
+#include <sstream>
+#include <folly/portability/GTest.h>
+#include <folly/portability/GMock.h>
+#include <folly/synchronization/Hazptr.h>
+
+TEST(MappingTest, Empty) {
+  TollFreeMapping db = TollFreeMapping::Builder().build();
+  ASSERT_EQ(db.size(), 0);
+  ASSERT_EQ(db.lookup(8005550101), 0);
+  folly::hazptr_cleanup();
+}
+
+TEST(MappingTest, DuplicateKey) {
+  TollFreeMapping::Builder builder;
+  builder.addRow(8005550101, 1);
+  ASSERT_THROW(builder.addRow(8005550101, 1), std::runtime_error);
+}
+
+TEST(MappingTest, Bitmap) {
+  DncMapping db = DncMapping::Builder()
+    .addRow(2015550000, 1)
+    .addRow(2015550063, 1)
+    .addRow(2015550064, 1)
+    .addRow(2015559999, 1)
+    .addRow(9999999999, 1)
+    .build();
+  ASSERT_EQ(db.size(), 5);
+
+  uint64_t pn[] = { 2015550000, 2015550001, 2015550064, 2015560000,
+                    9999999999, 10000000000 };
+  uint64_t dnc[6];
+  db.lookups(6, pn, dnc);
+  ASSERT_THAT(dnc, testing::ElementsAre(1, 0, 1, 0, 1, 0));
+
+  ASSERT_EQ(db.count(0, 10000000000), 5);
+  ASSERT_EQ(db.count(2015550000, 2015550064), 2);
+  ASSERT_EQ(db.count(2015550001, 2015560000), 3);
+  ASSERT_EQ(db.count(2015560000, 2015550000), 0);
+  ASSERT_THROW(DncMapping::Builder().addRow(10000000000, 1), std::runtime_error);
+  folly::hazptr_cleanup();
+}
+
+TEST(MappingTest, ListedNumberRows) {
+  // Rows of other lengths are skipped instead of failing the reload
+  std::istringstream dncIn(
+    "201,555,0101\n"
+    "1,202,555,0101\n"
+    "203555010\n"
+    "12345678901234567890123\n"
+    "2,045550101\n");
+  DncMapping::Builder dnc;
+  size_t line = 0;
+  dnc.fromCSV(dncIn, line, 100);
+  DncMapping dncDb = dnc.build();
+  ASSERT_EQ(dncDb.size(), 3);
+  ASSERT_EQ(dncDb.lookup(2015550101), 1);
+  ASSERT_EQ(dncDb.lookup(2025550101), 1);
+  ASSERT_EQ(dncDb.lookup(2045550101), 1);
+
+  std::istringstream tollFreeIn(
+    "8005550101,x,y\n"
+    "18885550101,x,y\n"
+    "28885550101,x,y\n"
+    "800555010,x,y\n");
+  TollFreeMapping::Builder tollFree;
+  line = 0;
+  tollFree.fromCSV(tollFreeIn, line, 100);
+  TollFreeMapping tollFreeDb = tollFree.build();
+  ASSERT_EQ(tollFreeDb.size(), 2);
+  ASSERT_EQ(tollFreeDb.lookup(8005550101), 1);
+  ASSERT_EQ(tollFreeDb.lookup(8885550101), 1);
+  folly::hazptr_cleanup();
+}
+
+TEST(MappingTest, LevelFallback) {
+  std::istringstream in(
+    "NPA,NXX,X\n"
+    "201,555,1,NJ,Block Co,1111,NEWARK,ILEC,224,US\n"
+    "201,555,,NJ,Office Co,2222,NEWARK,CLEC,224,US\n");
+  LergMapping::Builder builder;
+  size_t line = 0;
+  builder.fromCSV(in, line, 100);
+  LergMapping db = builder.build();
+  ASSERT_EQ(db.size(), 2);
+
+  uint64_t pn[] = { 2015551234, 2015559999, 2025551234 };
+  LergData lerg[3];
+  db.lookups(3, pn, lerg);
+  ASSERT_EQ(lerg[0].lerg_key, 2015551);
+  ASSERT_EQ(lerg[0].ocn, "1111");
+  ASSERT_EQ(lerg[1].lerg_key, 201555);
+  ASSERT_EQ(lerg[1].ocn, "2222");
+  ASSERT_EQ(lerg[2].lerg_key, 0);
+  folly::hazptr_cleanup();
+}
+
+TEST(MappingTest, Inherit) {
+  DnoMapping npa = DnoMapping::Builder()
+    .addRow(201, 1, DnoPolicy::NPA)
+    .addRow(3035551, 1, DnoPolicy::NPA_NXX_X)
+    .build();
+
+  DnoMapping::Builder builder;
+  builder.inherit(npa, DnoPolicy::NPA_NXX_X);
+  builder.addRow(3035552, 1, DnoPolicy::NPA_NXX_X);
+  DnoMapping db = builder.build();
+
+  uint64_t pn[] = { 2019999999, 3035551234, 3035552234 };
+  uint64_t dno[3];
+  db.lookups(3, pn, dno);
+  ASSERT_EQ(dno[0], 1);
+  ASSERT_EQ(dno[1], 0);
+  ASSERT_EQ(dno[2], 1);
+  folly::hazptr_cleanup();
+}
@@ -0,0 +1,54 @@
+#include <callfwd/Metrics.h>
+#include <string>
+#include <folly/portability/GTest.h>
+
+TEST(MetricsTest, Buckets) {
+  // Small values are exact
+  for (uint64_t v = 0; v < 8; ++v) {
+    EXPECT_EQ(MetricHistogram::bucketOf(v), v);
+    EXPECT_EQ(MetricHistogram::bucketLowerBound(v), v);
+  }
+
+  // Then each power of two is split into 8 sub-buckets
+  EXPECT_EQ(MetricHistogram::bucketOf(8), 8);
+  EXPECT_EQ(MetricHistogram::bucketOf(15), 15);
+  EXPECT_EQ(MetricHistogram::bucketOf(16), 16);
+  EXPECT_EQ(MetricHistogram::bucketOf(17), 16);
+  EXPECT_EQ(MetricHistogram::bucketOf(18), 17);
+  EXPECT_EQ(MetricHistogram::bucketLowerBound(17), 18);
+
+  for (size_t b = 0; b < 200; ++b) {
+    uint64_t lower = MetricHistogram::bucketLowerBound(b);
+    uint64_t next = MetricHistogram::bucketLowerBound(b + 1);
+    ASSERT_LT(lower, next);
+    EXPECT_EQ(MetricHistogram::bucketOf(lower), b);
+    EXPECT_EQ(MetricHistogram::bucketOf(next - 1), b);
+  }
+
+  // Powers of two start a bucket, the coarse export relies on it
+  for (unsigned exp = 0; exp < 36; ++exp) {
+    uint64_t pow = uint64_t(1) << exp;
+    EXPECT_EQ(MetricHistogram::bucketLowerBound(MetricHistogram::bucketOf(pow)), pow);
+  }
+}
+
+TEST(MetricsTest, RenderHistogram) {
+  MetricHistogram histogram("test_values", "Test values");
+  for (uint64_t v : {0, 1, 2, 3, 4, 7, 8, 100})
+    histogram.record(v);
+
+  // Each bound is inclusive, values equal to a power of two are counted
+  // by the next one
+  std::string out = renderMetrics();
+  EXPECT_NE(out.find("# TYPE test_values histogram\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"0\"} 1\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"1\"} 2\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"3\"} 4\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"7\"} 6\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"15\"} 7\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"63\"} 7\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"127\"} 8\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_bucket{le=\"+Inf\"} 8\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_count 8\n"), std::string::npos);
+  EXPECT_NE(out.find("test_values_sum 125\n"), std::string::npos);
+}
@@ -94,6 +94,31 @@ TEST(PhoneMappingTest, LastDigit) {
   folly::hazptr_cleanup();
 }
 
+TEST(PhoneMappingTest, PNRange) {
+  PhoneMapping::Builder builder;
+  for (size_t i = 999; i >= 100; --i)
+    builder.addRow(i, i % 10);
+
+  PhoneMapping db = builder.build();
+  ASSERT_THAT(drain(db.inversePNs(200, 203)),
+              ElementsAre(Pair(200, 0), Pair(201, 1), Pair(202, 2)));
+  ASSERT_FALSE(db.inversePNs(203, 200).hasRow());
+  ASSERT_FALSE(db.inversePNs(1000, 2000).hasRow());
+  ASSERT_EQ(drain(db.inversePNs(0, 1000)).size(), 900);
+  ASSERT_EQ(db.countPNs(0, 1000), 900);
+  ASSERT_EQ(db.countPNs(150, 250), 100);
+  ASSERT_EQ(db.countPNs(250, 150), 0);
+
+  std::vector<std::pair<uint64_t, size_t>> groups;
+  db.countPNs(0, 1000, 100, [&](uint64_t group, size_t count) {
+    groups.emplace_back(group, count);
+  });
+  ASSERT_EQ(groups.size(), 9);
+  ASSERT_THAT(groups[0], Pair(1, 100));
+  ASSERT_THAT(groups[8], Pair(9, 100));
+  folly::hazptr_cleanup();
+}
+
 TEST(PhoneNumberTest, Parse) {
   ASSERT_EQ(PhoneNumber::fromString("+14844249683"), 4844249683);
   ASSERT_EQ(PhoneNumber::fromString("14844249683"), 4844249683);
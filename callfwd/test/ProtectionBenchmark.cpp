@@ -0,0 +1,78 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <folly/synchronization/Hazptr.h>
+#include <folly/synchronization/Rcu.h>
+
+// Per-request cost of protecting datasets from reclamation by a reload,
+// compares protecting every dataset with protecting a single snapshot.
+
+// Datasets read by /target: US, CA and 9 auxiliary mappings
+static constexpr size_t kDatasets = 11;
+
+struct Dataset : folly::hazptr_obj_base<Dataset> {
+  uint64_t value = 1;
+};
+
+static std::array<std::atomic<Dataset*>, kDatasets> datasets;
+static std::atomic<Dataset*> snapshot;
+
+static void setup() {
+  for (auto &global : datasets)
+    global.store(new Dataset);
+  snapshot.store(new Dataset);
+}
+
+static void teardown() {
+  for (auto &global : datasets)
+    global.exchange(nullptr)->retire();
+  snapshot.exchange(nullptr)->retire();
+}
+
+/** A hazard pointer per dataset, as every get() used to take */
+template <size_t N>
+static void hazptrPerDataset(size_t iters) {
+  for (size_t i = 0; i < iters; ++i) {
+    std::array<folly::hazptr_holder<>, N> holder;
+    uint64_t sum = 0;
+    for (size_t d = 0; d < N; ++d)
+      sum += holder[d].get_protected(datasets[d])->value;
+    folly::doNotOptimizeAway(sum);
+  }
+}
+
+BENCHMARK(hazptrPerDataset_target, iters) {
+  hazptrPerDataset<kDatasets>(iters);
+}
+
+// US, CA and ACL
+BENCHMARK(hazptrPerDataset_sip_invite, iters) {
+  hazptrPerDataset<3>(iters);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(hazptrSnapshot, iters) {
+  for (size_t i = 0; i < iters; ++i) {
+    folly::hazptr_holder<> holder;
+    folly::doNotOptimizeAway(holder.get_protected(snapshot)->value);
+  }
+}
+
+BENCHMARK(rcuSnapshot, iters) {
+  for (size_t i = 0; i < iters; ++i) {
+    folly::rcu_reader guard;
+    folly::doNotOptimizeAway(snapshot.load(std::memory_order_acquire)->value);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+  setup();
+  folly::runBenchmarks();
+  teardown();
+  folly::hazptr_cleanup();
+  return 0;
+}
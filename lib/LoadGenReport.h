@@ -0,0 +1,26 @@
+#ifndef LIB_LOAD_GEN_REPORT_H
+#define LIB_LOAD_GEN_REPORT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <folly/Format.h>
+
+/** Print the percentiles shared by callfwd and stir load generators, so
+  * their reports can be compared. Samples are in microseconds and sorted
+  * in place, nothing is printed without them. */
+inline void reportPercentiles(std::ostream &out, const char *what,
+                              std::vector<uint32_t> &samples)
+{
+  if (samples.empty())
+    return;
+  std::sort(samples.begin(), samples.end());
+  out << "  " << what << " (us):";
+  for (double q : {0.5, 0.9, 0.99, 0.999, 0.9999})
+    out << folly::format(" p{}={}", q * 100, samples[size_t(q * (samples.size() - 1))]);
+  out << " max=" << samples.back() << "\n";
+}
+
+#endif // LIB_LOAD_GEN_REPORT_H
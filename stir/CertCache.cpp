@@ -0,0 +1,432 @@
+#include <stir/CertCache.h>
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <glog/logging.h>
+#include <folly/Conv.h>
+#include <folly/Format.h>
+#include <folly/Optional.h>
+#include <folly/SharedMutex.h>
+#include <folly/String.h>
+#include <folly/container/F14Map.h>
+#include <folly/futures/SharedPromise.h>
+#include <folly/io/async/SSLContext.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/portability/GFlags.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/lib/utils/URL.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509_vfy.h>
+
+using namespace proxygen;
+using folly::StringPiece;
+using folly::ssl::BioUniquePtr;
+using folly::ssl::X509UniquePtr;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+
+DEFINE_string(x5u_trust_store, "",
+              "CA file or directory to validate x5u certificates with, "
+              "certificates are rejected if empty");
+DEFINE_bool(x5u_insecure_skip_validation, false,
+            "Accept x5u certificates without validating their chain, "
+            "for testing only");
+DEFINE_uint32(x5u_fetch_concurrency, 16,
+              "Maximum number of x5u certificates fetched at once");
+DEFINE_uint32(x5u_fetch_timeout, 2000,
+              "Milliseconds to wait for x5u certificate");
+DEFINE_uint32(x5u_default_ttl, 3600,
+              "Seconds to cache x5u certificate served without max-age");
+DEFINE_uint32(x5u_min_ttl, 60, "Minimum seconds to cache x5u certificate");
+DEFINE_uint32(x5u_max_ttl, 86400, "Maximum seconds to cache x5u certificate");
+DEFINE_uint32(x5u_error_ttl, 30, "Seconds to remember x5u fetch failure");
+
+namespace {
+
+/** HTTP response to a certificate fetch. */
+struct FetchResult {
+  int status = 0;
+  std::string body;
+  folly::Optional<seconds> maxAge;
+};
+
+/** Parse Cache-Control of the response, no-cache means no lifetime. */
+folly::Optional<seconds> parseMaxAge(StringPiece cacheControl) {
+  folly::Optional<seconds> maxAge;
+  while (!cacheControl.empty()) {
+    StringPiece directive = folly::trimWhitespace(cacheControl.split_step(','));
+    StringPiece name = directive.split_step('=');
+    if (name == "no-cache" || name == "no-store")
+      return seconds(0);
+    if (name == "max-age") {
+      if (auto value = folly::tryTo<uint32_t>(directive))
+        maxAge = seconds(value.value());
+    }
+  }
+  return maxAge;
+}
+
+/** Single GET of an x5u URL, deletes itself when done. */
+class CertFetch : public HTTPConnector::Callback, public HTTPTransactionHandler {
+ public:
+  using Done = folly::Function<void(folly::Try<FetchResult>)>;
+
+  CertFetch(folly::EventBase *evb, std::shared_ptr<folly::SSLContext> tls,
+            const CertCache::Options &opts, Done done)
+    : evb_(evb), tls_(std::move(tls)), timeout_(opts.timeout)
+    , maxSize_(opts.maxSize), connector_(this, &evb->timer())
+    , done_(std::move(done))
+  {}
+
+  ~CertFetch() override {
+    fail("connection closed");
+  }
+
+  /** Resolve and connect, blocks the fetch thread during DNS lookup. */
+  void start(const std::string &x5u) {
+    url_ = URL(x5u);
+    folly::SocketAddress addr;
+    try {
+      if (!url_.isValid() || !url_.hasHost())
+        throw std::invalid_argument("invalid URL");
+      addr = folly::SocketAddress(url_.getHost(), url_.getPort(), true);
+    } catch (const std::exception &ex) {
+      fail(ex.what());
+      delete this;
+      return;
+    }
+
+    if (url_.isSecure()) {
+      connector_.connectSSL(evb_, addr, tls_, nullptr, timeout_,
+                            folly::emptySocketOptionMap,
+                            folly::AsyncSocket::anyAddress(), url_.getHost());
+    } else {
+      connector_.connect(evb_, addr, timeout_);
+    }
+  }
+
+  void connectSuccess(HTTPUpstreamSession *session) override {
+    HTTPTransaction *txn = session->newTransaction(this);
+    session->closeWhenIdle();
+    if (!txn) {
+      delete this;
+      return;
+    }
+
+    HTTPMessage req;
+    req.setMethod(HTTPMethod::GET);
+    req.setURL(url_.makeRelativeURL());
+    req.getHeaders().set(HTTP_HEADER_HOST, url_.getHostAndPort());
+    req.getHeaders().set(HTTP_HEADER_ACCEPT, "application/pem-certificate-chain, */*");
+    txn->setIdleTimeout(timeout_);
+    txn->sendHeaders(req);
+    txn->sendEOM();
+  }
+
+  void connectError(const folly::AsyncSocketException &ex) override {
+    fail(ex.what());
+    delete this;
+  }
+
+  void setTransaction(HTTPTransaction *txn) noexcept override {
+    txn_ = txn;
+  }
+
+  void detachTransaction() noexcept override {
+    delete this;
+  }
+
+  void onHeadersComplete(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    result_.status = msg->getStatusCode();
+    result_.maxAge = parseMaxAge
+      (msg->getHeaders().getSingleOrEmpty(HTTP_HEADER_CACHE_CONTROL));
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> chain) noexcept override {
+    if (!done_)
+      return;
+    if (result_.body.size() + chain->computeChainDataLength() > maxSize_) {
+      fail("certificate too large");
+      txn_->sendAbort();
+      return;
+    }
+    for (folly::ByteRange range : *chain)
+      result_.body.append(reinterpret_cast<const char*>(range.data()), range.size());
+  }
+
+  void onTrailers(std::unique_ptr<HTTPHeaders>) noexcept override {}
+
+  void onEOM() noexcept override {
+    complete(folly::Try<FetchResult>(std::move(result_)));
+  }
+
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+
+  void onError(const HTTPException &error) noexcept override {
+    fail(error.what());
+  }
+
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  void complete(folly::Try<FetchResult> result) {
+    if (done_) {
+      Done done = std::move(done_);
+      done_ = nullptr;
+      done(std::move(result));
+    }
+  }
+
+  void fail(const std::string &what) {
+    complete(folly::Try<FetchResult>(folly::make_exception_wrapper<CertError>
+      (false, folly::sformat("{}: {}", url_.getUrl(), what))));
+  }
+
+  folly::EventBase *evb_;
+  std::shared_ptr<folly::SSLContext> tls_;
+  std::chrono::milliseconds timeout_;
+  size_t maxSize_;
+  HTTPConnector connector_;
+  URL url_;
+  HTTPTransaction *txn_ = nullptr;
+  FetchResult result_;
+  Done done_;
+};
+
+} // namespace
+
+class CertCache::Impl {
+ public:
+  struct Slot {
+    CertPtr cert;
+    folly::exception_wrapper error;
+    steady_clock::time_point expires;
+    // fetch in progress
+    std::shared_ptr<folly::SharedPromise<CertPtr>> pending;
+  };
+
+  explicit Impl(Options opts);
+  folly::SemiFuture<CertPtr> fetch(StringPiece x5u);
+  CertPtr parse(StringPiece x5u, StringPiece pem) const;
+
+ private:
+  /** Future of a cached or fetching slot, empty if a fetch is needed. */
+  static folly::SemiFuture<CertPtr> ready(const Slot &slot, steady_clock::time_point now);
+
+  // fetch thread only
+  void enqueue(std::string x5u);
+  void drain();
+  void finish(const std::string &x5u, folly::Try<FetchResult> result);
+
+  Options opts_;
+  folly::ssl::X509StoreUniquePtr store_;
+  std::shared_ptr<folly::SSLContext> tls_;
+
+  folly::SharedMutex lock_;
+  folly::F14NodeMap<std::string, Slot> slots_;
+
+  // fetch thread only
+  std::deque<std::string> queue_;
+  unsigned active_ = 0;
+
+  // destroyed first, no fetch outlives the cache
+  folly::ScopedEventBaseThread thread_{"X5uFetch"};
+};
+
+CertCache::Impl::Impl(Options opts)
+  : opts_(std::move(opts))
+  , tls_(std::make_shared<folly::SSLContext>())
+{
+  if (!opts_.trustStore.empty()) {
+    const char *path = opts_.trustStore.c_str();
+    bool isDir = std::filesystem::is_directory(opts_.trustStore);
+    store_.reset(X509_STORE_new());
+    if (!X509_STORE_load_locations(store_.get(), isDir ? nullptr : path,
+                                   isDir ? path : nullptr))
+      throw std::runtime_error(opts_.trustStore + ": can't load trust store");
+  } else if (opts_.skipValidation) {
+    LOG(WARNING) << "x5u certificates are not validated";
+  } else {
+    LOG(ERROR) << "No --x5u_trust_store, fetched x5u certificates are rejected";
+  }
+
+  tls_->setVerificationOption(folly::SSLContext::SSLVerifyPeerEnum::VERIFY);
+  SSL_CTX_set_default_verify_paths(tls_->getSSLCtx());
+}
+
+folly::SemiFuture<CertCache::CertPtr>
+CertCache::Impl::ready(const Slot &slot, steady_clock::time_point now) {
+  if (slot.pending)
+    return slot.pending->getSemiFuture();
+  if (now >= slot.expires)
+    return folly::SemiFuture<CertPtr>::makeEmpty();
+  if (slot.cert)
+    return folly::makeSemiFuture(slot.cert);
+  return folly::makeSemiFuture<CertPtr>(slot.error);
+}
+
+folly::SemiFuture<CertCache::CertPtr> CertCache::Impl::fetch(StringPiece x5u) {
+  const auto now = steady_clock::now();
+  {
+    std::shared_lock<folly::SharedMutex> guard(lock_);
+    auto it = slots_.find(x5u);
+    if (it != slots_.end()) {
+      auto future = ready(it->second, now);
+      if (future.valid())
+        return future;
+    }
+  }
+
+  std::unique_lock<folly::SharedMutex> guard(lock_);
+  if (slots_.size() >= opts_.maxEntries) {
+    // Forget expired entries, slots being fetched stay
+    for (auto it = slots_.begin(); it != slots_.end();) {
+      if (!it->second.pending && now >= it->second.expires)
+        it = slots_.erase(it);
+      else
+        ++it;
+    }
+  }
+  Slot &slot = slots_.try_emplace(x5u.str()).first->second;
+  auto future = ready(slot, now);
+  if (future.valid())
+    return future;
+
+  slot.pending = std::make_shared<folly::SharedPromise<CertPtr>>();
+  future = slot.pending->getSemiFuture();
+  guard.unlock();
+
+  thread_.getEventBase()->runInEventBaseThread([this, x5u = x5u.str()]() mutable {
+    enqueue(std::move(x5u));
+  });
+  return future;
+}
+
+void CertCache::Impl::enqueue(std::string x5u) {
+  queue_.push_back(std::move(x5u));
+  drain();
+}
+
+void CertCache::Impl::drain() {
+  while (active_ < opts_.concurrency && !queue_.empty()) {
+    std::string x5u = std::move(queue_.front());
+    queue_.pop_front();
+    ++active_;
+
+    auto *fetch = new CertFetch(thread_.getEventBase(), tls_, opts_,
+      [this, x5u](folly::Try<FetchResult> result) {
+        --active_;
+        finish(x5u, std::move(result));
+        thread_.getEventBase()->runInLoop([this] { drain(); });
+      });
+    fetch->start(x5u);
+  }
+}
+
+void CertCache::Impl::finish(const std::string &x5u, folly::Try<FetchResult> result) {
+  CertPtr cert;
+  folly::exception_wrapper error;
+  seconds ttl = opts_.errorTtl;
+
+  try {
+    const FetchResult &response = result.value();
+    if (response.status != 200)
+      throw CertError(false, folly::sformat("{}: HTTP status {}", x5u, response.status));
+    cert = parse(x5u, response.body);
+    ttl = std::clamp(response.maxAge.value_or(opts_.defaultTtl), opts_.minTtl, opts_.maxTtl);
+  } catch (const CertError &ex) {
+    error = folly::make_exception_wrapper<CertError>(ex);
+  } catch (const std::exception &ex) {
+    error = folly::make_exception_wrapper<CertError>(false, ex.what());
+  }
+  if (error)
+    LOG(WARNING) << "x5u fetch failed: " << error.what();
+
+  std::shared_ptr<folly::SharedPromise<CertPtr>> pending;
+  {
+    std::unique_lock<folly::SharedMutex> guard(lock_);
+    Slot &slot = slots_[x5u];
+    slot.cert = cert;
+    slot.error = error;
+    slot.expires = steady_clock::now() + ttl;
+    pending = std::move(slot.pending);
+  }
+
+  CHECK(pending);
+  if (cert)
+    pending->setValue(std::move(cert));
+  else
+    pending->setException(std::move(error));
+}
+
+CertCache::CertPtr CertCache::Impl::parse(StringPiece x5u, StringPiece pem) const {
+  BioUniquePtr bio(BIO_new_mem_buf(pem.data(), pem.size()));
+  X509UniquePtr leaf(PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr));
+  if (!leaf)
+    throw CertError(false, x5u.str() + ": no PEM certificate");
+
+  // Intermediate certificates follow the leaf
+  folly::ssl::X509StackUniquePtr chain(sk_X509_new_null());
+  while (X509 *cert = PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr))
+    sk_X509_push(chain.get(), cert);
+  ERR_clear_error();
+
+  if (store_) {
+    folly::ssl::X509StoreCtxUniquePtr ctx(X509_STORE_CTX_new());
+    if (!ctx || !X509_STORE_CTX_init(ctx.get(), store_.get(), leaf.get(), chain.get()))
+      throw std::runtime_error("X509_STORE_CTX_init failed");
+    if (X509_verify_cert(ctx.get()) != 1) {
+      int err = X509_STORE_CTX_get_error(ctx.get());
+      throw CertError(true, folly::sformat("{}: {}", x5u, X509_verify_cert_error_string(err)));
+    }
+  } else if (!opts_.skipValidation) {
+    throw CertError(true, x5u.str() + ": no trust store to validate with");
+  }
+
+  auto result = std::make_shared<StirCert>();
+  result->x5u = x5u.str();
+  result->pkey.reset(X509_get_pubkey(leaf.get()));
+  result->cert = std::move(leaf);
+  result->ec = const_cast<EC_KEY*>(EVP_PKEY_get0_EC_KEY(result->pkey.get()));
+  if (!result->ec ||
+      EC_GROUP_get_curve_name(EC_KEY_get0_group(result->ec)) != NID_X9_62_prime256v1)
+    throw CertError(true, x5u.str() + ": not a P-256 key required by ES256");
+  return result;
+}
+
+CertCache::CertCache(Options options)
+  : impl_(std::make_unique<Impl>(std::move(options)))
+{}
+
+CertCache::~CertCache() = default;
+
+CertCache& CertCache::get() {
+  static CertCache *cache = [] {
+    Options opts;
+    opts.trustStore = FLAGS_x5u_trust_store;
+    opts.skipValidation = FLAGS_x5u_insecure_skip_validation;
+    opts.concurrency = std::max(FLAGS_x5u_fetch_concurrency, 1u);
+    opts.timeout = std::chrono::milliseconds(FLAGS_x5u_fetch_timeout);
+    opts.defaultTtl = seconds(FLAGS_x5u_default_ttl);
+    opts.minTtl = seconds(FLAGS_x5u_min_ttl);
+    opts.maxTtl = seconds(std::max(FLAGS_x5u_min_ttl, FLAGS_x5u_max_ttl));
+    opts.errorTtl = seconds(FLAGS_x5u_error_ttl);
+    return new CertCache(std::move(opts));
+  }();
+  return *cache;
+}
+
+folly::SemiFuture<CertCache::CertPtr> CertCache::fetch(StringPiece x5u) {
+  return impl_->fetch(x5u);
+}
+
+CertCache::CertPtr CertCache::parse(StringPiece x5u, StringPiece pem) const {
+  return impl_->parse(x5u, pem);
+}
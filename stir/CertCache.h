@@ -0,0 +1,80 @@
+#ifndef STIR_CERT_CACHE_H
+#define STIR_CERT_CACHE_H
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <folly/Range.h>
+#include <folly/futures/Future.h>
+#include <folly/ssl/OpenSSLPtrTypes.h>
+
+/** Certificate referred by an x5u URL, validated and ready to verify. */
+struct StirCert {
+  std::string x5u;
+  folly::ssl::X509UniquePtr cert;
+  folly::ssl::EvpPkeyUniquePtr pkey;
+  // owned by pkey
+  EC_KEY *ec = nullptr;
+};
+
+/** Failure to fetch or validate a certificate. */
+class CertError : public std::runtime_error {
+ public:
+  CertError(bool untrusted, const std::string &what)
+    : std::runtime_error(what), untrusted_(untrusted) {}
+
+  /** Fetched fine, but not issued by a trusted CA. */
+  bool untrusted() const noexcept { return untrusted_; }
+
+ private:
+  bool untrusted_;
+};
+
+/** Asynchronous cache of x5u certificates. Certificates are fetched over
+  * HTTP(S) by a dedicated thread with limited concurrency, concurrent
+  * requests for the same URL share one fetch. Chains are validated against
+  * the trust store once per fetch and kept for the lifetime allowed by
+  * Cache-Control. Failures are remembered for a short while as well. */
+class CertCache {
+ public:
+  using CertPtr = std::shared_ptr<const StirCert>;
+
+  struct Options {
+    // CA file or hashed directory, certificates are rejected if empty
+    std::string trustStore;
+    // accept any certificate without a trust store, for testing only
+    bool skipValidation = false;
+    unsigned concurrency = 16;
+    std::chrono::milliseconds timeout{2000};
+    size_t maxSize = 65536;
+    // expired entries are swept when the cache grows beyond
+    size_t maxEntries = 65536;
+    // used when the response doesn't carry max-age
+    std::chrono::seconds defaultTtl{3600};
+    std::chrono::seconds minTtl{60};
+    std::chrono::seconds maxTtl{86400};
+    std::chrono::seconds errorTtl{30};
+  };
+
+  explicit CertCache(Options options);
+  ~CertCache();
+
+  /** Shared instance configured with `--x5u_*` flags. */
+  static CertCache& get();
+
+  /** Certificate of `x5u`, completes immediately if cached.
+    * Fails with CertError. */
+  folly::SemiFuture<CertPtr> fetch(folly::StringPiece x5u);
+
+  /** Parse a PEM chain with the leaf certificate first and validate it.
+    * Throws CertError. */
+  CertPtr parse(folly::StringPiece x5u, folly::StringPiece pem) const;
+
+ private:
+  class Impl; /* opaque */
+  std::unique_ptr<Impl> impl_;
+};
+
+#endif // STIR_CERT_CACHE_H
@@ -0,0 +1,68 @@
+#include <stir/CryptoPool.h>
+
+#include <algorithm>
+#include <folly/Format.h>
+#include <folly/portability/GFlags.h>
+#include <folly/system/HardwareConcurrency.h>
+#include <folly/system/ThreadName.h>
+
+DEFINE_int32(crypto_threads, 0,
+             "Number of threads signing and verifying PASSporTs. Numbers == 0 "
+             "use the number of cores, numbers < 0 run crypto on I/O threads.");
+DEFINE_uint32(crypto_batch, 32, "Maximum number of jobs a crypto thread takes at once");
+DEFINE_uint32(crypto_queue, 65536,
+              "Crypto jobs waiting for a thread, more are run on I/O threads");
+
+CryptoPool::CryptoPool(unsigned threads, size_t batch, size_t capacity)
+  : batch_(std::max<size_t>(batch, 1))
+  , queue_(std::max<size_t>(capacity, 1))
+{
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.emplace_back([this, i] {
+      folly::setThreadName(folly::sformat("Crypto{}", i));
+      loop();
+    });
+  }
+}
+
+CryptoPool::~CryptoPool() {
+  // An empty job stops one worker
+  for (size_t i = 0; i < workers_.size(); ++i)
+    queue_.blockingWrite(nullptr);
+  for (std::thread &worker : workers_)
+    worker.join();
+}
+
+CryptoPool& CryptoPool::get() {
+  static CryptoPool *pool = [] {
+    unsigned threads = 0;
+    if (FLAGS_crypto_threads == 0)
+      threads = folly::hardware_concurrency();
+    else if (FLAGS_crypto_threads > 0)
+      threads = FLAGS_crypto_threads;
+    return new CryptoPool(threads, FLAGS_crypto_batch, FLAGS_crypto_queue);
+  }();
+  return *pool;
+}
+
+void CryptoPool::loop() {
+  std::vector<Job> batch;
+  batch.reserve(batch_);
+  bool stopping = false;
+
+  while (!stopping) {
+    Job job;
+    queue_.blockingRead(job);
+    do {
+      if (!job) {
+        stopping = true;
+        break;
+      }
+      batch.push_back(std::move(job));
+    } while (batch.size() < batch_ && queue_.read(job));
+
+    for (Job &pending : batch)
+      pending();
+    batch.clear();
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef STIR_CRYPTO_POOL_H
+#define STIR_CRYPTO_POOL_H
+
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <folly/Function.h>
+#include <folly/MPMCQueue.h>
+#include <folly/futures/Future.h>
+
+/** Worker threads running signing and verification off the I/O threads.
+  * Workers take jobs from a shared queue in batches and run a batch back
+  * to back, so the key and curve tables stay in CPU cache. Results are
+  * delivered through futures, callers continue on their own executor.
+  * A pool without threads runs jobs inline. */
+class CryptoPool {
+ public:
+  /** Start `threads` workers taking up to `batch` jobs at once. */
+  CryptoPool(unsigned threads, size_t batch, size_t capacity);
+  /** Finish queued jobs and join workers. */
+  ~CryptoPool();
+
+  /** Shared pool configured with `--crypto_*` flags. */
+  static CryptoPool& get();
+
+  /** Run `fn` on a worker, or inline if the pool has no workers or its
+    * queue is full. */
+  template <class F, class R = std::invoke_result_t<F&>>
+  folly::SemiFuture<R> run(F &&fn) {
+    if (workers_.empty())
+      return folly::makeSemiFutureWith(std::forward<F>(fn));
+
+    auto [promise, future] = folly::makePromiseContract<R>();
+    Job job([promise = std::move(promise), fn = std::forward<F>(fn)]() mutable {
+      promise.setWith(fn);
+    });
+    if (!queue_.write(std::move(job)))
+      job();
+    return std::move(future);
+  }
+
+ private:
+  using Job = folly::Function<void()>;
+
+  void loop();
+
+  size_t batch_;
+  folly::MPMCQueue<Job> queue_;
+  std::vector<std::thread> workers_;
+};
+
+#endif // STIR_CRYPTO_POOL_H
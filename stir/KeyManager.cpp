@@ -0,0 +1,160 @@
+#include <stir/KeyManager.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <glog/logging.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/container/F14Map.h>
+#include <folly/synchronization/Hazptr.h>
+#include <folly/portability/GFlags.h>
+#include <proxygen/lib/utils/Base64.h>
+#include <openssl/pem.h>
+
+using folly::StringPiece;
+using folly::ssl::BioUniquePtr;
+using folly::ssl::EvpPkeyUniquePtr;
+using folly::ssl::X509UniquePtr;
+
+DEFINE_string(stir_keys, "",
+              "CSV file of `x5u,pem-file` lines listing the ES256 keys");
+
+class KeyManager::Data : public folly::hazptr_obj_base<Data> {
+ public:
+  std::vector<Key> keys;
+  // key index by x5u
+  folly::F14FastMap<std::string, size_t> byX5u;
+  // first private key listed
+  const Key *defaultKey = nullptr;
+};
+
+static std::atomic<KeyManager::Data*> currentKeys;
+
+/** Read a private key, public key or certificate from PEM file. */
+static EvpPkeyUniquePtr readPem(const std::string &path, bool &isPrivate) {
+  auto fail = [&](const char *what) {
+    return std::runtime_error(folly::sformat("{}: {}", path, what));
+  };
+
+  BioUniquePtr bio(BIO_new_file(path.c_str(), "r"));
+  if (!bio)
+    throw fail("can't open file");
+
+  EvpPkeyUniquePtr pkey(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr));
+  isPrivate = !!pkey;
+  if (!pkey) {
+    BIO_reset(bio.get());
+    pkey.reset(PEM_read_bio_PUBKEY(bio.get(), nullptr, nullptr, nullptr));
+  }
+  if (!pkey) {
+    BIO_reset(bio.get());
+    X509UniquePtr cert(PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr));
+    if (cert)
+      pkey.reset(X509_get_pubkey(cert.get()));
+  }
+  if (!pkey)
+    throw fail("no PEM key or certificate");
+
+  const EC_KEY *ec = EVP_PKEY_get0_EC_KEY(pkey.get());
+  if (!ec || EC_GROUP_get_curve_name(EC_KEY_get0_group(ec)) != NID_X9_62_prime256v1)
+    throw fail("not a P-256 key required by ES256");
+  return pkey;
+}
+
+/** The x5u is copied verbatim into the JSON header and the `info=<...>`
+  * parameter, only printable ASCII without quotes, backslash or angle
+  * brackets may be copied so. */
+static bool isPlainX5u(StringPiece x5u) {
+  if (x5u.empty())
+    return false;
+  for (char c : x5u) {
+    if (c <= ' ' || c >= 0x7f || c == '"' || c == '\\' || c == '<' || c == '>')
+      return false;
+  }
+  return true;
+}
+
+void KeyManager::load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error(path + ": can't open file");
+
+  auto data = std::make_unique<Data>();
+  std::string linebuf;
+  std::vector<StringPiece> fields;
+  for (size_t line = 1; std::getline(in, linebuf); ++line) {
+    StringPiece text = folly::trimWhitespace(linebuf);
+    if (text.empty() || text.startsWith('#'))
+      continue;
+
+    fields.clear();
+    folly::split(',', text, fields);
+    if (fields.size() != 2)
+      throw std::runtime_error(folly::sformat("{}:{}: expected x5u,pem-file", path, line));
+
+    Key key;
+    key.x5u = folly::trimWhitespace(fields[0]).str();
+    if (!isPlainX5u(key.x5u))
+      throw std::runtime_error(folly::sformat("{}:{}: invalid x5u {}", path, line, key.x5u));
+    key.pkey = readPem(folly::trimWhitespace(fields[1]).str(), key.canSign);
+    key.ec = const_cast<EC_KEY*>(EVP_PKEY_get0_EC_KEY(key.pkey.get()));
+
+    // Multiples of the generator are shared by all signatures
+    if (key.canSign && !EC_KEY_precompute_mult(key.ec, nullptr))
+      throw std::runtime_error(path + ": EC precomputation failed");
+    if (key.canSign)
+      key.nonces = NoncePool::create(key.ec);
+
+    // The header only depends on the key
+    std::string header = folly::sformat
+      (R"({{"alg":"ES256","ppt":"shaken","typ":"passport","x5u":"{}"}})",
+       key.x5u);
+    key.header = proxygen::Base64::urlEncode(folly::range(header));
+
+    if (!data->byX5u.emplace(key.x5u, data->keys.size()).second)
+      throw std::runtime_error(folly::sformat("{}:{}: duplicate x5u {}", path, line, key.x5u));
+    data->keys.push_back(std::move(key));
+  }
+
+  // Pointers are stable from now on
+  for (const Key &key : data->keys) {
+    if (key.canSign) {
+      data->defaultKey = &key;
+      break;
+    }
+  }
+
+  LOG(INFO) << "STIR keys updated: " << data->keys.size() << " keys, default x5u "
+            << (data->defaultKey ? data->defaultKey->x5u : "none");
+  if (Data *veteran = currentKeys.exchange(data.release()))
+    veteran->retire();
+}
+
+KeyManager::KeyManager(std::atomic<Data*> &global)
+  : data_(holder_.get_protected(global))
+{}
+
+KeyManager::KeyManager(KeyManager&& rhs) noexcept = default;
+
+KeyManager::~KeyManager() noexcept = default;
+
+KeyManager KeyManager::get() noexcept {
+  return KeyManager(currentKeys);
+}
+
+const KeyManager::Key* KeyManager::signingKey(StringPiece x5u) const noexcept {
+  if (!data_)
+    return nullptr;
+  if (x5u.empty())
+    return data_->defaultKey;
+  const Key *key = verificationKey(x5u);
+  return key && key->canSign ? key : nullptr;
+}
+
+const KeyManager::Key* KeyManager::verificationKey(StringPiece x5u) const noexcept {
+  if (!data_)
+    return nullptr;
+  auto it = data_->byX5u.find(x5u);
+  return it != data_->byX5u.end() ? &data_->keys[it->second] : nullptr;
+}
@@ -0,0 +1,58 @@
+#ifndef STIR_KEY_MANAGER_H
+#define STIR_KEY_MANAGER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <folly/Range.h>
+#include <folly/ssl/OpenSSLPtrTypes.h>
+#include <folly/synchronization/HazptrHolder.h>
+
+#include <stir/NoncePool.h>
+
+/** ES256 keys of the STIR service, loaded once and shared by all
+  * requests. Keys are identified by the x5u URL of their certificate. */
+class KeyManager {
+ public:
+  class Data; /* opaque */
+
+  struct Key {
+    std::string x5u;
+    // base64url encoded PASSporT header referring to x5u
+    std::string header;
+    folly::ssl::EvpPkeyUniquePtr pkey;
+    // owned by pkey
+    EC_KEY *ec = nullptr;
+    // precomputed nonces of a private key, null if disabled
+    std::shared_ptr<NoncePool> nonces;
+    bool canSign = false;
+  };
+
+  /** Construct from globals and hold protected reference. */
+  KeyManager(std::atomic<Data*> &global);
+  /** Ensure move constructor exists */
+  KeyManager(KeyManager&& rhs) noexcept;
+  /** Get current instance from global variable. */
+  static KeyManager get() noexcept;
+  ~KeyManager() noexcept;
+
+  /** Load keys from CSV file of `x5u,pem-file` lines and publish them.
+    * A PEM file holds a private key used for signing and verification,
+    * or a public key or certificate used only for verification.
+    * Throws `runtime_error`, current keys are kept then. */
+  static void load(const std::string &path);
+
+  /** Key to sign with: the private key of `x5u`, or the first private
+    * key listed if `x5u` is empty. Returns nullptr if there is none. */
+  const Key* signingKey(folly::StringPiece x5u = {}) const noexcept;
+
+  /** Public key of `x5u`, nullptr if unknown. */
+  const Key* verificationKey(folly::StringPiece x5u) const noexcept;
+
+ private:
+  folly::hazptr_holder<> holder_;
+  const Data *data_;
+};
+
+#endif // STIR_KEY_MANAGER_H
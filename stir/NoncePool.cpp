@@ -0,0 +1,190 @@
+#include <stir/NoncePool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <folly/portability/GFlags.h>
+#include <folly/system/ThreadName.h>
+
+using folly::ssl::BIGNUMUniquePtr;
+using folly::ssl::EcdsaSigUniquePtr;
+
+DEFINE_uint32(ecdsa_nonce_pool, 1024,
+              "Maximum number of precomputed ECDSA nonces per signing key, "
+              "0 computes every nonce while signing");
+DEFINE_uint32(ecdsa_nonce_horizon_ms, 250,
+              "Keep precomputed nonces for this much of the observed signing rate");
+
+// ring kept ready for the first signatures after start or an idle period
+static constexpr size_t kMinNonces = 16;
+// how often the rate is sampled if no signer wakes the thread earlier
+static constexpr std::chrono::milliseconds kRefillTick{50};
+
+static std::atomic<uint64_t> nonceHits{0};
+static std::atomic<uint64_t> nonceMisses{0};
+static std::atomic<uint64_t> noncesPrecomputed{0};
+
+/** The thread computing nonces of all live pools. */
+class NoncePool::Refiller {
+ public:
+  static Refiller& get() {
+    static Refiller *refiller = new Refiller;
+    return *refiller;
+  }
+
+  void add(const std::shared_ptr<NoncePool> &pool) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pools_.push_back(pool);
+    }
+    wakeup();
+  }
+
+  void wakeup() {
+    if (!wakeup_.exchange(true, std::memory_order_acq_rel))
+      cond_.notify_one();
+  }
+
+  /** Pools not yet destroyed. */
+  std::vector<std::shared_ptr<NoncePool>> live() {
+    std::vector<std::shared_ptr<NoncePool>> result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = pools_.begin(); it != pools_.end();) {
+      if (auto pool = it->lock()) {
+        result.push_back(std::move(pool));
+        ++it;
+      } else {
+        it = pools_.erase(it);
+      }
+    }
+    return result;
+  }
+
+ private:
+  Refiller() {
+    std::thread([this] {
+      folly::setThreadName("EcdsaNonces");
+      loop();
+    }).detach();
+  }
+
+  void loop() {
+    folly::ssl::BNCtxUniquePtr ctx(BN_CTX_new());
+    CHECK(ctx);
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock, kRefillTick, [this] {
+          return wakeup_.load(std::memory_order_acquire);
+        });
+      }
+      wakeup_.store(false, std::memory_order_release);
+
+      for (auto &pool : live())
+        pool->refill(ctx.get(), Clock::now());
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<bool> wakeup_{false};
+  std::vector<std::weak_ptr<NoncePool>> pools_;
+};
+
+std::shared_ptr<NoncePool> NoncePool::create(EC_KEY *ec) {
+  if (FLAGS_ecdsa_nonce_pool == 0)
+    return nullptr;
+  std::shared_ptr<NoncePool> pool(new NoncePool(ec, FLAGS_ecdsa_nonce_pool));
+  Refiller::get().add(pool);
+  return pool;
+}
+
+NoncePool::NoncePool(EC_KEY *ec, size_t capacity)
+  : ring_(capacity)
+  , capacity_(capacity)
+  , target_(std::min(kMinNonces, capacity))
+  , lastRefill_(Clock::now())
+{
+  EC_KEY_up_ref(ec);
+  ec_.reset(ec);
+}
+
+// Nonces left in the ring are cleared by their BIGNUM deleter
+NoncePool::~NoncePool() = default;
+
+EcdsaSigUniquePtr NoncePool::sign(folly::ByteRange digest) {
+  signed_.fetch_add(1, std::memory_order_relaxed);
+
+  EcdsaSigUniquePtr sig;
+  Nonce nonce;
+  if (ring_.read(nonce)) {
+    sig.reset(ECDSA_do_sign_ex(digest.data(), digest.size(),
+                               nonce.kinv.get(), nonce.r.get(), ec_.get()));
+    if (size() < target_.load(std::memory_order_relaxed) / 2)
+      Refiller::get().wakeup();
+  } else {
+    Refiller::get().wakeup();
+  }
+
+  // A nonce giving s == 0 is rejected, sign with a fresh one then
+  if (sig) {
+    nonceHits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    nonceMisses.fetch_add(1, std::memory_order_relaxed);
+    sig.reset(ECDSA_do_sign(digest.data(), digest.size(), ec_.get()));
+  }
+  return sig;
+}
+
+size_t NoncePool::size() const noexcept {
+  return std::max<ssize_t>(ring_.size(), 0);
+}
+
+void NoncePool::refill(BN_CTX *ctx, Clock::time_point now) {
+  using namespace std::chrono;
+
+  // Smoothed signatures per second, bursts raise the level quickly
+  double elapsed = duration<double>(now - lastRefill_).count();
+  uint64_t total = signed_.load(std::memory_order_relaxed);
+  if (elapsed > 0) {
+    double rate = (total - lastSigned_) / elapsed;
+    rate_ = rate > rate_ ? rate : 0.8 * rate_ + 0.2 * rate;
+  }
+  lastSigned_ = total;
+  lastRefill_ = now;
+
+  double wanted = std::ceil(rate_ * FLAGS_ecdsa_nonce_horizon_ms / 1000.0);
+  size_t target = std::clamp<size_t>(wanted, std::min(kMinNonces, capacity_), capacity_);
+  target_.store(target, std::memory_order_relaxed);
+
+  // Bounded per round, so a busy key doesn't starve the others
+  for (size_t n = size(); n < target; ++n) {
+    BIGNUM *kinv = nullptr, *r = nullptr;
+    if (!ECDSA_sign_setup(ec_.get(), ctx, &kinv, &r)) {
+      LOG_FIRST_N(ERROR, 1) << "ECDSA nonce precomputation failed";
+      return;
+    }
+    Nonce nonce{BIGNUMUniquePtr(kinv), BIGNUMUniquePtr(r)};
+    if (!ring_.write(std::move(nonce)))
+      return;
+    noncesPrecomputed.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+NoncePool::Stats NoncePool::stats() {
+  Stats stats;
+  stats.hits = nonceHits.load(std::memory_order_relaxed);
+  stats.misses = nonceMisses.load(std::memory_order_relaxed);
+  stats.precomputed = noncesPrecomputed.load(std::memory_order_relaxed);
+  if (FLAGS_ecdsa_nonce_pool == 0)
+    return stats;
+  for (auto &pool : Refiller::get().live()) {
+    stats.size += pool->size();
+    stats.target += pool->target_.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
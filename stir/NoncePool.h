@@ -0,0 +1,69 @@
+#ifndef STIR_NONCE_POOL_H
+#define STIR_NONCE_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <folly/MPMCQueue.h>
+#include <folly/Range.h>
+#include <folly/ssl/OpenSSLPtrTypes.h>
+
+/** Precomputed ECDSA nonces of one signing key. Computing r from k·G is
+  * most of the cost of a signature, a background thread keeps a bounded
+  * ring of (k⁻¹, r) pairs so signing only does the final modular step.
+  * The ring is refilled to cover `--ecdsa_nonce_horizon_ms` of the
+  * observed signing rate. Every nonce is used once; when the ring runs
+  * dry a signature is made with a fresh nonce as before. */
+class NoncePool {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t precomputed = 0;
+    size_t size = 0;
+    size_t target = 0;
+  };
+
+  /** Pool for the private key `ec`, nullptr if `--ecdsa_nonce_pool` is 0.
+    * Holds a reference to `ec` and is refilled while the pool is alive. */
+  static std::shared_ptr<NoncePool> create(EC_KEY *ec);
+  ~NoncePool();
+
+  /** Sign `digest`, with a precomputed nonce if one is ready. */
+  folly::ssl::EcdsaSigUniquePtr sign(folly::ByteRange digest);
+
+  /** Nonces ready to use. */
+  size_t size() const noexcept;
+
+  /** Counters of all pools. */
+  static Stats stats();
+
+ private:
+  struct Nonce {
+    folly::ssl::BIGNUMUniquePtr kinv;
+    folly::ssl::BIGNUMUniquePtr r;
+  };
+  using Clock = std::chrono::steady_clock;
+  class Refiller;
+
+  NoncePool(EC_KEY *ec, size_t capacity);
+  /** Top up the ring, called by the refill thread only. */
+  void refill(BN_CTX *ctx, Clock::time_point now);
+
+  folly::ssl::EcKeyUniquePtr ec_;
+  folly::MPMCQueue<Nonce> ring_;
+  size_t capacity_;
+  // refill level, the refill thread is woken below half of it
+  std::atomic<size_t> target_;
+  // signatures made since creation
+  std::atomic<uint64_t> signed_{0};
+
+  // owned by the refill thread
+  uint64_t lastSigned_ = 0;
+  Clock::time_point lastRefill_;
+  double rate_ = 0;
+};
+
+#endif // STIR_NONCE_POOL_H
@@ -1,75 +1,90 @@
 #include "Passport.h"
+#include "KeyManager.h"
+#include "CertCache.h"
+#include "CryptoPool.h"
+#include "VerifiedCache.h"
+#include "PassportCodec.h"
 
 #include <folly/Range.h>
-#include <folly/Format.h>
-#include <folly/json.h>
-#include <folly/dynamic.h>
+#include <folly/Optional.h>
+#include <folly/Conv.h>
 #include <folly/Uri.h>
+#include <folly/small_vector.h>
 #include <folly/ssl/OpenSSLHash.h>
 #include <folly/ssl/OpenSSLPtrTypes.h>
 #include <folly/portability/GFlags.h>
-#include <proxygen/lib/utils/Base64.h> // TODO: fix it or replace
 
 #include <array>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 
 using folly::ssl::OpenSSLHash;
 using folly::ssl::EvpPkeyUniquePtr;
 using folly::ssl::EcdsaSigUniquePtr;
 using folly::StringPiece;
 using folly::trimWhitespace;
-using proxygen::Base64;
 
 DEFINE_uint32(valid_iat_period, 60,
               "Fail SHAKEN verification, if iat value in identity header "
               "exceeds current time by this value");
 
 
-std::string makePassport(const SigningRequest &req) {
-  EvpPkeyUniquePtr priv;
-  EC_KEY *ec;
-  FILE *pemfile;
-
-  pemfile = fopen("/home/sergio/tmp/ec256-private.pem", "r");
-  assert(pemfile);
-  priv.reset(PEM_read_PrivateKey(pemfile, NULL, NULL, NULL));
-  fclose(pemfile);
-  ec = EVP_PKEY_get0_EC_KEY(priv.get());
-  assert(priv && ec);
-
-  const std::string x5u = "http://asipto.lab/stir/cert.pem";
-  std::string header = folly::sformat
-    (R"({{"alg":"ES256","ppt":"shaken","typ":"passport","x5u":"{}"}})",
-     x5u);
+folly::Expected<std::string, StirApiError>
+makePassport(const SigningRequest &req) {
+  KeyManager keys = KeyManager::get();
+  const KeyManager::Key *key = keys.signingKey(req.x5u);
+  if (!key) {
+    StirApiError err = STIR_POL_INTERNAL_ERROR;
+    if (!req.x5u.empty()) {
+      err = STIR_SVC_INVALID_PARAMETER_VALUE;
+      err.putVariable("x5u");
+      err.putVariable("no signing key for this URL");
+    }
+    return folly::makeUnexpected(std::move(err));
+  }
 
   // Sort destinations lexicographically
-  folly::fbvector<StringPiece> dest(req.dest.size());
-  for (size_t i = 0; i < req.dest.size(); ++i)
-    dest[i] = req.dest[i];
+  folly::small_vector<StringPiece, 8> dest(req.dest.begin(), req.dest.end());
   std::sort(dest.begin(), dest.end());
 
-  std::string payload = folly::sformat
-    (R"({{"attest":"{}","dest":{{"tn":["{}"]}},"iat":{},"orig":{{"tn":"{}"}},"origid":"{}"}})",
-     req.attest, folly::join("\",\"", dest), req.iat, req.orig, req.origid);
-
-  std::string signingString = folly::sformat
-    ("{}.{}",
-     Base64::urlEncode(folly::range(header)),
-     Base64::urlEncode(folly::range(payload)));
+  PassportPayload claims;
+  claims.attest = req.attest;
+  claims.dest = folly::range(dest);
+  claims.iat = req.iat;
+  claims.orig = req.orig;
+  claims.origid = req.origid;
+
+  folly::small_vector<char, 512> payload(passportPayloadSize(claims));
+  writePassportPayload(claims, payload.data());
+
+  // header.payload.signature;info=<x5u>
+  constexpr size_t kSignatureSize = base64urlEncodedSize(64);
+  std::string identity;
+  identity.resize(key->header.size() + 1 + base64urlEncodedSize(payload.size()) +
+                  1 + kSignatureSize + 7 + key->x5u.size() + 1);
+  char *p = &identity[0];
+  std::memcpy(p, key->header.data(), key->header.size());
+  p += key->header.size();
+  *p++ = '.';
+  p = base64urlEncode(folly::ByteRange(StringPiece(payload.data(), payload.size())), p);
 
   std::array<uint8_t, 32> digest;
   std::array<uint8_t, 64> sigbuf;
 
   OpenSSLHash::sha256(folly::range(digest),
-                      folly::range(signingString));
+                      StringPiece(identity.data(), p));
 
   {
     EcdsaSigUniquePtr sig;
     const BIGNUM *r, *s;
 
-    sig.reset(ECDSA_do_sign(digest.data(), digest.size(), ec));
-    assert(sig);
+    if (key->nonces)
+      sig = key->nonces->sign(folly::range(digest));
+    else
+      sig.reset(ECDSA_do_sign(digest.data(), digest.size(), key->ec));
+    if (!sig)
+      return folly::makeUnexpected(StirApiError(STIR_POL_INTERNAL_ERROR));
 
     ECDSA_SIG_get0(sig.get(), &r, &s);
     assert(r && BN_num_bytes(r) <= 32);
@@ -79,11 +94,15 @@ std::string makePassport(const SigningRequest &req) {
     BN_bn2binpad(s, sigbuf.data()+32, 32);
   }
 
-  return folly::sformat
-    ("{}.{};info=<{}>",
-     signingString,
-     Base64::urlEncode(folly::range(sigbuf)),
-     x5u);
+  *p++ = '.';
+  p = base64urlEncode(folly::range(sigbuf), p);
+  std::memcpy(p, ";info=<", 7);
+  p += 7;
+  std::memcpy(p, key->x5u.data(), key->x5u.size());
+  p += key->x5u.size();
+  *p++ = '>';
+  assert(p == identity.data() + identity.size());
+  return identity;
 }
 
 static const char* NO_TN_VALIDATION = "No-TN-Validation";
@@ -108,7 +127,27 @@ static VerificationResponse VF_UNSUPPORTED_CREDENTIAL(bool fail, const char* des
   return {437, fail ? TN_VALIDATION_FAILED : NO_TN_VALIDATION, "Unsupported credential", desc};
 }
 
-VerificationResponse verifyPassport(const VerificationRequest &request) {
+/** Signature validation left after all claims are checked. */
+struct SignatureCheck {
+  VerifiedCache::Key key;
+  uint64_t iat;
+  std::string x5u;
+  std::array<uint8_t, 32> digest;
+  EcdsaSigUniquePtr sig;
+
+  /** Validate the signature and cache the outcome. */
+  VerificationResponse verify(const EC_KEY *ec) const;
+};
+
+static bool isFreshIat(uint64_t iat, uint64_t time) {
+  uint64_t iatDrift = (iat > time) ? iat - time : time - iat;
+  return iatDrift <= FLAGS_valid_iat_period;
+}
+
+/** Verification steps up to signature decoding, returns a response if
+  * the identity is rejected before the certificate is needed. */
+static folly::Optional<VerificationResponse>
+checkIdentity(const VerificationRequest &request, SignatureCheck &check) {
   using namespace std::chrono;
 
   uint64_t now = duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
@@ -120,6 +159,18 @@ VerificationResponse verifyPassport(const VerificationRequest &request) {
   if (timeDrift > FLAGS_valid_iat_period)
     return VF_STALE_DATE("Received 'time' value is not fresh.");
 
+  // Remaining checks are determined by the request, a cached outcome
+  // only needs the freshness of its iat
+  VerifiedCache &verified = VerifiedCache::get();
+  if (verified.enabled()) {
+    check.key = VerifiedCache::key(request);
+    if (auto hit = verified.find(check.key)) {
+      if (!isFreshIat(hit->iat, request.time))
+        return VF_STALE_DATE("'iat' from PASSporT payload is not fresh.");
+      return std::move(hit->response);
+    }
+  }
+
   // Parse the "identity" parameter value.
   StringPiece identity = request.identity;
   StringPiece identityDigest = trimWhitespace(identity.split_step(';'));
@@ -166,79 +217,70 @@ VerificationResponse verifyPassport(const VerificationRequest &request) {
   }
 
   // Decode "identity-digest" parameter value to extract from the first portion
-  std::string headerText;
-  folly::dynamic header;
-  try {
-    headerText = Base64::urlDecode(headerDigest.str());
-    header = folly::parseJson(headerText);
-  } catch (const folly::json::parse_error &ex) {
+  folly::small_vector<char, 256> headerText(base64urlDecodedSize(headerDigest.size()));
+  ptrdiff_t headerSize = base64urlDecode(headerDigest, (uint8_t*)headerText.data());
+  PassportHeader header;
+  if (headerSize < 0 ||
+      !parsePassportHeader(headerText.data(), headerText.data() + headerSize, header))
     return VF_BAD_IDENTITY_INFO("Unable to decode PASSporT header.");
-  }
-  if (!header.isObject())
-    return VF_BAD_IDENTITY_INFO("PASSporT header is not a JSON object.");
 
   // a. If one of the mentioned claims is missing -> reject request (E9).
-  if (!header.get_ptr("ppt"))
+  if (!header.ppt.data())
     return VF_BAD_IDENTITY_INFO("Missing 'ppt' claim in the PASSporT header.");
-  if (!header.get_ptr("typ"))
+  if (!header.typ.data())
     return VF_BAD_IDENTITY_INFO("Missing 'typ' claim in the PASSporT header.");
-  if (!header.get_ptr("alg"))
+  if (!header.alg.data())
     return VF_BAD_IDENTITY_INFO("Missing 'alg' claim in the PASSporT header.");
-  if (!header.get_ptr("x5u"))
+  if (!header.x5u.data())
     return VF_BAD_IDENTITY_INFO("Missing 'x5u' claim in the PASSporT header.");
 
   // b. If extracted "typ" value is not equal to "passport" -> reject request (E11).
-  if (header["typ"] != "passport")
+  if (header.typ != "passport")
     return VF_UNSUPPORTED_CREDENTIAL(false, "'typ' from PASSporT header is not 'passport'.");
   // c. If extracted "alg" value is not equal to "ES256" -> reject request (E12).
-  if (header["alg"] != "ES256")
+  if (header.alg != "ES256")
     return VF_UNSUPPORTED_CREDENTIAL(false, "'alg' from PASSporT header is not 'ES256'.");
   // d. If extracted "x5u" value is not equal to the URI specified in the
   //    "info" parameter of Identity header -> reject request (E10).
-  if (header["x5u"] != identityInfo)
+  if (header.x5u != identityInfo)
     return VF_BAD_IDENTITY_INFO("'x5u' from PASSporT header doesn’t match the "
                                 "'info' parameter of identity header value.");
   // e. If extracted "ppt" is not equal to "shaken" -> reject request (E13).
-  if (header["ppt"] != "shaken")
+  if (header.ppt != "shaken")
     return VF_INVALID_IDENTITY("'ppt' from PASSporT header is not 'shaken'");
 
 
   // Decode “identity-digest” parameter value to extract from the second portion
-  std::string payloadText;
-  folly::dynamic payload;
-  try {
-    payloadText = Base64::urlDecode(payloadDigest.str());
-    payload = folly::parseJson(payloadText);
-  } catch (const folly::json::parse_error &ex) {
+  folly::small_vector<char, 512> payloadText(base64urlDecodedSize(payloadDigest.size()));
+  ptrdiff_t payloadSize = base64urlDecode(payloadDigest, (uint8_t*)payloadText.data());
+  PassportClaims payload;
+  if (payloadSize < 0 ||
+      !parsePassportClaims(payloadText.data(), payloadText.data() + payloadSize, payload))
     return VF_BAD_IDENTITY_INFO("Unable to decode PASSporT payload.");
-  }
-  if (!payload.isObject())
-    return VF_BAD_IDENTITY_INFO("PASSporT payload is not a JSON object.");
 
   // a. On missing mandatory claims reject request (E14).
-  if (!payload.get_ptr("dest"))
+  if (!payload.hasDest)
     return VF_INVALID_IDENTITY("Missing 'dest' mandatory claim in PASSporT payload");
-  if (!payload.get_ptr("orig"))
+  if (!payload.orig.data())
     return VF_INVALID_IDENTITY("Missing 'orig' mandatory claim in PASSporT payload");
-  if (!payload.get_ptr("attest"))
+  if (!payload.attest.data())
     return VF_INVALID_IDENTITY("Missing 'attest' mandatory claim in PASSporT payload");
-  if (!payload.get_ptr("origid"))
+  if (!payload.origid.data())
     return VF_INVALID_IDENTITY("Missing 'origid' mandatory claim in PASSporT payload");
-  if (!payload.get_ptr("iat"))
+  if (!payload.iat.data())
     return VF_INVALID_IDENTITY("Missing 'iat' mandatory claim in PASSporT payload");
-  if (!payload["iat"].isInt() || payload["iat"] < 0)
+  auto iat = folly::tryTo<uint64_t>(payload.iat);
+  if (!iat)
     return VF_INVALID_IDENTITY("Bad 'iat' claim value in PASSporT payload");
 
   // b. Validate the extracted from payload "iat" claim value in terms of "freshness"
   // relative to "time" value: request with "expired" 'iat' will be rejected (E15).
-  uint64_t iat = payload["iat"].asInt();
-  uint64_t iatDrift = (iat > request.time) ? iat - request.time : request.time - iat;
-  if (iatDrift > FLAGS_valid_iat_period)
+  check.iat = iat.value();
+  if (!isFreshIat(check.iat, request.time))
     return VF_STALE_DATE("'iat' from PASSporT payload is not fresh.");
 
   // c. On invalid "attest" claim reject request (E19).
-  folly::dynamic attest = payload["attest"];
-  if (attest != "A" && attest != "B" && attest != "C")
+  if (payload.attest != "A" && payload.attest != "B" && payload.attest != "C")
     return VF_INVALID_IDENTITY("'attest' claim in PASSporT payload is not valid.");
 
   // d. Normalize to the canonical form the received in the "verificationRequest"
@@ -247,64 +289,102 @@ VerificationResponse verifyPassport(const VerificationRequest &request) {
   // PASSporT payload. If they are not identical -> reject request (E16).
 
   // TODO: TN normalization
-  // TODO: handle exception if no "TN" present
-  if (payload["orig"]["tn"] != StringPiece(request.from))
+  if (payload.orig != StringPiece(request.from))
     return VF_INVALID_IDENTITY("'orig' claim from PASSporT payload doesn’t match the "
                                "received in the verification request claim.");
-  if (payload["dest"]["tn"] != folly::dynamic::array(folly::range(request.to)))
+  if (!std::equal(payload.dest.begin(), payload.dest.end(),
+                  request.to.begin(), request.to.end()))
     return VF_INVALID_IDENTITY("'dest' claim from PASSporT payload doesn’t match the "
                                "received in the verification request claim.");
 
-  // 6. Dereference "info" parameter URI to a resource that contains the public key
-  // of the certificate used by signing service to sign a request.
-  // If there is a failure to dereference the URI due to timeout or a non-existent
-  // resource, the request is rejected (E8).
-
-  // TODO: replace this stub
-  EvpPkeyUniquePtr pub;
-  EC_KEY *ec;
-  FILE *pemfile;
-
-  pemfile = fopen("/home/sergio/tmp/ec256-public.pem", "r");
-  assert(pemfile);
-  pub.reset(PEM_read_PUBKEY(pemfile, NULL, NULL, NULL));
-  fclose(pemfile);
-  ec = EVP_PKEY_get0_EC_KEY(pub.get());
-  assert(pub && ec);
-
-  // 7. Validate the issuing CA. On the failure to authenticate the CA
-  // (for example not valid, no root CA) request will be rejected (E17).
-  if (0 /*TODO*/)
-    return VF_UNSUPPORTED_CREDENTIAL(true, "Failed to authenticate CA.");
-
-  // 8. Validate the signature of "identity" digest parameter.
-  // On failure, reject the request (E18).
-  EcdsaSigUniquePtr sig;
+  // 8. Signature of "identity" digest parameter is validated once the
+  // certificate is available.
+  check.x5u = identityInfo.str();
   BIGNUM *r, *s;
-  sig.reset(ECDSA_SIG_new());
+  check.sig.reset(ECDSA_SIG_new());
 
-  std::string sigbuf = Base64::urlDecode(signatureDigest.str());
-  if (sigbuf.size() == 64) {
-    r = BN_bin2bn((uint8_t*)sigbuf.data(), 32, NULL);
-    s = BN_bin2bn((uint8_t*)sigbuf.data()+32, 32, NULL);
+  std::array<uint8_t, base64urlDecodedSize(86)> sigbuf;
+  if (signatureDigest.size() <= 86 &&
+      base64urlDecode(signatureDigest, sigbuf.data()) == 64) {
+    r = BN_bin2bn(sigbuf.data(), 32, NULL);
+    s = BN_bin2bn(sigbuf.data()+32, 32, NULL);
   } else {
     r = BN_new();
     s = BN_new();
   }
 
-  ECDSA_SIG_set0(sig.get(), r, s);
-
-  std::string signingString = folly::sformat
-    ("{}.{}",
-     Base64::urlEncode(folly::range(headerText)),
-     Base64::urlEncode(folly::range(payloadText)));
+  ECDSA_SIG_set0(check.sig.get(), r, s);
 
-  std::array<uint8_t, 32> digest;
-  OpenSSLHash::sha256(folly::range(digest),
-                      folly::range(signingString));
+  // JWS signing input is the received "header.payload"
+  StringPiece signingString(headerDigest.begin(), payloadDigest.end());
+  OpenSSLHash::sha256(folly::range(check.digest), signingString);
+  return folly::none;
+}
 
+VerificationResponse SignatureCheck::verify(const EC_KEY *ec) const {
+  // On failure, reject the request (E18).
+  VerificationResponse response;
   if (ECDSA_do_verify(digest.begin(), digest.size(), sig.get(), ec) != 1)
-    return {438, TN_VALIDATION_FAILED, "Invalid Identity Header", "Signature validation failed."};
+    response = {438, TN_VALIDATION_FAILED, "Invalid Identity Header", "Signature validation failed."};
   else
-    return {0, TN_VALIDATION_PASSED, "", ""};
+    response = {0, TN_VALIDATION_PASSED, "", ""};
+
+  VerifiedCache &verified = VerifiedCache::get();
+  if (verified.enabled())
+    verified.insert(key, {iat, response});
+  return response;
+}
+
+/** Verify the signature with the fetched certificate of its x5u. */
+static folly::SemiFuture<VerificationResponse> fetchAndVerify(SignatureCheck check) {
+  // 6. Dereference "info" parameter URI to a resource that contains the public key
+  // of the certificate used by signing service to sign a request.
+  // If there is a failure to dereference the URI due to timeout or a non-existent
+  // resource, the request is rejected (E8).
+  // 7. Validate the issuing CA. On the failure to authenticate the CA
+  // (for example not valid, no root CA) request will be rejected (E17).
+  return CertCache::get().fetch(check.x5u)
+    .deferValue([check = std::move(check)](CertCache::CertPtr cert) mutable {
+      return CryptoPool::get().run([check = std::move(check), cert] {
+        return check.verify(cert->ec);
+      });
+    })
+    .deferError(folly::tag_t<CertError>{}, [](const CertError &err) {
+      if (err.untrusted())
+        return VF_UNSUPPORTED_CREDENTIAL(true, "Failed to authenticate CA.");
+      return VF_BAD_IDENTITY_INFO("Failed to dereference 'info' URI.");
+    });
+}
+
+folly::SemiFuture<VerificationResponse> verifyPassport(const VerificationRequest &request) {
+  SignatureCheck check;
+  if (auto rejected = checkIdentity(request, check))
+    return folly::makeSemiFuture(std::move(*rejected));
+
+  // Own keys don't need to be fetched. Keys are looked up again by the
+  // worker, hazard pointers are not handed over between threads.
+  if (KeyManager::get().verificationKey(check.x5u)) {
+    return CryptoPool::get().run([check = std::move(check)] {
+      KeyManager keys = KeyManager::get();
+      if (const KeyManager::Key *key = keys.verificationKey(check.x5u))
+        return check.verify(key->ec);
+      return VF_BAD_IDENTITY_INFO("Failed to dereference 'info' URI.");
+    });
+  }
+  return fetchAndVerify(std::move(check));
+}
+
+folly::SemiFuture<VerificationResponse> verifyPassportOnPool(VerificationRequest request) {
+  return CryptoPool::get().run([request = std::move(request)] {
+    SignatureCheck check;
+    if (auto rejected = checkIdentity(request, check))
+      return folly::makeSemiFuture(std::move(*rejected));
+
+    KeyManager keys = KeyManager::get();
+    if (const KeyManager::Key *key = keys.verificationKey(check.x5u))
+      return folly::makeSemiFuture(check.verify(key->ec));
+    return fetchAndVerify(std::move(check));
+  }).deferValue([](folly::SemiFuture<VerificationResponse> response) {
+    return response;
+  });
 }
@@ -3,7 +3,15 @@
 
 #include "StirApiTypes.h"
 
-std::string makePassport(const SigningRequest &req);
-VerificationResponse verifyPassport(const VerificationRequest &request);
+#include <folly/futures/Future.h>
+
+/** Sign `req` with the key of `req.x5u`, or the default key if empty. */
+folly::Expected<std::string, StirApiError> makePassport(const SigningRequest &req);
+/** Verify `request`, fetching the certificate of its x5u if needed. */
+folly::SemiFuture<VerificationResponse> verifyPassport(const VerificationRequest &request);
+/** As verifyPassport(), but identity checks run on a CryptoPool worker
+  * too, not only the signature. Used for batches, which would otherwise
+  * hold the I/O thread for every item. */
+folly::SemiFuture<VerificationResponse> verifyPassportOnPool(VerificationRequest request);
 
 #endif
@@ -0,0 +1,340 @@
+#include <stir/PassportCodec.h>
+
+#include <array>
+#include <cctype>
+#include <cstring>
+
+using folly::StringPiece;
+
+static const char kAlphabet[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/** Reverse alphabet, invalid characters have the high bit set. */
+static constexpr std::array<uint8_t, 256> makeDecodeTable() {
+  std::array<uint8_t, 256> table{};
+  for (auto &v : table)
+    v = 0x80;
+  for (uint8_t i = 0; i < 64; ++i)
+    table[static_cast<uint8_t>(kAlphabet[i])] = i;
+  return table;
+}
+
+static constexpr std::array<uint8_t, 256> kDecode = makeDecodeTable();
+
+char* base64urlEncode(folly::ByteRange in, char *out) noexcept {
+  const uint8_t *p = in.begin();
+  const uint8_t *end = in.end();
+
+  for (; end - p >= 3; p += 3) {
+    uint32_t v = p[0] << 16 | p[1] << 8 | p[2];
+    *out++ = kAlphabet[v >> 18];
+    *out++ = kAlphabet[(v >> 12) & 63];
+    *out++ = kAlphabet[(v >> 6) & 63];
+    *out++ = kAlphabet[v & 63];
+  }
+
+  if (end - p == 2) {
+    uint32_t v = p[0] << 16 | p[1] << 8;
+    *out++ = kAlphabet[v >> 18];
+    *out++ = kAlphabet[(v >> 12) & 63];
+    *out++ = kAlphabet[(v >> 6) & 63];
+  } else if (end - p == 1) {
+    uint32_t v = p[0] << 16;
+    *out++ = kAlphabet[v >> 18];
+    *out++ = kAlphabet[(v >> 12) & 63];
+  }
+  return out;
+}
+
+ptrdiff_t base64urlDecode(StringPiece in, uint8_t *out) noexcept {
+  while (in.endsWith('='))
+    in.pop_back();
+  if (in.size() % 4 == 1)
+    return -1;
+
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(in.begin());
+  const uint8_t *end = reinterpret_cast<const uint8_t*>(in.end());
+  uint8_t *begin = out;
+
+  for (; end - p >= 4; p += 4) {
+    uint8_t a = kDecode[p[0]], b = kDecode[p[1]], c = kDecode[p[2]], d = kDecode[p[3]];
+    if ((a | b | c | d) & 0x80)
+      return -1;
+    uint32_t v = a << 18 | b << 12 | c << 6 | d;
+    *out++ = v >> 16;
+    *out++ = v >> 8;
+    *out++ = v;
+  }
+
+  if (end - p >= 2) {
+    uint8_t a = kDecode[p[0]], b = kDecode[p[1]];
+    uint8_t c = end - p == 3 ? kDecode[p[2]] : 0;
+    if ((a | b | c) & 0x80)
+      return -1;
+    uint32_t v = a << 18 | b << 12 | c << 6;
+    *out++ = v >> 16;
+    if (end - p == 3)
+      *out++ = v >> 8;
+  }
+  return out - begin;
+}
+
+static char* put(char *out, StringPiece text) noexcept {
+  std::memcpy(out, text.data(), text.size());
+  return out + text.size();
+}
+
+static size_t digits(uint64_t n) noexcept {
+  size_t len = 1;
+  while (n >= 10) {
+    n /= 10;
+    ++len;
+  }
+  return len;
+}
+
+// {"attest":"","dest":{"tn":[]},"iat":,"orig":{"tn":""},"origid":""}
+static constexpr size_t kPayloadFraming = 66;
+
+size_t passportPayloadSize(const PassportPayload &claims) noexcept {
+  size_t size = kPayloadFraming + claims.attest.size() + digits(claims.iat) +
+    claims.orig.size() + claims.origid.size();
+  for (StringPiece tn : claims.dest)
+    size += tn.size() + 2;
+  if (!claims.dest.empty())
+    size += claims.dest.size() - 1;
+  return size;
+}
+
+char* writePassportPayload(const PassportPayload &claims, char *out) noexcept {
+  out = put(out, R"({"attest":")");
+  out = put(out, claims.attest);
+  out = put(out, R"(","dest":{"tn":[)");
+  for (size_t i = 0; i < claims.dest.size(); ++i) {
+    if (i)
+      *out++ = ',';
+    *out++ = '"';
+    out = put(out, claims.dest[i]);
+    *out++ = '"';
+  }
+  out = put(out, R"(]},"iat":)");
+  char *end = out + digits(claims.iat);
+  uint64_t iat = claims.iat;
+  for (char *p = end; p != out; iat /= 10)
+    *--p = '0' + iat % 10;
+  out = end;
+  out = put(out, R"(,"orig":{"tn":")");
+  out = put(out, claims.orig);
+  out = put(out, R"("},"origid":")");
+  out = put(out, claims.origid);
+  out = put(out, R"("})");
+  return out;
+}
+
+namespace {
+
+/** Minimal JSON reader over a mutable buffer, strings are unescaped in
+  * place and returned as views. */
+class JsonCursor {
+ public:
+  JsonCursor(char *begin, char *end) : p_(begin), end_(end) {}
+
+  bool atEnd() {
+    skipWhitespace();
+    return p_ == end_;
+  }
+
+  char peek() {
+    skipWhitespace();
+    return p_ < end_ ? *p_ : '\0';
+  }
+
+  bool consume(char c) {
+    if (peek() != c)
+      return false;
+    ++p_;
+    return true;
+  }
+
+  bool string(StringPiece &out) {
+    if (!consume('"'))
+      return false;
+    char *begin = p_;
+    char *w = p_;
+    while (p_ < end_) {
+      char c = *p_++;
+      if (c == '"') {
+        out = StringPiece(begin, w);
+        return true;
+      }
+      if (static_cast<unsigned char>(c) < 0x20)
+        return false;
+      if (c == '\\' && !unescape(c))
+        return false;
+      *w++ = c;
+    }
+    return false;
+  }
+
+  /** Member values of an object, `member(key)` parses or skips each. */
+  template <class F>
+  bool object(F &&member) {
+    if (!consume('{'))
+      return false;
+    if (consume('}'))
+      return true;
+    do {
+      StringPiece key;
+      if (!string(key) || !consume(':') || !member(key))
+        return false;
+    } while (consume(','));
+    return consume('}');
+  }
+
+  template <class F>
+  bool array(F &&element) {
+    if (!consume('['))
+      return false;
+    if (consume(']'))
+      return true;
+    do {
+      if (!element())
+        return false;
+    } while (consume(','));
+    return consume(']');
+  }
+
+  /** Skip a value, keeping its JSON text in `raw`. */
+  bool skip(StringPiece &raw, unsigned depth = 8) {
+    char c = peek();
+    char *begin = p_;
+    bool ok;
+    if (c == '"') {
+      StringPiece s;
+      ok = string(s);
+    } else if (c == '{' || c == '[') {
+      StringPiece inner;
+      auto value = [&] { return depth > 0 && skip(inner, depth - 1); };
+      ok = c == '{' ? object([&](StringPiece) { return value(); }) : array(value);
+    } else {
+      // numbers and literals
+      while (p_ < end_ && (isalnum(*p_) || *p_ == '-' || *p_ == '+' || *p_ == '.'))
+        ++p_;
+      ok = p_ != begin;
+    }
+    raw = StringPiece(begin, p_);
+    return ok;
+  }
+
+  bool skip() {
+    StringPiece raw;
+    return skip(raw);
+  }
+
+  /** String value if the next one is a string, skipped otherwise. */
+  bool optString(StringPiece &out) {
+    return peek() == '"' ? string(out) : skip();
+  }
+
+ private:
+  void skipWhitespace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+      ++p_;
+  }
+
+  bool unescape(char &c) {
+    if (p_ >= end_)
+      return false;
+    switch (*p_++) {
+    case '"': c = '"'; break;
+    case '\\': c = '\\'; break;
+    case '/': c = '/'; break;
+    case 'b': c = '\b'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'u': {
+      // claims are ASCII, other code points are rejected
+      if (end_ - p_ < 4)
+        return false;
+      unsigned code = 0;
+      for (int i = 0; i < 4; ++i) {
+        char h = *p_++;
+        code <<= 4;
+        if (h >= '0' && h <= '9') code |= h - '0';
+        else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+        else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+        else return false;
+      }
+      if (code >= 0x80)
+        return false;
+      c = static_cast<char>(code);
+      break;
+    }
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  char *p_;
+  char *end_;
+};
+
+} // namespace
+
+bool parsePassportHeader(char *begin, char *end, PassportHeader &header) {
+  JsonCursor json(begin, end);
+  return json.object([&](StringPiece key) {
+    if (key == "alg")
+      return json.optString(header.alg);
+    if (key == "ppt")
+      return json.optString(header.ppt);
+    if (key == "typ")
+      return json.optString(header.typ);
+    if (key == "x5u")
+      return json.optString(header.x5u);
+    return json.skip();
+  }) && json.atEnd();
+}
+
+bool parsePassportClaims(char *begin, char *end, PassportClaims &claims) {
+  JsonCursor json(begin, end);
+
+  // {"tn": ...} of orig and dest
+  auto tn = [&](auto &&value) {
+    if (json.peek() != '{')
+      return json.skip();
+    return json.object([&](StringPiece key) {
+      return key == "tn" ? value() : json.skip();
+    });
+  };
+
+  return json.object([&](StringPiece key) {
+    if (key == "attest")
+      return json.optString(claims.attest);
+    if (key == "iat")
+      return json.skip(claims.iat);
+    if (key == "origid")
+      return json.optString(claims.origid);
+    if (key == "orig")
+      return tn([&] { return json.optString(claims.orig); });
+    if (key == "dest") {
+      return tn([&] {
+        if (json.peek() != '[')
+          return json.skip();
+        claims.dest.clear();
+        claims.hasDest = true;
+        return json.array([&] {
+          StringPiece number;
+          if (!json.string(number))
+            return false;
+          claims.dest.push_back(number);
+          return true;
+        });
+      });
+    }
+    return json.skip();
+  }) && json.atEnd();
+}
@@ -0,0 +1,68 @@
+#ifndef STIR_PASSPORT_CODEC_H
+#define STIR_PASSPORT_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <folly/Range.h>
+#include <folly/small_vector.h>
+
+/* PASSporT encoding without generic JSON and base64 helpers. Output goes
+ * into caller buffers sized up front, parsed claims are views into the
+ * decoded buffer, which is unescaped in place. Missing claims are
+ * StringPieces with null data, present empty strings are not null. */
+
+/** Length of unpadded base64url encoding of `n` bytes. */
+constexpr size_t base64urlEncodedSize(size_t n) { return (n * 4 + 2) / 3; }
+/** Upper bound of bytes decoded from `n` base64url characters. */
+constexpr size_t base64urlDecodedSize(size_t n) { return n * 3 / 4; }
+
+/** Encode `in` without padding, returns end of output. */
+char* base64urlEncode(folly::ByteRange in, char *out) noexcept;
+
+/** Decode `in`, trailing padding is accepted. Returns number of bytes
+  * written or -1 if `in` is not base64url. */
+ptrdiff_t base64urlDecode(folly::StringPiece in, uint8_t *out) noexcept;
+
+/** Claims of the PASSporT payload to sign, `dest` sorted by the caller.
+  * Strings are not escaped, callers validate them to TN and UUID charsets. */
+struct PassportPayload {
+  folly::StringPiece attest;
+  folly::Range<const folly::StringPiece*> dest;
+  uint64_t iat;
+  folly::StringPiece orig;
+  folly::StringPiece origid;
+};
+
+/** Length of the canonical JSON of `claims`. */
+size_t passportPayloadSize(const PassportPayload &claims) noexcept;
+
+/** Write canonical JSON of `claims` (sorted keys, no whitespace),
+  * returns end of output. */
+char* writePassportPayload(const PassportPayload &claims, char *out) noexcept;
+
+struct PassportHeader {
+  folly::StringPiece alg;
+  folly::StringPiece ppt;
+  folly::StringPiece typ;
+  folly::StringPiece x5u;
+};
+
+struct PassportClaims {
+  folly::StringPiece attest;
+  folly::small_vector<folly::StringPiece, 4> dest;
+  // dest may legitimately be empty, tells it apart from missing
+  bool hasDest = false;
+  // raw JSON text of the value
+  folly::StringPiece iat;
+  folly::StringPiece orig;
+  folly::StringPiece origid;
+};
+
+/** Parse JSON object in [begin, end), unknown members are skipped and
+  * claims of unexpected type are left missing. Returns false on malformed
+  * JSON. */
+bool parsePassportHeader(char *begin, char *end, PassportHeader &header);
+bool parsePassportClaims(char *begin, char *end, PassportClaims &claims);
+
+#endif // STIR_PASSPORT_CODEC_H
@@ -0,0 +1,43 @@
+#include <stir/RequestId.h>
+
+#include <cstring>
+#include <folly/Random.h>
+
+/** Two hex digits of every byte value. */
+static constexpr std::array<char, 512> makeHexTable() {
+  constexpr char digits[] = "0123456789abcdef";
+  std::array<char, 512> table{};
+  for (unsigned i = 0; i < 256; ++i) {
+    table[i * 2] = digits[i >> 4];
+    table[i * 2 + 1] = digits[i & 15];
+  }
+  return table;
+}
+
+static constexpr std::array<char, 512> kHex = makeHexTable();
+
+char* formatUuid(const std::array<uint8_t, 16> &uuid, char *out) noexcept {
+  for (size_t i = 0; i < uuid.size(); ++i) {
+    if (i == 4 || i == 6 || i == 8 || i == 10)
+      *out++ = '-';
+    std::memcpy(out, &kHex[uuid[i] * 2], 2);
+    out += 2;
+  }
+  return out;
+}
+
+std::array<uint8_t, 16> randomUuid() noexcept {
+  // ThreadLocalPRNG, no syscall after the first use on a thread
+  uint64_t bits[2] = { folly::Random::rand64(), folly::Random::rand64() };
+  std::array<uint8_t, 16> uuid;
+  std::memcpy(uuid.data(), bits, uuid.size());
+  uuid[6] = (uuid[6] & 0x0f) | 0x40;  // version 4
+  uuid[8] = (uuid[8] & 0x3f) | 0x80;  // RFC 4122 variant
+  return uuid;
+}
+
+std::string makeRequestId() {
+  std::string id(36, '\0');
+  formatUuid(randomUuid(), &id[0]);
+  return id;
+}
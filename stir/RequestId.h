@@ -0,0 +1,19 @@
+#ifndef STIR_REQUEST_ID_H
+#define STIR_REQUEST_ID_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+/** Format `uuid` as 36 lowercase characters with dashes, returns end of
+  * output. */
+char* formatUuid(const std::array<uint8_t, 16> &uuid, char *out) noexcept;
+
+/** Random RFC 4122 version 4 UUID from the per-thread generator, which is
+  * seeded from the system CSPRNG once per thread. */
+std::array<uint8_t, 16> randomUuid() noexcept;
+
+/** X-RequestID for requests that don't carry one. */
+std::string makeRequestId();
+
+#endif // STIR_REQUEST_ID_H
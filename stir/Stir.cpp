@@ -2,8 +2,13 @@
 #include <folly/ssl/Init.h>
 #include <folly/portability/GFlags.h>
 #include <folly/system/HardwareConcurrency.h>
+#include <folly/io/async/AsyncSignalHandler.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
 #include <proxygen/httpserver/HTTPServer.h>
 
+#include <stir/KeyManager.h>
+#include <stir/CertCache.h>
+
 using namespace proxygen;
 
 DEFINE_uint32(http_port, 12000, "Port to listen on with HTTP protocol");
@@ -15,9 +20,30 @@ DEFINE_int32(threads, 0,
              "Number of threads to listen on. Numbers <= 0 "
              "will use the number of cores on this machine.");
 
+DEFINE_uint32(h2c_port, 12001,
+              "Port to listen on with HTTP/2 prior knowledge, 0 disables");
+DEFINE_uint32(h2_max_streams, 1000,
+              "Maximum concurrent HTTP/2 streams per connection");
+DECLARE_string(stir_keys);
+
 std::unique_ptr<RequestHandlerFactory> makeStirApi();
+std::unique_ptr<RequestHandlerFactory> makeStirMetrics();
 std::unique_ptr<RequestHandlerFactory> makeHttpNotFound();
 
+/** Reload keys on SIGHUP, requests in flight finish with the old ones. */
+class KeyReloader : public folly::AsyncSignalHandler {
+ public:
+  using AsyncSignalHandler::AsyncSignalHandler;
+
+  void signalReceived(int signum) noexcept override {
+    try {
+      KeyManager::load(FLAGS_stir_keys);
+    } catch (const std::exception &ex) {
+      LOG(ERROR) << "Keeping current STIR keys: " << ex.what();
+    }
+  }
+};
+
 int main(int argc, char *argv[])
 {
   folly::Init init(&argc, &argv);
@@ -30,9 +56,30 @@ int main(int argc, char *argv[])
       uint16_t port = FLAGS_http_port;
       IPs.emplace_back(folly::SocketAddress{intf, port, true},
                        HTTPServer::Protocol::HTTP);
+      if (FLAGS_h2c_port) {
+        port = FLAGS_h2c_port;
+        IPs.emplace_back(folly::SocketAddress{intf, port, true},
+                         HTTPServer::Protocol::HTTP2);
+      }
     }
   }
 
+  if (FLAGS_stir_keys.empty()) {
+    LOG(WARNING) << "No --stir_keys given, signing is disabled";
+  } else {
+    KeyManager::load(FLAGS_stir_keys);
+  }
+
+  // Fail early on a bad trust store
+  CertCache::get();
+
+  folly::ScopedEventBaseThread signalThread("StirSignals");
+  std::unique_ptr<KeyReloader> reloader;
+  signalThread.getEventBase()->runInEventBaseThreadAndWait([&] {
+    reloader = std::make_unique<KeyReloader>(signalThread.getEventBase());
+    reloader->registerSignalHandler(SIGHUP);
+  });
+
   if (FLAGS_threads <= 0) {
     FLAGS_threads = folly::hardware_concurrency();
     CHECK(FLAGS_threads > 0);
@@ -43,13 +90,18 @@ int main(int argc, char *argv[])
   options.idleTimeout = std::chrono::seconds(FLAGS_http_idle_timeout);
   options.shutdownOn = {SIGINT, SIGTERM};
   options.enableContentCompression = false;
-  options.h2cEnabled = false;
+  // HTTP/1.1 clients may upgrade, see --h2c_port for prior knowledge
+  options.h2cEnabled = true;
+  // SBCs multiplex many small requests on a few connections, the limit
+  // bounds work queued per connection
+  options.maxConcurrentIncomingStreams = FLAGS_h2_max_streams;
   // Increase the default flow control to 1MB/10MB
   options.initialReceiveWindow = uint32_t(1 << 20);
   options.receiveStreamWindowSize = uint32_t(1 << 20);
   options.receiveSessionWindowSize = 10 * (1 << 20);
   options.handlerFactories = RequestHandlerChain()
     .addThen(makeStirApi())
+    .addThen(makeStirMetrics())
     .addThen(makeHttpNotFound())
     .build();
 
@@ -60,5 +112,8 @@ int main(int argc, char *argv[])
   LOG(INFO) << "Serving requests";
   server.start();
 
+  signalThread.getEventBase()->runInEventBaseThreadAndWait([&] {
+    reloader.reset();
+  });
   return EXIT_SUCCESS;
 }
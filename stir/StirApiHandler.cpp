@@ -1,22 +1,32 @@
 #include <stir/StirApiTypes.h>
 #include <stir/Passport.h>
+#include <stir/CryptoPool.h>
+#include <stir/StirMetrics.h>
+#include <stir/RequestId.h>
 
 #include <folly/Range.h>
 #include <folly/String.h>
 #include <folly/dynamic.h>
+#include <folly/futures/Future.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/EventBaseManager.h>
 #include <proxygen/lib/http/RFC2616.h>
 #include <proxygen/httpserver/RequestHandler.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
 #include <proxygen/httpserver/ResponseBuilder.h>
 #include <proxygen/httpserver/filters/DirectResponseHandler.h>
 
-#include <uuid.h>
 #include <memory>
+#include <vector>
 
 using namespace proxygen;
 using folly::StringPiece;
 
 DEFINE_uint32(stir_api_body_limit, 32768, "Maximum size of STIR API message");
+DEFINE_uint32(stir_api_batch_body_limit, 1 << 20,
+              "Maximum size of STIR API batch message");
+DEFINE_uint32(stir_api_batch_limit, 256,
+              "Maximum number of requests in a STIR API batch");
 
 
 StringPiece getHttpAcceptValue(StringPiece headerValue) {
@@ -28,63 +38,54 @@ StringPiece getHttpAcceptValue(StringPiece headerValue) {
     return {};
 }
 
+/** Request headers the API looks at. Known headers are found by their
+  * precomputed codes, only X-RequestID is compared by name. */
 struct StirApiHeaderVisitor {
   StirApiError error;
   std::string requestId;
   int64_t contentLength = -1;
   bool jsonInput = false;
 
-  void visit(HTTPHeaderCode code, StringPiece name, StringPiece value);
-  StirApiError finalize();
-
-  void operator()(HTTPHeaderCode code, StringPiece name, StringPiece value) {
-    visit(code, name, value);
-  }
+  void visit(const HTTPHeaders &headers);
+  StirApiError finalize(uint32_t bodyLimit);
 };
 
-void StirApiHeaderVisitor::visit(HTTPHeaderCode code, StringPiece name,
-                                 StringPiece value) {
+void StirApiHeaderVisitor::visit(const HTTPHeaders &headers) {
+  static const std::string kRequestId = "X-RequestID";
   StringPiece token;
 
-  switch (code) {
-  case HTTP_HEADER_CONTENT_LENGTH:
-    if (auto maybe = folly::tryTo<uint32_t>(value))
+  if (headers.exists(HTTP_HEADER_CONTENT_LENGTH)) {
+    token = headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_LENGTH);
+    if (auto maybe = folly::tryTo<uint32_t>(token))
       contentLength = maybe.value();
     else
       contentLength = 0;
-    break;
-  case HTTP_HEADER_CONTENT_TYPE:
-    token = value;
-    token = token.split_step(";");
-    token = folly::trimWhitespace(token);
-    if (token == "application/json")
-      jsonInput = true;
-    break;
-  case HTTP_HEADER_ACCEPT:
-    token = getHttpAcceptValue(value);
+  }
+
+  token = headers.getSingleOrEmpty(HTTP_HEADER_CONTENT_TYPE);
+  token = token.split_step(";");
+  token = folly::trimWhitespace(token);
+  if (token == "application/json")
+    jsonInput = true;
+
+  if (headers.exists(HTTP_HEADER_ACCEPT)) {
+    token = getHttpAcceptValue(headers.getSingleOrEmpty(HTTP_HEADER_ACCEPT));
     if (token != "application/json" && token != "*/*") {
       error = STIR_SVC_NOT_ACCEPTABLE_RESPONSE_BODY_TYPE;
       error.putVariable(token);
     }
-    break;
-  case HTTP_HEADER_OTHER:
-    token = name;
-    if (token.equals("X-RequestID", folly::AsciiCaseInsensitive()))
-      requestId = value;
-    break;
-  default:
-    // ignore
-    break;
   }
+
+  requestId = headers.getSingleOrEmpty(kRequestId);
 }
 
-StirApiError StirApiHeaderVisitor::finalize() {
+StirApiError StirApiHeaderVisitor::finalize(uint32_t bodyLimit) {
+  // Content-Length is optional, HTTP/2 and chunked requests may omit it;
+  // onBody() enforces the limit on the received length anyway
   if (!jsonInput) {
     error = STIR_SVC_UNSUPPORTED_REQUEST_BODY_TYPE;
     error.putVariable("application/json");
-  } else if (contentLength == -1) {
-    error = STIR_SVC_MISSING_BODY_LENGTH;
-  } else if (contentLength >= FLAGS_stir_api_body_limit) {
+  } else if (contentLength >= bodyLimit) {
     error = STIR_SVC_FAILED_TO_PARSE_MSG_BODY;
     error.putVariable("invalid message body length specified");
   }
@@ -93,14 +94,16 @@ StirApiError StirApiHeaderVisitor::finalize() {
 
 class StirApiHandler final : public RequestHandler {
  public:
+  using Response = folly::Expected<std::string, StirApiError>;
+
   void onRequest(std::unique_ptr<HTTPMessage> req) noexcept override {
     const StringPiece path = req->getPathAsStringPiece();
     StirApiHeaderVisitor hVisitor;
 
     // Find or generate RequestId
-    req->getHeaders().forEachWithCode(std::ref(hVisitor));
+    hVisitor.visit(req->getHeaders());
     if (hVisitor.requestId.empty()) {
-      generateRequestId();
+      requestId_ = makeRequestId();
     } else {
       requestId_ = std::move(hVisitor.requestId);
     }
@@ -114,75 +117,160 @@ class StirApiHandler final : public RequestHandler {
       endpoint_ = Endpoint::SIGN;
     } else if (path == "/stir/v1/verification") {
       endpoint_ = Endpoint::VERIFY;
+    } else if (path == "/stir/v1/signing/batch") {
+      endpoint_ = Endpoint::SIGN_BATCH;
+      bodyLimit_ = FLAGS_stir_api_batch_body_limit;
+    } else if (path == "/stir/v1/verification/batch") {
+      endpoint_ = Endpoint::VERIFY_BATCH;
+      bodyLimit_ = FLAGS_stir_api_batch_body_limit;
     } else {
       error_ = STIR_SVC_RESOURCE_NOT_FOUND;
       return;
     }
 
-    error_ = hVisitor.finalize();
-    if (!error_)
-      body_.reserve(hVisitor.contentLength);
+    error_ = hVisitor.finalize(bodyLimit_);
   }
 
   void onBody(std::unique_ptr<folly::IOBuf> pkt) noexcept override {
-    if (!error_)
-      body_ += StringPiece(pkt->coalesce());
-  }
-
-  void generateRequestId() {
-    uuid_t randomId;
-    uuid_generate_random(randomId);
-    requestId_.resize(37);
-    uuid_unparse(randomId, requestId_.data());
+    if (error_)
+      return;
+    // Chunks are kept as received and parsed in place on EOM
+    request_.append(std::move(pkt));
+    if (request_.chainLength() >= bodyLimit_) {
+      error_ = STIR_SVC_FAILED_TO_PARSE_MSG_BODY;
+      error_.putVariable("message body is too long");
+      request_.reset();
+    }
   }
 
   void onEOM() noexcept override {
-    if (!error_)
-      handleRequest();
-
-    if (error_) {
-      body_ = error_.toBody();
-      sendResponse(error_.http_status());
-    } else {
-      sendResponse(200);
-    }
+    if (error_)
+      return sendError();
+
+    // Crypto runs on CryptoPool and verification may wait for a certificate
+    // fetch, the response is sent from this thread once it completes
+    folly::SemiFuture<Response> response = handleRequest();
+    if (response.isReady())
+      return finish(std::move(response).getTry());
+
+    pending_ = true;
+    std::move(response)
+      .via(folly::getKeepAliveToken(folly::EventBaseManager::get()->getEventBase()))
+      .thenTry([this](folly::Try<Response> result) {
+        pending_ = false;
+        if (aborted_)
+          delete this;
+        else
+          finish(std::move(result));
+      });
   }
 
-  void handleRequest() {
+  folly::SemiFuture<Response> handleRequest() {
     using SignMsg = StirApiType<SigningRequest>;
     using VerifyMsg = StirApiType<VerificationRequest>;
 
-    folly::Expected<std::string, StirApiError> response;
-
     switch (endpoint_) {
-    case Endpoint::SIGN:
-      response = SignMsg::fromJson(std::move(body_))
-        .then([this](SigningRequest req) {
-          return SignMsg::toBody(doSigning(req));
+    case Endpoint::SIGN: {
+      auto req = SignMsg::fromBody(requestBody());
+      if (req.hasError())
+        return folly::makeSemiFuture<Response>(folly::makeUnexpected(std::move(req).error()));
+      return CryptoPool::get().run([req = std::move(req).value()] {
+        return makePassport(req).then([](std::string identity) {
+          return SignMsg::toBody(SigningResponse{ identity });
         });
-      break;
-    case Endpoint::VERIFY:
-      response = VerifyMsg::fromJson(std::move(body_))
-        .then([this](VerificationRequest req) {
-          return VerifyMsg::toBody(doVerification(req));
+      });
+    }
+    case Endpoint::VERIFY: {
+      auto req = VerifyMsg::fromBody(requestBody());
+      if (req.hasError())
+        return folly::makeSemiFuture<Response>(folly::makeUnexpected(std::move(req).error()));
+      return doVerification(req.value())
+        .deferValue([](VerificationResponse resp) {
+          return Response(VerifyMsg::toBody(resp));
+        });
+    }
+    case Endpoint::SIGN_BATCH:
+      return handleBatch<SigningRequest>([](SigningRequest req) {
+        return CryptoPool::get().run([req = std::move(req)] {
+          return makePassport(req).then([](std::string identity) {
+            return SigningResponse{ identity };
+          });
         });
-      break;
+      });
+    case Endpoint::VERIFY_BATCH:
+      return handleBatch<VerificationRequest>([](VerificationRequest req) {
+        return verifyPassportOnPool(std::move(req))
+          .deferValue([](VerificationResponse resp) {
+            return StirApiType<VerificationRequest>::Result(std::move(resp));
+          });
+      });
     }
+    folly::assume_unreachable();
+  }
 
-    if (response.hasError())
-      error_ = std::move(response).error();
-    else
-      body_ = std::move(response).value();
+  /** Start every valid item of a batch with `start`, items run on crypto
+    * workers concurrently and are answered in request order. */
+  template<class M, class F>
+  folly::SemiFuture<Response> handleBatch(F &&start) {
+    using Ops = StirApiType<M>;
+    using Result = typename Ops::Result;
+
+    auto batch = Ops::fromBatchBody(requestBody(), FLAGS_stir_api_batch_limit);
+    if (batch.hasError())
+      return folly::makeSemiFuture<Response>(folly::makeUnexpected(std::move(batch).error()));
+
+    std::vector<folly::SemiFuture<Result>> items;
+    items.reserve(batch->size());
+    for (auto &req : batch.value()) {
+      if (req.hasError())
+        items.push_back(folly::makeSemiFuture<Result>(folly::makeUnexpected(std::move(req).error())));
+      else
+        items.push_back(start(std::move(req).value()));
+    }
+
+    return folly::collectAll(std::move(items))
+      .deferValue([](std::vector<folly::Try<Result>> done) {
+        std::vector<Result> results;
+        results.reserve(done.size());
+        for (folly::Try<Result> &item : done) {
+          if (item.hasException())
+            results.push_back(folly::makeUnexpected(StirApiError(STIR_POL_INTERNAL_ERROR)));
+          else
+            results.push_back(std::move(item).value());
+        }
+        return Response(Ops::toBatchBody(results));
+      });
+  }
+
+  const folly::IOBuf& requestBody() {
+    static const folly::IOBuf kEmpty;
+    return request_.empty() ? kEmpty : *request_.front();
   }
 
-  SigningResponse doSigning(const SigningRequest &req) {
-    return { makePassport(req) };
+  void finish(folly::Try<Response> result) {
+    if (result.hasException())
+      error_ = STIR_POL_INTERNAL_ERROR;
+    else if (result->hasError())
+      error_ = std::move(result->error());
+    else
+      body_ = std::move(result->value());
+
+    if (error_)
+      sendError();
+    else
+      sendResponse(200);
   }
 
-  VerificationResponse doVerification(const VerificationRequest &req) {
+  folly::SemiFuture<VerificationResponse>
+  doVerification(const VerificationRequest &req) {
     return verifyPassport(req);
   }
 
+  void sendError() {
+    body_ = error_.toBody();
+    sendResponse(error_.http_status());
+  }
+
   void sendResponse(int status) {
     ResponseBuilder(downstream_)
       .status(status, HTTPMessage::getDefaultReason(status))
@@ -201,16 +289,24 @@ class StirApiHandler final : public RequestHandler {
   }
 
   void onError(ProxygenError err) noexcept override {
-    delete this;
+    if (pending_)
+      aborted_ = true;
+    else
+      delete this;
   }
 
  private:
-  enum class Endpoint { SIGN, VERIFY };
+  enum class Endpoint { SIGN, VERIFY, SIGN_BATCH, VERIFY_BATCH };
 
   std::string requestId_;
   Endpoint endpoint_;
+  uint32_t bodyLimit_ = FLAGS_stir_api_body_limit;
   StirApiError error_;
+  folly::IOBufQueue request_{folly::IOBufQueue::cacheChainLength()};
   std::string body_;
+  // response is being computed, deletion deferred until it completes
+  bool pending_ = false;
+  bool aborted_ = false;
 };
 
 class StirApiFactory : public RequestHandlerFactory {
@@ -236,6 +332,28 @@ std::unique_ptr<RequestHandlerFactory> makeStirApi()
   return std::make_unique<StirApiFactory>();
 }
 
+class StirMetricsFactory : public RequestHandlerFactory {
+ public:
+  void onServerStart(folly::EventBase* /*evb*/) noexcept override {
+  }
+
+  void onServerStop() noexcept override {
+  }
+
+  RequestHandler* onRequest(RequestHandler *upstream, HTTPMessage *msg) noexcept override {
+    if (msg->getPathAsStringPiece() == "/metrics") {
+      return new DirectResponseHandler(200, "OK", renderStirMetrics());
+    } else {
+      return upstream;
+    }
+  }
+};
+
+std::unique_ptr<RequestHandlerFactory> makeStirMetrics()
+{
+  return std::make_unique<StirMetricsFactory>();
+}
+
 class HttpNotFound : public RequestHandlerFactory {
  public:
   void onServerStart(folly::EventBase* /*evb*/) noexcept override {
@@ -5,6 +5,7 @@
 #include <folly/json.h>
 #include <folly/Conv.h>
 #include <folly/DynamicConverter.h>
+#include <folly/io/IOBuf.h>
 
 #include <uuid.h>
 #include <algorithm>
@@ -91,19 +92,15 @@ struct FromJsonVisitor {
   void visit(const dynamic &d);
 };
 
-template<class M> folly::Expected<M, StirApiError>
-StirApiType<M>::fromJson(const dynamic &d) {
+/** Run `visit(visitor)` and map conversion errors to StirApiError. */
+template<class M, class F> static folly::Expected<M, StirApiError>
+decodeMessage(F &&visit) {
   FromJsonVisitor<M> visitor;
   StirApiError err;
 
   try {
-    if (d.isString()) {
-      dynamic json = parseJson(d.stringPiece());
-      visitor.visit(visitor.unwrap(json));
-    } else {
-      visitor.visit(d);
-    }
-    if (err = validate(visitor.msg))
+    visit(visitor);
+    if (err = StirApiType<M>::validate(visitor.msg))
       return folly::makeUnexpected(std::move(err));
     return std::move(visitor.msg);
   } catch (const folly::json::parse_error& e) {
@@ -124,9 +121,115 @@ StirApiType<M>::fromJson(const dynamic &d) {
   return folly::makeUnexpected(std::move(err));
 }
 
+template<class M> folly::Expected<M, StirApiError>
+StirApiType<M>::fromJson(const dynamic &d) {
+  if (d.isString())
+    return fromBody(d.stringPiece());
+  return decodeMessage<M>([&](FromJsonVisitor<M> &visitor) {
+    visitor.visit(d);
+  });
+}
+
+template<class M> folly::Expected<M, StirApiError>
+StirApiType<M>::fromBody(StringPiece body) {
+  return decodeMessage<M>([&](FromJsonVisitor<M> &visitor) {
+    dynamic json = folly::parseJson(body);
+    visitor.visit(visitor.unwrap(json));
+  });
+}
+
+/** Call `f` with text of `body`, chains are joined once. */
+template<class F> static auto withBodyText(const folly::IOBuf &body, F &&f) {
+  // Bodies mostly arrive in a single buffer
+  if (!body.isChained())
+    return f(StringPiece(folly::ByteRange(body.data(), body.length())));
+  std::string text;
+  text.reserve(body.computeChainDataLength());
+  for (folly::ByteRange chunk : body)
+    text.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+  return f(StringPiece(text));
+}
+
+template<class M> folly::Expected<M, StirApiError>
+StirApiType<M>::fromBody(const folly::IOBuf &body) {
+  return withBodyText(body, [](StringPiece text) { return fromBody(text); });
+}
+
+/** Member names of batch bodies. */
+template<class M> struct BatchNames;
+
+template<> struct BatchNames<SigningRequest> {
+  static constexpr const char *requests = "signingRequests";
+  static constexpr const char *response = "signingResponse";
+  static constexpr const char *responses = "signingResponses";
+};
+
+template<> struct BatchNames<VerificationRequest> {
+  static constexpr const char *requests = "verificationRequests";
+  static constexpr const char *response = "verificationResponse";
+  static constexpr const char *responses = "verificationResponses";
+};
+
+template<class M>
+folly::Expected<std::vector<folly::Expected<M, StirApiError>>, StirApiError>
+StirApiType<M>::fromBatchBody(const folly::IOBuf &body, size_t limit) {
+  using Batch = std::vector<folly::Expected<M, StirApiError>>;
+  const char *param = BatchNames<M>::requests;
+  StirApiError err;
+
+  dynamic json;
+  try {
+    json = withBodyText(body, [](StringPiece text) { return folly::parseJson(text); });
+  } catch (const folly::json::parse_error& e) {
+    err = STIR_SVC_FAILED_TO_PARSE_MSG_BODY;
+    err.putVariable("invalid JSON body");
+    return folly::makeUnexpected(std::move(err));
+  }
+
+  const dynamic *items = json.isObject() ? json.get_ptr(param) : nullptr;
+  if (!items) {
+    err = STIR_SVC_MISSING_INFORMATION;
+    err.putVariable(param);
+    return folly::makeUnexpected(std::move(err));
+  }
+  if (!items->isArray() || items->empty() || items->size() > limit) {
+    err = STIR_SVC_INVALID_PARAMETER_VALUE;
+    err.putVariable(param);
+    err.putVariable(folly::to<std::string>("should contain 1 to ", limit, " requests"));
+    return folly::makeUnexpected(std::move(err));
+  }
+
+  Batch batch;
+  batch.reserve(items->size());
+  for (const dynamic &item : *items) {
+    if (item.isObject()) {
+      batch.push_back(fromJson(item));
+    } else {
+      StirApiError bad = STIR_SVC_INVALID_PARAMETER_VALUE;
+      bad.putVariable(param);
+      bad.putVariable("should contain objects");
+      batch.push_back(folly::makeUnexpected(std::move(bad)));
+    }
+  }
+  return batch;
+}
+
+template<class M> std::string
+StirApiType<M>::toBatchBody(const std::vector<Result> &results) {
+  dynamic items = dynamic::array;
+  for (const Result &result : results) {
+    if (result.hasValue())
+      items.push_back(dynamic::object(BatchNames<M>::response, toJson(result.value())));
+    else
+      items.push_back(dynamic::object("requestError", result.error().toJson()));
+  }
+  return folly::toJson(dynamic::object(BatchNames<M>::responses, std::move(items)));
+}
+
 static bool validateTN(const fbstring &tn) {
   static const char* acceptedChars = "0123456789*#+.-()";
-  auto pred = [](char c) { return !!strchr(acceptedChars, c); };
+  // strchr() also finds the terminating NUL
+  auto pred = [](char c) { return c != '\0' && strchr(acceptedChars, c); };
   return std::all_of(tn.begin(), tn.end(), pred);
 }
 
@@ -185,6 +288,9 @@ template<> void FromJsonVisitor<SigningRequest>::visit(const dynamic &d) {
   msg.origid = folly::convertTo<fbstring>(d[param]);
   param = "iat";
   msg.iat = folly::convertTo<uint64_t>(d[param]);
+  param = "x5u";
+  if (const dynamic *x5u = d.get_ptr(param))
+    msg.x5u = folly::convertTo<fbstring>(*x5u);
 }
 
 template<> const dynamic& FromJsonVisitor<SigningRequest>::unwrap(const dynamic &d) {
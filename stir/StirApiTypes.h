@@ -5,9 +5,11 @@
 #include <folly/FBVector.h>
 #include <folly/Range.h>
 #include <folly/Expected.h>
+#include <vector>
 
 namespace folly {
   struct dynamic;
+  class IOBuf;
 }
 
 struct SigningRequest {
@@ -16,6 +18,8 @@ struct SigningRequest {
   uint64_t iat;
   folly::fbstring orig;
   folly::fbstring origid;
+  // optional, selects the signing key
+  folly::fbstring x5u;
 };
 
 struct SigningResponse {
@@ -78,8 +82,21 @@ template<class M>
 struct StirApiType {
   static StirApiError validate(const M &msg);
   static folly::Expected<M, StirApiError> fromJson(const folly::dynamic& json);
+  /** Parse JSON request body, without copying it unless it is chained. */
+  static folly::Expected<M, StirApiError> fromBody(folly::StringPiece body);
+  static folly::Expected<M, StirApiError> fromBody(const folly::IOBuf &body);
   static folly::dynamic toJson(const typename ResponseFor<M>::type &msg);
   static std::string toBody(const typename ResponseFor<M>::type &msg);
+
+  /** Outcome of one request of a batch. */
+  using Result = folly::Expected<typename ResponseFor<M>::type, StirApiError>;
+  /** Parse body of a batch request with 1 to `limit` items. Errors of the
+    * batch as a whole are returned as error, each item is validated on
+    * its own and keeps its own error. */
+  static folly::Expected<std::vector<folly::Expected<M, StirApiError>>, StirApiError>
+  fromBatchBody(const folly::IOBuf &body, size_t limit);
+  /** Responses and errors of batch items in request order. */
+  static std::string toBatchBody(const std::vector<Result> &results);
 };
 
 template<>
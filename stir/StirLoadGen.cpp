@@ -0,0 +1,285 @@
+#include <glog/logging.h>
+#include <folly/init/Init.h>
+#include <folly/Conv.h>
+#include <folly/ssl/Init.h>
+#include <folly/Format.h>
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/portability/GFlags.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/codec/HTTP2Framer.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <lib/LoadGenReport.h>
+#include <stir/KeyManager.h>
+#include <stir/Passport.h>
+
+using namespace proxygen;
+using Clock = std::chrono::steady_clock;
+using TimePoint = Clock::time_point;
+
+DEFINE_string(host, "127.0.0.1", "Address of stird under test");
+DEFINE_uint32(http_port, 12000, "HTTP/1.1 port of stird");
+DEFINE_uint32(h2c_port, 12001, "HTTP/2 prior knowledge port of stird");
+DEFINE_string(protocol, "http1", "http1 (keep-alive) or h2c (prior knowledge)");
+DEFINE_string(endpoint, "sign", "sign or verify");
+DEFINE_uint32(duration, 10, "Seconds to generate load for");
+DEFINE_uint32(threads, 1, "Number of event loops to split the load across");
+DEFINE_uint32(connections, 4, "Connections per thread");
+DEFINE_uint32(streams, 32, "Requests in flight per h2c connection, "
+              "HTTP/1.1 connections have one");
+DEFINE_uint32(timeout_ms, 1000, "Count a request as lost after this time");
+DECLARE_string(stir_keys);
+
+/** Closed-loop load: every connection keeps its requests in flight for
+  * `--duration` seconds, so the reply rate is the server throughput at
+  * that concurrency. */
+
+struct Stats {
+  // microseconds from write to complete reply
+  std::vector<uint32_t> latency;
+  uint64_t ok = 0;
+  uint64_t bad = 0;
+  uint64_t lost = 0;
+
+  void merge(Stats &&other) {
+    latency.insert(latency.end(), other.latency.begin(), other.latency.end());
+    ok += other.ok;
+    bad += other.bad;
+    lost += other.lost;
+  }
+};
+
+struct Workload {
+  std::string path;
+  std::string body;
+  // substring of a successful response
+  std::string expect;
+};
+
+class Connection;
+
+/** One POST, deletes itself when its transaction is detached. */
+class Request : public HTTPTransactionHandler {
+ public:
+  explicit Request(Connection *conn) : conn_(conn), sent_(Clock::now()) {}
+
+  void setTransaction(HTTPTransaction *txn) noexcept override {}
+  void detachTransaction() noexcept override;
+
+  void onHeadersComplete(std::unique_ptr<HTTPMessage> msg) noexcept override {
+    status_ = msg->getStatusCode();
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> chain) noexcept override {
+    for (folly::ByteRange range : *chain)
+      body_.append(reinterpret_cast<const char*>(range.data()), range.size());
+  }
+
+  void onTrailers(std::unique_ptr<HTTPHeaders>) noexcept override {}
+  void onEOM() noexcept override { complete_ = true; }
+  void onUpgrade(UpgradeProtocol) noexcept override {}
+  void onError(const HTTPException &error) noexcept override {
+    LOG_FIRST_N(WARNING, 20) << error.what();
+  }
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  Connection *conn_;
+  TimePoint sent_;
+  unsigned status_ = 0;
+  bool complete_ = false;
+  std::string body_;
+};
+
+class Connection : private HTTPConnector::Callback {
+ public:
+  Connection(folly::EventBase *evb, const Workload &work, Stats &stats, TimePoint end)
+    : work_(work), stats_(stats), end_(end)
+    , connector_(this, &evb->timer())
+  {
+    bool h2c = FLAGS_protocol == "h2c";
+    if (h2c)
+      connector_.setPlaintextProtocol(http2::kProtocolCleartextString);
+    limit_ = h2c ? FLAGS_streams : 1;
+    folly::SocketAddress addr(FLAGS_host, h2c ? FLAGS_h2c_port : FLAGS_http_port, true);
+    connector_.connect(evb, addr, std::chrono::milliseconds(FLAGS_timeout_ms));
+  }
+
+  /** Count requests still in flight as lost and close. */
+  void abandon() {
+    abandoned_ = true;
+    stats_.lost += inflight_;
+    if (session_)
+      session_->dropConnection();
+  }
+
+  void finished(TimePoint sent, unsigned status, bool complete, folly::StringPiece body) {
+    --inflight_;
+    if (abandoned_)
+      return;
+    TimePoint now = Clock::now();
+    if (!complete) {
+      ++stats_.lost;
+    } else {
+      using namespace std::chrono;
+      stats_.latency.push_back(duration_cast<microseconds>(now - sent).count());
+      ++(status == 200 && body.find(work_.expect) != folly::StringPiece::npos
+         ? stats_.ok : stats_.bad);
+    }
+    fill();
+  }
+
+ private:
+  void connectSuccess(HTTPUpstreamSession *session) override {
+    session_ = session;
+    fill();
+  }
+
+  void connectError(const folly::AsyncSocketException &ex) override {
+    LOG(ERROR) << "Connect failed: " << ex.what();
+  }
+
+  void fill() {
+    if (!session_)
+      return;
+    if (Clock::now() >= end_ || session_->isClosing()) {
+      // the session deletes itself once idle
+      if (inflight_ == 0) {
+        session_->closeWhenIdle();
+        session_ = nullptr;
+      }
+      return;
+    }
+    while (inflight_ < limit_) {
+      auto *req = new Request(this);
+      HTTPTransaction *txn = session_->newTransaction(req);
+      if (!txn) {
+        delete req;
+        return;
+      }
+      ++inflight_;
+
+      HTTPMessage msg;
+      msg.setMethod(HTTPMethod::POST);
+      msg.setURL(work_.path);
+      msg.getHeaders().set(HTTP_HEADER_HOST, FLAGS_host);
+      msg.getHeaders().set(HTTP_HEADER_CONTENT_TYPE, "application/json");
+      msg.getHeaders().set(HTTP_HEADER_ACCEPT, "application/json");
+      msg.getHeaders().set(HTTP_HEADER_CONTENT_LENGTH,
+                           folly::to<std::string>(work_.body.size()));
+      txn->setIdleTimeout(std::chrono::milliseconds(FLAGS_timeout_ms));
+      txn->sendHeaders(msg);
+      txn->sendBody(folly::IOBuf::copyBuffer(work_.body));
+      txn->sendEOM();
+    }
+  }
+
+  const Workload &work_;
+  Stats &stats_;
+  TimePoint end_;
+  HTTPConnector connector_;
+  HTTPUpstreamSession *session_ = nullptr;
+  unsigned limit_;
+  unsigned inflight_ = 0;
+  bool abandoned_ = false;
+};
+
+void Request::detachTransaction() noexcept {
+  conn_->finished(sent_, status_, complete_, body_);
+  delete this;
+}
+
+/** Event loop driving its share of connections. */
+class Worker {
+ public:
+  Worker(const Workload &work, TimePoint end) : work_(work), end_(end) {}
+
+  void run() {
+    evb_.runInEventBaseThread([this] {
+      for (uint32_t i = 0; i < FLAGS_connections; ++i)
+        conns_.push_back(std::make_unique<Connection>(&evb_, work_, stats, end_));
+
+      using namespace std::chrono;
+      auto deadline = end_ + milliseconds(FLAGS_timeout_ms) - Clock::now();
+      evb_.runAfterDelay([this] {
+        for (auto &conn : conns_)
+          conn->abandon();
+        evb_.terminateLoopSoon();
+      }, duration_cast<milliseconds>(deadline).count());
+    });
+    evb_.loopForever();
+  }
+
+  Stats stats;
+
+ private:
+  folly::EventBase evb_;
+  const Workload &work_;
+  TimePoint end_;
+  std::vector<std::unique_ptr<Connection>> conns_;
+};
+
+static Workload makeWorkload() {
+  using namespace std::chrono;
+  uint64_t now = duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+  SigningRequest sign{"A", {"12355551212"}, now, "12155551212",
+                      "de305d54-75b4-431b-adb2-eb6b9e546014", ""};
+
+  if (FLAGS_endpoint == "sign") {
+    return {"/stir/v1/signing", folly::sformat(
+        R"({{"signingRequest":{{"attest":"{}","dest":{{"tn":["{}"]}},)"
+        R"("iat":{},"orig":{{"tn":"{}"}},"origid":"{}"}}}})",
+        sign.attest, sign.dest[0], sign.iat, sign.orig, sign.origid),
+      "\"identity\""};
+  }
+
+  // stird must list the same x5u to verify without fetching it
+  CHECK(FLAGS_endpoint == "verify") << "Unknown --endpoint";
+  CHECK(!FLAGS_stir_keys.empty()) << "Verification needs --stir_keys to sign with";
+  KeyManager::load(FLAGS_stir_keys);
+  std::string identity = makePassport(sign).value();
+  return {"/stir/v1/verification", folly::sformat(
+      R"({{"verificationRequest":{{"from":{{"tn":"{}"}},"identity":"{}",)"
+      R"("time":{},"to":{{"tn":["{}"]}}}}}})",
+      sign.orig, identity, now, sign.dest[0]),
+    "TN-Validation-Passed"};
+}
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+  folly::ssl::init();
+  CHECK(FLAGS_threads > 0);
+  CHECK(FLAGS_protocol == "http1" || FLAGS_protocol == "h2c") << "Unknown --protocol";
+
+  Workload work = makeWorkload();
+  TimePoint end = Clock::now() + std::chrono::seconds(FLAGS_duration);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (unsigned i = 0; i < FLAGS_threads; ++i)
+    workers.push_back(std::make_unique<Worker>(work, end));
+
+  std::vector<std::thread> threads;
+  for (auto &worker : workers)
+    threads.emplace_back([&worker] { worker->run(); });
+  for (auto &thread : threads)
+    thread.join();
+
+  Stats total;
+  for (auto &worker : workers)
+    total.merge(std::move(worker->stats));
+
+  std::cout << folly::format(
+      "{} {} over {}: {} ok, {} invalid, {} lost, {:.1f} replies/s\n",
+      FLAGS_endpoint, work.path, FLAGS_protocol, total.ok, total.bad,
+      total.lost, (total.ok + total.bad) / double(FLAGS_duration));
+  reportPercentiles(std::cout, "latency", total.latency);
+  return total.bad + total.lost ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+#include <stir/StirMetrics.h>
+#include <stir/VerifiedCache.h>
+#include <stir/NoncePool.h>
+
+#include <folly/Format.h>
+
+static void renderMetric(std::string &out, const char *name, const char *type,
+                         const char *help, const char *labels, uint64_t value) {
+  folly::format(&out, "# HELP {} {}\n# TYPE {} {}\n{}{} {}\n",
+                name, help, name, type, name, labels, value);
+}
+
+std::string renderStirMetrics() {
+  std::string out;
+
+  VerifiedCache::Stats verified = VerifiedCache::get().stats();
+  renderMetric(out, "stir_verified_cache_lookups_total", "counter",
+               "Verified PASSporT cache lookups", "{result=\"hit\"}", verified.hits);
+  folly::format(&out, "stir_verified_cache_lookups_total{{result=\"miss\"}} {}\n",
+                verified.misses);
+  renderMetric(out, "stir_verified_cache_evictions_total", "counter",
+               "Verified PASSporTs evicted to make room", "", verified.evictions);
+  renderMetric(out, "stir_verified_cache_entries", "gauge",
+               "Verified PASSporTs cached", "", verified.size);
+
+  NoncePool::Stats nonces = NoncePool::stats();
+  renderMetric(out, "stir_ecdsa_nonces_total", "counter",
+               "Signatures by source of their ECDSA nonce", "{source=\"pool\"}", nonces.hits);
+  folly::format(&out, "stir_ecdsa_nonces_total{{source=\"inline\"}} {}\n",
+                nonces.misses);
+  renderMetric(out, "stir_ecdsa_nonces_precomputed_total", "counter",
+               "ECDSA nonces computed in background", "", nonces.precomputed);
+  renderMetric(out, "stir_ecdsa_nonce_pool_entries", "gauge",
+               "Precomputed ECDSA nonces ready", "", nonces.size);
+  renderMetric(out, "stir_ecdsa_nonce_pool_target", "gauge",
+               "Precomputed ECDSA nonces kept for the signing rate", "", nonces.target);
+
+  return out;
+}
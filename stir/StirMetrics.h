@@ -0,0 +1,9 @@
+#ifndef STIR_STIR_METRICS_H
+#define STIR_STIR_METRICS_H
+
+#include <string>
+
+/** Render STIR service metrics in Prometheus text exposition format. */
+std::string renderStirMetrics();
+
+#endif // STIR_STIR_METRICS_H
@@ -0,0 +1,118 @@
+#include <stir/VerifiedCache.h>
+
+#include <cstring>
+#include <mutex>
+#include <folly/container/EvictingCacheMap.h>
+#include <folly/portability/GFlags.h>
+#include <folly/ssl/OpenSSLHash.h>
+
+using folly::ssl::OpenSSLHash;
+
+DEFINE_uint32(passport_cache_size, 65536,
+              "Number of verified PASSporTs to remember, 0 disables the cache");
+
+// Lookups of different identities rarely share a lock
+static constexpr size_t kShards = 64;
+
+namespace {
+
+struct KeyHash {
+  size_t operator()(const VerifiedCache::Key &key) const noexcept {
+    size_t hash;
+    std::memcpy(&hash, key.data(), sizeof(hash));
+    return hash;
+  }
+};
+
+} // namespace
+
+struct VerifiedCache::Shard {
+  Shard() : entries(0) {}
+
+  std::mutex lock;
+  folly::EvictingCacheMap<Key, Entry, KeyHash> entries;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+};
+
+VerifiedCache::VerifiedCache(size_t capacity)
+  : capacity_(capacity)
+{
+  if (!capacity_)
+    return;
+  shards_.reset(new Shard[kShards]);
+  for (size_t i = 0; i < kShards; ++i)
+    shards_[i].entries.setMaxSize((capacity_ + kShards - 1) / kShards);
+}
+
+VerifiedCache::~VerifiedCache() = default;
+
+VerifiedCache& VerifiedCache::get() {
+  static VerifiedCache *cache = new VerifiedCache(FLAGS_passport_cache_size);
+  return *cache;
+}
+
+VerifiedCache::Key VerifiedCache::key(const VerificationRequest &request) {
+  OpenSSLHash::Digest digest;
+  digest.hash_init(EVP_sha256());
+  // Every field and the number of `to` entries are length prefixed, so
+  // no two requests hash the same bytes whatever the fields contain
+  auto addLength = [&](uint64_t length) {
+    uint8_t bytes[sizeof(length)];
+    for (size_t i = 0; i < sizeof(length); ++i)
+      bytes[i] = uint8_t(length >> (8 * i));
+    digest.hash_update(folly::range(bytes));
+  };
+  auto add = [&](folly::StringPiece field) {
+    addLength(field.size());
+    digest.hash_update(folly::ByteRange(field));
+  };
+  add(request.identity);
+  add(request.from);
+  addLength(request.to.size());
+  for (const auto &tn : request.to)
+    add(tn);
+
+  Key key;
+  digest.hash_final(folly::range(key));
+  return key;
+}
+
+folly::Optional<VerifiedCache::Entry> VerifiedCache::find(const Key &key) {
+  if (!capacity_)
+    return folly::none;
+  Shard &shard = shards_[key[8] % kShards];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    ++shard.misses;
+    return folly::none;
+  }
+  ++shard.hits;
+  return it->second;
+}
+
+void VerifiedCache::insert(const Key &key, Entry entry) {
+  if (!capacity_)
+    return;
+  Shard &shard = shards_[key[8] % kShards];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  shard.entries.set(key, std::move(entry), true,
+                    [&](Key, Entry&&) { ++shard.evictions; });
+}
+
+VerifiedCache::Stats VerifiedCache::stats() const {
+  Stats stats;
+  if (!capacity_)
+    return stats;
+  for (size_t i = 0; i < kShards; ++i) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.size += shard.entries.size();
+  }
+  return stats;
+}
@@ -0,0 +1,54 @@
+#ifndef STIR_VERIFIED_CACHE_H
+#define STIR_VERIFIED_CACHE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include <folly/Optional.h>
+
+#include "StirApiTypes.h"
+
+/** Bounded cache of PASSporT verification outcomes. The same Identity
+  * header is verified many times along a call path, a hit skips decoding,
+  * JSON parsing and the signature check. Only outcomes of the signature
+  * check are cached; time freshness is rechecked on every hit. */
+class VerifiedCache {
+ public:
+  /** SHA-256 over identity and the numbers compared with its claims. */
+  using Key = std::array<uint8_t, 32>;
+
+  struct Entry {
+    uint64_t iat;
+    VerificationResponse response;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+  };
+
+  /** Up to `capacity` entries, 0 disables the cache. */
+  explicit VerifiedCache(size_t capacity);
+  ~VerifiedCache();
+
+  /** Shared cache sized by `--passport_cache_size`. */
+  static VerifiedCache& get();
+
+  static Key key(const VerificationRequest &request);
+
+  bool enabled() const noexcept { return capacity_ > 0; }
+  folly::Optional<Entry> find(const Key &key);
+  void insert(const Key &key, Entry entry);
+  Stats stats() const;
+
+ private:
+  struct Shard;
+
+  size_t capacity_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+#endif // STIR_VERIFIED_CACHE_H
@@ -0,0 +1,153 @@
+#include <stir/CertCache.h>
+
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <folly/portability/GTest.h>
+#include <folly/ssl/Init.h>
+#include <folly/synchronization/Baton.h>
+#include <folly/testing/TestUtil.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <proxygen/httpserver/filters/DirectResponseHandler.h>
+#include <openssl/pem.h>
+
+using namespace proxygen;
+using folly::ssl::EvpPkeyUniquePtr;
+using folly::ssl::X509UniquePtr;
+
+/** Self-signed P-256 certificate in PEM. */
+static std::string makeCert() {
+  folly::ssl::EcKeyUniquePtr ec(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+  EC_KEY_generate_key(ec.get());
+  EvpPkeyUniquePtr pkey(EVP_PKEY_new());
+  EVP_PKEY_assign_EC_KEY(pkey.get(), ec.release());
+
+  X509UniquePtr cert(X509_new());
+  X509_set_version(cert.get(), 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert.get()), -60);
+  X509_gmtime_adj(X509_getm_notAfter(cert.get()), 3600);
+  X509_set_pubkey(cert.get(), pkey.get());
+  X509_NAME *name = X509_get_subject_name(cert.get());
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char*)"SHAKEN Test", -1, -1, 0);
+  X509_set_issuer_name(cert.get(), name);
+  X509_sign(cert.get(), pkey.get(), EVP_sha256());
+
+  folly::ssl::BioUniquePtr bio(BIO_new(BIO_s_mem()));
+  PEM_write_bio_X509(bio.get(), cert.get());
+  char *data;
+  long size = BIO_get_mem_data(bio.get(), &data);
+  return std::string(data, size);
+}
+
+/** Local stand-in for a certificate repository. */
+class CertServer : public RequestHandlerFactory {
+ public:
+  explicit CertServer(std::string pem) : pem_(std::move(pem)) {}
+
+  void onServerStart(folly::EventBase*) noexcept override {}
+  void onServerStop() noexcept override {}
+
+  RequestHandler* onRequest(RequestHandler*, HTTPMessage *msg) noexcept override {
+    ++requests;
+    if (msg->getPathAsStringPiece() != "/cert.pem")
+      return new DirectResponseHandler(404, "Not Found", "");
+    return new DirectResponseHandler(200, "OK", pem_);
+  }
+
+  std::atomic<int> requests{0};
+
+ private:
+  std::string pem_;
+};
+
+class CertCacheTest : public testing::Test {
+ public:
+  void SetUp() override {
+    folly::ssl::init();
+    pem = makeCert();
+    auto handler = std::make_unique<CertServer>(pem);
+    repo = handler.get();
+
+    HTTPServerOptions options;
+    options.threads = 1;
+    options.handlerFactories.push_back(std::move(handler));
+    server = std::make_unique<HTTPServer>(std::move(options));
+    server->bind({{folly::SocketAddress("127.0.0.1", 0), HTTPServer::Protocol::HTTP}});
+
+    folly::Baton<> started;
+    thread = std::thread([&] { server->start([&] { started.post(); }); });
+    started.wait();
+    folly::SocketAddress addr;
+    server->getSockets()[0]->getAddress(&addr);
+    base = "http://127.0.0.1:" + std::to_string(addr.getPort());
+
+    // Fetch tests serve a self-signed certificate
+    insecure.skipValidation = true;
+  }
+
+  void TearDown() override {
+    server->stop();
+    thread.join();
+  }
+
+ protected:
+  std::string pem;
+  CertServer *repo;
+  std::unique_ptr<HTTPServer> server;
+  std::thread thread;
+  std::string base;
+  // as with --x5u_insecure_skip_validation
+  CertCache::Options insecure;
+};
+
+TEST_F(CertCacheTest, Coalesce) {
+  CertCache cache(insecure);
+  std::vector<folly::SemiFuture<CertCache::CertPtr>> fetches;
+  for (int i = 0; i < 8; ++i)
+    fetches.push_back(cache.fetch(base + "/cert.pem"));
+
+  CertCache::CertPtr first = std::move(fetches[0]).get();
+  ASSERT_TRUE(first && first->ec);
+  for (size_t i = 1; i < fetches.size(); ++i)
+    EXPECT_EQ(std::move(fetches[i]).get(), first);
+
+  // Served from cache
+  EXPECT_EQ(cache.fetch(base + "/cert.pem").isReady(), true);
+  EXPECT_EQ(repo->requests.load(), 1);
+}
+
+TEST_F(CertCacheTest, Failures) {
+  CertCache cache(insecure);
+  EXPECT_THROW(cache.fetch(base + "/missing.pem").get(), CertError);
+  EXPECT_THROW(cache.fetch(base + "/missing.pem").get(), CertError);
+  EXPECT_EQ(repo->requests.load(), 1);
+  EXPECT_THROW(cache.fetch("http://127.0.0.1:1/cert.pem").get(), CertError);
+  EXPECT_THROW(cache.fetch("not a url").get(), CertError);
+}
+
+TEST_F(CertCacheTest, TrustStore) {
+  folly::test::TemporaryDirectory dir;
+  std::string trusted = (dir.path() / "trusted.pem").string();
+  std::string other = (dir.path() / "other.pem").string();
+  std::ofstream(trusted) << pem;
+  std::ofstream(other) << makeCert();
+
+  CertCache::Options opts;
+  opts.trustStore = trusted;
+  EXPECT_TRUE(CertCache(opts).fetch(base + "/cert.pem").get());
+
+  // Signed by another CA or nothing to validate with
+  for (std::string store : {other, std::string()}) {
+    opts.trustStore = store;
+    try {
+      CertCache(opts).fetch(base + "/cert.pem").get();
+      FAIL() << store;
+    } catch (const CertError &err) {
+      EXPECT_TRUE(err.untrusted());
+    }
+  }
+}
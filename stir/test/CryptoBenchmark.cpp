@@ -0,0 +1,58 @@
+#include <stir/CryptoPool.h>
+
+#include <array>
+#include <vector>
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <folly/ssl/Init.h>
+#include <folly/ssl/OpenSSLHash.h>
+#include <folly/ssl/OpenSSLPtrTypes.h>
+#include <folly/system/HardwareConcurrency.h>
+
+using folly::ssl::EcdsaSigUniquePtr;
+
+/** Compare ES256 verification on the calling thread with CryptoPool.
+  * Pool numbers include the hand-over to workers and back. */
+
+static folly::ssl::EcKeyUniquePtr key;
+static std::array<uint8_t, 32> digest;
+static EcdsaSigUniquePtr sig;
+
+static bool verify() {
+  return ECDSA_do_verify(digest.data(), digest.size(), sig.get(), key.get()) == 1;
+}
+
+BENCHMARK(verifyInline, n) {
+  for (unsigned i = 0; i < n; ++i)
+    folly::doNotOptimizeAway(verify());
+}
+
+static void verifyPool(unsigned n, unsigned threads) {
+  folly::BenchmarkSuspender braces;
+  CryptoPool pool(threads, 32, 65536);
+  std::vector<folly::SemiFuture<bool>> results;
+  results.reserve(n);
+  braces.dismiss();
+
+  for (unsigned i = 0; i < n; ++i)
+    results.push_back(pool.run(verify));
+  folly::doNotOptimizeAway(folly::collectAll(results).get());
+}
+
+BENCHMARK_RELATIVE_PARAM(verifyPool, 1)
+BENCHMARK_RELATIVE_PARAM(verifyPool, 4)
+BENCHMARK_RELATIVE_PARAM(verifyPool, 16)
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+  folly::ssl::init();
+
+  key.reset(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+  EC_KEY_generate_key(key.get());
+  std::string text = "eyJhbGciOiJFUzI1NiJ9.eyJpYXQiOjE0NDMyMDgzNDV9";
+  folly::ssl::OpenSSLHash::sha256(folly::range(digest), folly::range(text));
+  sig.reset(ECDSA_do_sign(digest.data(), digest.size(), key.get()));
+
+  folly::runBenchmarks();
+  return 0;
+}
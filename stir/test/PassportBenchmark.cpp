@@ -0,0 +1,81 @@
+#include <stir/PassportCodec.h>
+
+#include <algorithm>
+#include <folly/Benchmark.h>
+#include <folly/FBVector.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/json.h>
+#include <folly/init/Init.h>
+#include <folly/small_vector.h>
+#include <proxygen/lib/utils/Base64.h>
+
+using folly::StringPiece;
+using proxygen::Base64;
+
+/** Compare PASSporT payload encoding and decoding through sformat,
+  * proxygen Base64 and folly::dynamic with PassportCodec. */
+
+static const folly::fbvector<std::string> kDest = {"12355551213", "12355551212"};
+static const char *kOrig = "12155551212";
+static const char *kOrigid = "de305d54-75b4-431b-adb2-eb6b9e546014";
+static const uint64_t kIat = 1443208345;
+static std::string encodedPayload;
+
+BENCHMARK(encodeDynamic, n) {
+  for (unsigned i = 0; i < n; ++i) {
+    folly::fbvector<StringPiece> dest(kDest.begin(), kDest.end());
+    std::sort(dest.begin(), dest.end());
+    std::string payload = folly::sformat
+      (R"({{"attest":"{}","dest":{{"tn":["{}"]}},"iat":{},"orig":{{"tn":"{}"}},"origid":"{}"}})",
+       "A", folly::join("\",\"", dest), kIat, kOrig, kOrigid);
+    folly::doNotOptimizeAway(Base64::urlEncode(folly::range(payload)));
+  }
+}
+
+BENCHMARK_RELATIVE(encodeCodec, n) {
+  for (unsigned i = 0; i < n; ++i) {
+    folly::small_vector<StringPiece, 8> dest(kDest.begin(), kDest.end());
+    std::sort(dest.begin(), dest.end());
+    PassportPayload claims{"A", folly::range(dest), kIat, kOrig, kOrigid};
+    folly::small_vector<char, 512> payload(passportPayloadSize(claims));
+    writePassportPayload(claims, payload.data());
+    char out[base64urlEncodedSize(512)];
+    folly::doNotOptimizeAway(base64urlEncode(
+        folly::ByteRange(StringPiece(payload.data(), payload.size())), out));
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(decodeDynamic, n) {
+  for (unsigned i = 0; i < n; ++i) {
+    folly::dynamic payload = folly::parseJson(Base64::urlDecode(encodedPayload));
+    folly::doNotOptimizeAway(payload["dest"]["tn"] == folly::dynamic::array(kDest[1], kDest[0]));
+  }
+}
+
+BENCHMARK_RELATIVE(decodeCodec, n) {
+  for (unsigned i = 0; i < n; ++i) {
+    folly::small_vector<char, 512> text(base64urlDecodedSize(encodedPayload.size()));
+    ptrdiff_t size = base64urlDecode(encodedPayload, (uint8_t*)text.data());
+    PassportClaims claims;
+    parsePassportClaims(text.data(), text.data() + size, claims);
+    folly::doNotOptimizeAway(claims.dest.size() == 2 && claims.dest[0] == kDest[1]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  folly::Init init(&argc, &argv);
+
+  folly::small_vector<StringPiece, 8> dest(kDest.begin(), kDest.end());
+  std::sort(dest.begin(), dest.end());
+  PassportPayload claims{"A", folly::range(dest), kIat, kOrig, kOrigid};
+  std::string payload(passportPayloadSize(claims), '\0');
+  writePassportPayload(claims, &payload[0]);
+  encodedPayload.resize(base64urlEncodedSize(payload.size()));
+  base64urlEncode(folly::ByteRange(StringPiece(payload)), &encodedPayload[0]);
+
+  folly::runBenchmarks();
+  return 0;
+}
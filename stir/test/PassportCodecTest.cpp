@@ -0,0 +1,104 @@
+#include <stir/PassportCodec.h>
+
+#include <string>
+#include <folly/portability/GTest.h>
+
+using folly::StringPiece;
+
+static std::string encode(StringPiece in) {
+  std::string out(base64urlEncodedSize(in.size()), '\0');
+  char *end = base64urlEncode(folly::ByteRange(in), &out[0]);
+  EXPECT_EQ(end, out.data() + out.size());
+  return out;
+}
+
+static std::string decode(StringPiece in) {
+  std::string out(base64urlDecodedSize(in.size()), '\0');
+  ptrdiff_t n = base64urlDecode(in, (uint8_t*)&out[0]);
+  if (n < 0)
+    return "<invalid>";
+  out.resize(n);
+  return out;
+}
+
+TEST(PassportCodec, Base64url) {
+  // RFC 4648 test vectors without padding
+  EXPECT_EQ(encode(""), "");
+  EXPECT_EQ(encode("f"), "Zg");
+  EXPECT_EQ(encode("fo"), "Zm8");
+  EXPECT_EQ(encode("foo"), "Zm9v");
+  EXPECT_EQ(encode("foob"), "Zm9vYg");
+  EXPECT_EQ(encode("fooba"), "Zm9vYmE");
+  EXPECT_EQ(encode("foobar"), "Zm9vYmFy");
+  EXPECT_EQ(encode("\xfb\xff"), "-_8");
+
+  EXPECT_EQ(decode("Zm9vYmE"), "fooba");
+  EXPECT_EQ(decode("Zm9vYg=="), "foob");
+  EXPECT_EQ(decode("-_8"), "\xfb\xff");
+  EXPECT_EQ(decode("Zm9vY"), "<invalid>");
+  EXPECT_EQ(decode("Zm9+"), "<invalid>");
+  EXPECT_EQ(decode("Zm.v"), "<invalid>");
+
+  std::string bytes;
+  for (int i = 0; i < 256; ++i)
+    bytes.push_back(static_cast<char>(i));
+  EXPECT_EQ(decode(encode(bytes)), bytes);
+}
+
+TEST(PassportCodec, CanonicalPayload) {
+  StringPiece dest[] = {"12355551212", "12355551213"};
+  PassportPayload claims;
+  claims.attest = "A";
+  claims.dest = folly::range(dest);
+  claims.iat = 1443208345;
+  claims.orig = "12155551212";
+  claims.origid = "de305d54-75b4-431b-adb2-eb6b9e546014";
+
+  std::string out(passportPayloadSize(claims), '\0');
+  EXPECT_EQ(writePassportPayload(claims, &out[0]), out.data() + out.size());
+  EXPECT_EQ(out,
+            R"({"attest":"A","dest":{"tn":["12355551212","12355551213"]},)"
+            R"("iat":1443208345,"orig":{"tn":"12155551212"},)"
+            R"("origid":"de305d54-75b4-431b-adb2-eb6b9e546014"})");
+}
+
+TEST(PassportCodec, ParseClaims) {
+  std::string text =
+    R"({ "origid": "x", "attest" : "B", "iat": 1443208345, "extra": [{"a": null}],)"
+    R"( "orig": {"tn": "12155551212"}, "dest": {"tn": ["1", "2"]} })";
+  PassportClaims claims;
+  ASSERT_TRUE(parsePassportClaims(&text[0], &text[0] + text.size(), claims));
+  EXPECT_EQ(claims.attest, "B");
+  EXPECT_EQ(claims.iat, "1443208345");
+  EXPECT_EQ(claims.orig, "12155551212");
+  EXPECT_EQ(claims.origid, "x");
+  EXPECT_TRUE(claims.hasDest);
+  ASSERT_EQ(claims.dest.size(), 2);
+  EXPECT_EQ(claims.dest[1], "2");
+
+  // wrong types are reported as missing claims
+  text = R"({"attest": 1, "orig": "12155551212", "dest": {"tn": "1"}})";
+  claims = PassportClaims();
+  ASSERT_TRUE(parsePassportClaims(&text[0], &text[0] + text.size(), claims));
+  EXPECT_EQ(claims.attest.data(), nullptr);
+  EXPECT_EQ(claims.orig.data(), nullptr);
+  EXPECT_FALSE(claims.hasDest);
+
+  for (std::string bad : {"", "[]", R"({"attest":"A")", R"({"attest":"A"} x)",
+                          R"({"attest":"\u00e9"})", R"({"x":[[[[[[[[[[]]]]]]]]]]})"}) {
+    claims = PassportClaims();
+    EXPECT_FALSE(parsePassportClaims(&bad[0], &bad[0] + bad.size(), claims)) << bad;
+  }
+}
+
+TEST(PassportCodec, ParseHeader) {
+  std::string text =
+    R"({"alg":"ES256","ppt":"shaken","typ":"passport",)"
+    R"("x5u":"https:\/\/cert.example.org\/passport.cer"})";
+  PassportHeader header;
+  ASSERT_TRUE(parsePassportHeader(&text[0], &text[0] + text.size(), header));
+  EXPECT_EQ(header.alg, "ES256");
+  EXPECT_EQ(header.ppt, "shaken");
+  EXPECT_EQ(header.typ, "passport");
+  EXPECT_EQ(header.x5u, "https://cert.example.org/passport.cer");
+}
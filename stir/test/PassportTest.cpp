@@ -0,0 +1,149 @@
+#include <stir/KeyManager.h>
+#include <stir/NoncePool.h>
+#include <stir/Passport.h>
+#include <stir/VerifiedCache.h>
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <folly/ssl/Init.h>
+#include <folly/ssl/OpenSSLHash.h>
+#include <folly/testing/TestUtil.h>
+#include <openssl/pem.h>
+
+using namespace testing;
+using folly::ssl::BioUniquePtr;
+
+DECLARE_uint32(valid_iat_period);
+
+static const char *kX5u = "https://cert.example.org/passport.cer";
+
+/** Generate a P-256 key and write it to `path`. */
+static void writeKey(const std::string &path) {
+  folly::ssl::EcKeyUniquePtr ec(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+  ASSERT_TRUE(ec && EC_KEY_generate_key(ec.get()));
+  BioUniquePtr bio(BIO_new_file(path.c_str(), "w"));
+  ASSERT_TRUE(bio);
+  ASSERT_TRUE(PEM_write_bio_ECPrivateKey(bio.get(), ec.get(), nullptr,
+                                         nullptr, 0, nullptr, nullptr));
+}
+
+TEST(Passport, SignAndVerify) {
+  folly::ssl::init();
+  folly::test::TemporaryDirectory dir;
+  std::string pem = (dir.path() / "key.pem").string();
+  std::string csv = (dir.path() / "keys.csv").string();
+  writeKey(pem);
+  std::ofstream(csv) << "# x5u,pem\n" << kX5u << "," << pem << "\n";
+  KeyManager::load(csv);
+
+  {
+    KeyManager keys = KeyManager::get();
+    ASSERT_TRUE(keys.signingKey());
+    EXPECT_EQ(keys.signingKey(), keys.signingKey(kX5u));
+    EXPECT_EQ(keys.signingKey("https://unknown"), nullptr);
+  }
+
+  using namespace std::chrono;
+  uint64_t now = duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+  SigningRequest sreq{"A", {"12355551212"}, now - 30, "12155551212",
+                      "de305d54-75b4-431b-adb2-eb6b9e546014", ""};
+  std::string identity = makePassport(sreq).value();
+  EXPECT_THAT(identity, EndsWith(std::string(";info=<") + kX5u + ">"));
+
+  VerificationRequest vreq{identity, {"12355551212"}, "12155551212", now};
+  VerificationResponse vresp = verifyPassport(vreq).get();
+  EXPECT_EQ(vresp.reasonCode, 0);
+  EXPECT_THAT(vresp.verStat, Eq("TN-Validation-Passed"));
+
+  // Repeated verification is answered from cache, freshness is rechecked
+  uint64_t hits = VerifiedCache::get().stats().hits;
+  EXPECT_EQ(verifyPassport(vreq).get().reasonCode, 0);
+  EXPECT_EQ(VerifiedCache::get().stats().hits, hits + 1);
+  FLAGS_valid_iat_period = 20;
+  EXPECT_EQ(verifyPassport(vreq).get().reasonCode, 403);
+  EXPECT_EQ(VerifiedCache::get().stats().hits, hits + 2);
+  FLAGS_valid_iat_period = 60;
+
+  // Unknown signing key is a parameter error
+  sreq.x5u = "https://unknown";
+  EXPECT_THAT(makePassport(sreq).error().reflect(),
+              StrEq("STIR_SVC_INVALID_PARAMETER_VALUE"));
+
+  // Broken reload keeps the current keys
+  std::ofstream(csv) << kX5u << "\n";
+  EXPECT_THROW(KeyManager::load(csv), std::runtime_error);
+  EXPECT_TRUE(KeyManager::get().signingKey(kX5u));
+
+  // x5u would break the JSON header or the info parameter
+  for (const char *x5u : {"https://cert\"", "https://cert\\", "https://cert>", "https://a b"}) {
+    std::ofstream(csv) << x5u << "," << pem << "\n";
+    EXPECT_THROW(KeyManager::load(csv), std::runtime_error) << x5u;
+  }
+  EXPECT_TRUE(KeyManager::get().signingKey(kX5u));
+}
+
+TEST(Passport, PrecomputedNonces) {
+  folly::ssl::init();
+  folly::ssl::EcKeyUniquePtr ec(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+  ASSERT_TRUE(ec && EC_KEY_generate_key(ec.get()));
+  std::shared_ptr<NoncePool> pool = NoncePool::create(ec.get());
+  ASSERT_TRUE(pool);
+
+  // The refill thread fills the ring shortly after creation
+  for (int i = 0; i < 500 && pool->size() == 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_GT(pool->size(), 0);
+
+  // Signatures verify and no nonce is used twice, also after the ring
+  // runs dry and signing falls back to fresh nonces
+  uint64_t hits = NoncePool::stats().hits;
+  std::array<uint8_t, 32> digest;
+  std::set<std::string> rs;
+  for (int i = 0; i < 200; ++i) {
+    std::string text = "header.payload" + std::to_string(i);
+    folly::ssl::OpenSSLHash::sha256(folly::range(digest), folly::range(text));
+    folly::ssl::EcdsaSigUniquePtr sig = pool->sign(folly::range(digest));
+    ASSERT_TRUE(sig);
+    EXPECT_EQ(ECDSA_do_verify(digest.data(), digest.size(), sig.get(), ec.get()), 1);
+
+    const BIGNUM *r, *s;
+    ECDSA_SIG_get0(sig.get(), &r, &s);
+    std::string rbin(BN_num_bytes(r), '\0');
+    BN_bn2bin(r, reinterpret_cast<uint8_t*>(&rbin[0]));
+    EXPECT_TRUE(rs.insert(rbin).second);
+  }
+  EXPECT_GT(NoncePool::stats().hits, hits);
+}
+
+TEST(Passport, VerifiedCacheKey) {
+  VerificationRequest a{"identity", {std::string("\0" "2", 2)}, "1", 0};
+  VerificationRequest b{"identity", {"2"}, std::string("1\0", 2), 0};
+  VerificationRequest c{"identity", {"1", "2"}, "", 0};
+  VerificationRequest d{"identity", {"2"}, "1", 0};
+  std::set<VerifiedCache::Key> keys;
+  for (const auto *request : {&a, &b, &c, &d})
+    EXPECT_TRUE(keys.insert(VerifiedCache::key(*request)).second);
+
+  // Only the fields compared with the PASSporT are part of the key
+  d.time = 1443208345;
+  EXPECT_EQ(keys.count(VerifiedCache::key(d)), 1);
+}
+
+TEST(Passport, VerifiedCacheBound) {
+  VerifiedCache cache(64);
+  VerifiedCache::Key key{};
+  for (uint32_t i = 0; i < 1000; ++i) {
+    std::memcpy(key.data() + 8, &i, sizeof(i));
+    cache.insert(key, {i, {}});
+  }
+  VerifiedCache::Stats stats = cache.stats();
+  EXPECT_LE(stats.size, 64);
+  EXPECT_EQ(stats.size + stats.evictions, 1000);
+  EXPECT_FALSE(VerifiedCache(0).find(key));
+}
@@ -1,9 +1,12 @@
 #include <stir/StirApiTypes.h>
+#include <stir/RequestId.h>
 
 #include <folly/portability/GMock.h>
 #include <folly/portability/GTest.h>
 #include <folly/Preprocessor.h>
 #include <folly/dynamic.h>
+#include <folly/json.h>
+#include <folly/io/IOBuf.h>
 #include <proxygen/httpserver/Mocks.h>
 #include <proxygen/httpserver/RequestHandler.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
@@ -77,6 +80,12 @@ TEST(StirApiTypes, Signing) {
   EXPECT_THAT(msg.dest, ElementsAre("12355551212"));
   EXPECT_EQ(msg.iat, 1443208345);
   EXPECT_THAT(msg.origid, Eq("de305d54-75b4-431b-adb2-eb6b9e546014"));
+  EXPECT_TRUE(msg.x5u.empty());
+
+  // Optional key selector
+  dynamic keyed = sample;
+  keyed["x5u"] = "https://cert.example.org/passport.cer";
+  EXPECT_THAT(Ops::fromJson(keyed).value().x5u, Eq("https://cert.example.org/passport.cer"));
 
   // SVC4001: missing parameter
   for (auto param : {"attest", "orig", "dest", "iat", "origid"}) {
@@ -103,6 +112,7 @@ TEST(StirApiTypes, Signing) {
   CORRUPT("attest", "X"); // bad value
   CORRUPT("origid", "not-an-uuid"); // bad value
   CORRUPT("orig", "+1 2155 551 212"); // bad value
+  CORRUPT("x5u", dynamic::array()); // bad type
 #undef CORRUPT
 }
 
@@ -126,6 +136,100 @@ TEST(StirApiTypes, Verification) {
   EXPECT_THAT(msg.to, ElementsAre("12355551212"));
   EXPECT_EQ(msg.time, 1443208345);
   EXPECT_TRUE(msg.identity.size() > 0);
+
+  // JSON may escape NUL, it is not a valid TN character
+  dynamic bad = sample;
+  bad["from"] = dynamic::object("tn", std::string("1215555121\0", 11));
+  EXPECT_PARSE_ERROR("SVC4005", "from");
+  bad = sample;
+  bad["to"] = dynamic::object("tn", dynamic::array(std::string("\0", 1)));
+  EXPECT_PARSE_ERROR("SVC4005", "to");
+}
+
+TEST(StirApiTypes, BodyChain) {
+  using Ops = StirApiType<VerificationRequest>;
+
+  std::string body = folly::toJson(dynamic::object
+    ("verificationRequest", dynamic::object
+     ("from", dynamic::object("tn", "12155551212"))
+     ("to", dynamic::object("tn", dynamic::array("12355551212")))
+     ("time", 1443208345)
+     ("identity", "a.b.c;info=<https://cert.example.org/passport.cer>")));
+
+  // Request bodies arrive in chunks split anywhere
+  auto chain = folly::IOBuf::copyBuffer(body.data(), 7);
+  chain->prependChain(folly::IOBuf::copyBuffer(body.data() + 7, body.size() - 7));
+  VerificationRequest msg = Ops::fromBody(*chain).value();
+  EXPECT_THAT(msg.from, Eq("12155551212"));
+  EXPECT_THAT(msg.to, ElementsAre("12355551212"));
+  EXPECT_EQ(msg.time, 1443208345);
+
+  chain->coalesce();
+  EXPECT_THAT(Ops::fromBody(*chain).value().identity,
+              Eq("a.b.c;info=<https://cert.example.org/passport.cer>"));
+
+  auto result = Ops::fromBody(folly::IOBuf());
+  ASSERT_FALSE(result);
+  EXPECT_THAT(result.error().toJson()["serviceException"]["messageId"].asString(),
+              Eq("SVC4006"));
+}
+
+TEST(StirApiTypes, Batch) {
+  using Ops = StirApiType<SigningRequest>;
+  auto messageId = [](const StirApiError &err) {
+    return err.toJson()["serviceException"]["messageId"].asString();
+  };
+
+  dynamic item = dynamic::object
+    ("attest", "A")
+    ("orig", dynamic::object("tn", "12155551212"))
+    ("dest", dynamic::object("tn", dynamic::array("12355551212")))
+    ("iat", 1443208345)
+    ("origid", "de305d54-75b4-431b-adb2-eb6b9e546014");
+  dynamic broken = item;
+  broken.erase("iat");
+
+  // Each item keeps its own outcome
+  auto body = folly::IOBuf::copyBuffer(folly::toJson(dynamic::object
+    ("signingRequests", dynamic::array(item, broken, "text"))));
+  auto batch = Ops::fromBatchBody(*body, 3).value();
+  ASSERT_EQ(3, batch.size());
+  EXPECT_THAT(batch[0].value().orig, Eq("12155551212"));
+  EXPECT_THAT(messageId(batch[1].error()), Eq("SVC4001"));
+  EXPECT_THAT(messageId(batch[2].error()), Eq("SVC4005"));
+
+  // Errors of the whole batch
+  EXPECT_THAT(messageId(Ops::fromBatchBody(*body, 2).error()), Eq("SVC4005"));
+  EXPECT_THAT(messageId(Ops::fromBatchBody(folly::IOBuf(), 2).error()), Eq("SVC4006"));
+  auto empty = folly::IOBuf::copyBuffer(R"({"signingRequests":[]})");
+  EXPECT_THAT(messageId(Ops::fromBatchBody(*empty, 2).error()), Eq("SVC4005"));
+  auto single = folly::IOBuf::copyBuffer(folly::toJson(dynamic::object("signingRequest", item)));
+  EXPECT_THAT(messageId(Ops::fromBatchBody(*single, 2).error()), Eq("SVC4001"));
+
+  // Responses are listed in request order
+  std::vector<Ops::Result> results;
+  results.push_back(SigningResponse{"a.b.c"});
+  results.push_back(folly::makeUnexpected(std::move(batch[1].error())));
+  dynamic out = folly::parseJson(Ops::toBatchBody(results));
+  ASSERT_EQ(2, out["signingResponses"].size());
+  EXPECT_THAT(out["signingResponses"][0]["signingResponse"]["identity"].asString(), Eq("a.b.c"));
+  EXPECT_THAT(out["signingResponses"][1]["requestError"]["serviceException"]["messageId"].asString(),
+              Eq("SVC4001"));
+}
+
+TEST(RequestId, Format) {
+  std::array<uint8_t, 16> uuid = {0xde, 0x30, 0x5d, 0x54, 0x75, 0xb4, 0x43, 0x1b,
+                                  0xad, 0xb2, 0xeb, 0x6b, 0x9e, 0x54, 0x60, 0x14};
+  char text[36];
+  EXPECT_EQ(formatUuid(uuid, text), text + 36);
+  EXPECT_THAT(std::string(text, 36), Eq("de305d54-75b4-431b-adb2-eb6b9e546014"));
+
+  std::string a = makeRequestId(), b = makeRequestId();
+  ASSERT_EQ(a.size(), 36);
+  EXPECT_NE(a, b);
+  // version 4, RFC 4122 variant
+  EXPECT_EQ(a[14], '4');
+  EXPECT_THAT(std::string("89ab"), HasSubstr(std::string(1, a[19])));
 }
 
 #if 0